@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include "adaptive.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Tile cost and index, sorted busiest first */
+typedef struct _TileCost
+{
+    uint cost;
+    uint index;
+} TileCost;
+
+/* Bands of the cost map handled by one worker */
+typedef struct _CostJob
+{
+    const ImageGeometry *geometry;
+    const AdaptiveMap *map;
+    const unsigned char *pixels;
+    unsigned char mask[16]; // bits embedding leaves alone, per byte of a vector
+    TileCost *costs;
+    uint first_band, last_band;
+    pthread_t thread;
+    int started;            // thread was created and has to be joined
+} CostJob;
+
+size_t adaptive_tile_count(const ImageGeometry *geometry, size_t data_size, size_t header_bytes)
+{
+    size_t rows = data_size / geometry->row_stride;
+    if (rows > geometry->height)
+        rows = geometry->height;
+    uint first_row = payload_start_row(geometry, header_bytes);
+    if (rows <= first_row)
+        return 0;
+    // the cost of a band also reads the row below it
+    return (rows - first_row - 1) / ROWS_PER_CHUNK * (geometry->width / ADAPTIVE_TILE_W);
+}
+
+size_t adaptive_payload_capacity(const ImageGeometry *geometry, size_t data_size, size_t header_bytes, uint channel_mask, uint k)
+{
+    size_t tiles = adaptive_tile_count(geometry, data_size, header_bytes);
+    size_t tile_slots = (size_t)ADAPTIVE_TILE_W * ROWS_PER_CHUNK * channel_count(channel_mask);
+    size_t unit = k ? 8 * (((size_t)1 << k) - 1) : 8;
+    size_t capacity = 0;
+
+    // every batch of tiles is coded on its own
+    for (size_t first = 0; first < tiles; first += ADAPTIVE_BATCH)
+    {
+        size_t n = tiles - first < ADAPTIVE_BATCH ? tiles - first : ADAPTIVE_BATCH;
+        capacity += n * tile_slots / unit * (k ? k : 1);
+    }
+    return capacity;
+}
+
+/*
+ * Texture of one tile: for every byte of its rows the |difference| to
+ * the same byte of the next pixel and of the next row, LSB-free bits
+ * only. SSE2 does 16 bytes per psadbw, the row below and the pixel to
+ * the right are plain unaligned loads, so a tile is a few dozen ops.
+ */
+static uint tile_cost(const unsigned char *tile, const ImageGeometry *geometry, const unsigned char *mask)
+{
+    uint bpp = geometry->bytes_per_pixel;
+    uint n = ADAPTIVE_TILE_W * bpp;
+    uint cost = 0;
+
+#ifdef __SSE2__
+    __m128i keep = _mm_loadu_si128((const __m128i *)mask);
+    __m128i sum = _mm_setzero_si128();
+    for (uint r = 0; r < ROWS_PER_CHUNK; r++, tile += geometry->row_stride)
+    {
+        for (uint i = 0; i < n; i += 16)
+        {
+            __m128i here = _mm_and_si128(_mm_loadu_si128((const __m128i *)(tile + i)), keep);
+            __m128i right = _mm_and_si128(_mm_loadu_si128((const __m128i *)(tile + i + bpp)), keep);
+            __m128i below = _mm_and_si128(_mm_loadu_si128((const __m128i *)(tile + geometry->row_stride + i)), keep);
+            sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_sad_epu8(here, right), _mm_sad_epu8(here, below)));
+        }
+    }
+    cost = (uint)(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+#else
+    for (uint r = 0; r < ROWS_PER_CHUNK; r++, tile += geometry->row_stride)
+    {
+        for (uint i = 0; i < n; i++)
+        {
+            int here = tile[i] & mask[i % 16];
+            int right = tile[i + bpp] & mask[i % 16];
+            int below = tile[geometry->row_stride + i] & mask[i % 16];
+            cost += (uint)(abs(here - right) + abs(here - below));
+        }
+    }
+#endif
+    return cost;
+}
+
+static void *cost_worker(void *arg)
+{
+    CostJob *job = arg;
+    const ImageGeometry *geometry = job->geometry;
+    uint tiles_per_band = job->map->tiles_per_band;
+
+    // one band (ROWS_PER_CHUNK + 1 rows) at a time stays in cache
+    for (uint band = job->first_band; band < job->last_band; band++)
+    {
+        const unsigned char *row = job->pixels + (size_t)(job->map->first_row + band * ROWS_PER_CHUNK) * geometry->row_stride;
+        for (uint tx = 0; tx < tiles_per_band; tx++)
+        {
+            size_t index = (size_t)band * tiles_per_band + tx;
+            job->costs[index].cost = tile_cost(row + (size_t)tx * ADAPTIVE_TILE_W * geometry->bytes_per_pixel, geometry, job->mask);
+            job->costs[index].index = (uint)index;
+        }
+    }
+    return NULL;
+}
+
+static int compare_tiles(const void *a, const void *b)
+{
+    const TileCost *x = a, *y = b;
+    if (x->cost != y->cost)
+        return x->cost < y->cost ? 1 : -1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* Per byte mask of the bits no embedding touches (the low bit of each 16 bit field, or of each 16 bit sample) */
+static void invariant_mask(PixelFormat format, unsigned char *mask)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        if (format == e_pixel_rgb565)
+            mask[i] = i % 2 ? 0xF7 : 0xDE; // bits 0, 5 and 11
+        else if (format == e_pixel_rgb555)
+            mask[i] = i % 2 ? 0xFB : 0xDE; // bits 0, 5 and 10
+        else if (format == e_pixel_rgb48 || format == e_pixel_gray16)
+            mask[i] = i % 2 ? 0xFE : 0xFF; // big endian, the low byte is second
+        else
+            mask[i] = 0xFE;
+    }
+}
+
+Status adaptive_build_map(const ImageGeometry *geometry, const char *pixels, size_t data_size, size_t header_bytes, AdaptiveMap *map)
+{
+    CostJob jobs[ADAPTIVE_MAX_THREADS];
+
+    map->first_row = payload_start_row(geometry, header_bytes);
+    map->tiles_per_band = geometry->width / ADAPTIVE_TILE_W;
+    map->tiles = adaptive_tile_count(geometry, data_size, header_bytes);
+    map->order = malloc((map->tiles ? map->tiles : 1) * sizeof(*map->order));
+    TileCost *costs = malloc((map->tiles ? map->tiles : 1) * sizeof(*costs));
+    if (map->order == NULL || costs == NULL)
+    {
+        free(costs);
+        adaptive_free_map(map);
+        return e_failure;
+    }
+
+    // split the bands over the cores, small images stay on this thread
+    uint bands = map->tiles_per_band ? (uint)(map->tiles / map->tiles_per_band) : 0;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > ADAPTIVE_MAX_THREADS)
+        nthreads = ADAPTIVE_MAX_THREADS;
+    if (nthreads > bands / 64)
+        nthreads = bands / 64;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    // job 0 runs on this thread once the others are under way, a job without a thread runs here too
+    for (long t = nthreads - 1; t >= 0; t--)
+    {
+        CostJob *job = &jobs[t];
+        job->geometry = geometry;
+        job->map = map;
+        job->pixels = (const unsigned char *)pixels;
+        job->costs = costs;
+        job->first_band = (uint)((unsigned long long)bands * t / nthreads);
+        job->last_band = (uint)((unsigned long long)bands * (t + 1) / nthreads);
+        invariant_mask(geometry->format, job->mask);
+        job->started = t > 0 && pthread_create(&job->thread, NULL, cost_worker, job) == 0;
+        if (!job->started)
+            cost_worker(job);
+    }
+    for (long t = 1; t < nthreads; t++)
+    {
+        if (jobs[t].started)
+            pthread_join(jobs[t].thread, NULL);
+    }
+
+    qsort(costs, map->tiles, sizeof(*costs), compare_tiles);
+    for (size_t i = 0; i < map->tiles; i++)
+        map->order[i] = costs[i].index;
+    free(costs);
+    return e_success;
+}
+
+void adaptive_free_map(AdaptiveMap *map)
+{
+    free(map->order);
+    map->order = NULL;
+    map->tiles = 0;
+}
+
+/* First pixel of row r of a ranked tile */
+static size_t tile_offset(const AdaptiveMap *map, const ImageGeometry *geometry, size_t rank, uint r)
+{
+    uint tile = map->order[rank];
+    uint band = tile / map->tiles_per_band, tx = tile % map->tiles_per_band;
+    return (size_t)(map->first_row + band * ROWS_PER_CHUNK + r) * geometry->row_stride + (size_t)tx * ADAPTIVE_TILE_W * geometry->bytes_per_pixel;
+}
+
+void adaptive_gather(const AdaptiveMap *map, const ImageGeometry *geometry, const LsbKernels *kernels, const char *pixels, size_t first, size_t n, char *slots)
+{
+    uint row_slots = ADAPTIVE_TILE_W * channel_count(kernels->channel_mask);
+    for (size_t rank = first; rank < first + n; rank++)
+    {
+        for (uint r = 0; r < ROWS_PER_CHUNK; r++, slots += row_slots)
+            kernels->gather(pixels + tile_offset(map, geometry, rank, r), ADAPTIVE_TILE_W, slots);
+    }
+}
+
+void adaptive_scatter(const AdaptiveMap *map, const ImageGeometry *geometry, const LsbKernels *kernels, char *pixels, size_t first, size_t n, const char *slots)
+{
+    uint row_slots = ADAPTIVE_TILE_W * channel_count(kernels->channel_mask);
+    for (size_t rank = first; rank < first + n; rank++)
+    {
+        for (uint r = 0; r < ROWS_PER_CHUNK; r++, slots += row_slots)
+            kernels->scatter(pixels + tile_offset(map, geometry, rank, r), ADAPTIVE_TILE_W, slots);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stddef.h>
+
+#include "types.h" // Contains user defined types
+#include "image.h" // Pixel geometry
+#include "lsb.h"   // Gather / scatter kernels
+
+/*
+ * Content adaptive embedding (--adaptive)
+ * ---------------------------------------
+ * The rows after the header are cut into tiles of ADAPTIVE_TILE_W pixels
+ * by ROWS_PER_CHUNK rows. The cost of a tile is its texture: the sum of
+ * |differences| to the right and lower neighbour of every byte, with the
+ * bits embedding may change masked off, so the decoder computes the same
+ * map from the stego image. The payload fills the busiest tiles first,
+ * ADAPTIVE_BATCH tiles at a time gathered into contiguous slots.
+ */
+
+#define ADAPTIVE_TILE_W 16    // Pixels per tile row (one SSSE3 gather block)
+#define ADAPTIVE_BATCH 64     // Tiles gathered / scattered per chunk
+#define ADAPTIVE_MAX_THREADS 16 // Upper bound of the cost map workers
+
+typedef struct _AdaptiveMap
+{
+    uint first_row;      // To store the first row of the tiles (after the header)
+    uint tiles_per_band; // To store the tiles in one band of ROWS_PER_CHUNK rows
+    size_t tiles;        // To store the number of tiles
+    uint *order;         // To store the tile indices, busiest first
+} AdaptiveMap;
+
+/* Number of whole tiles after header_bytes (a row below the last band is kept for the cost) */
+size_t adaptive_tile_count(const ImageGeometry *geometry, size_t data_size, size_t header_bytes);
+
+/* Bytes of payload the tiles hold for a channel mask and --matrix k (0 = off) */
+size_t adaptive_payload_capacity(const ImageGeometry *geometry, size_t data_size, size_t header_bytes, uint channel_mask, uint k);
+
+/* Compute the cost map of the pixels and rank the tiles */
+Status adaptive_build_map(const ImageGeometry *geometry, const char *pixels, size_t data_size, size_t header_bytes, AdaptiveMap *map);
+
+/* Free the ranking */
+void adaptive_free_map(AdaptiveMap *map);
+
+/* Tiles [first, first + n) of the ranking <-> contiguous slots */
+void adaptive_gather(const AdaptiveMap *map, const ImageGeometry *geometry, const LsbKernels *kernels, const char *pixels, size_t first, size_t n, char *slots);
+void adaptive_scatter(const AdaptiveMap *map, const ImageGeometry *geometry, const LsbKernels *kernels, char *pixels, size_t first, size_t n, const char *slots);
+
+#endif
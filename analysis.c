@@ -0,0 +1,575 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "analysis.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Counts of one thread, merged into the first one at the end */
+typedef struct _AnalysisStats
+{
+    unsigned long long hist[ANALYSIS_SEGMENTS][256]; // sample histogram of every segment of the pixel data
+    unsigned long long rs[3][8];                     // R / S under M and -M, image then flipped image, per channel
+} AnalysisStats;
+
+/* Tiles of one image shared by its threads */
+typedef struct _AnalysisJob
+{
+    const ImageGeometry *geometry;
+    const unsigned char *pixels;
+    uint channels;
+    uint rows_per_tile;
+    uint tiles;
+    uint next_tile;
+} AnalysisJob;
+
+typedef struct _AnalysisThread
+{
+    AnalysisJob *job;
+    AnalysisStats *stats;
+    pthread_t thread;
+} AnalysisThread;
+
+static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The directory walk of nftw has no user pointer */
+static AnalysisInfo *collecting;
+
+/* Image files by extension, hidden names (temporaries) skipped */
+static int analysis_candidate(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    base = base != NULL ? base + 1 : path;
+    const char *extn = strrchr(base, '.');
+    return base[0] != '.' && extn != NULL && (!strcmp(extn, ".bmp") || !strcmp(extn, ".ppm") || !strcmp(extn, ".pgm"));
+}
+
+static Status add_path(AnalysisInfo *anInfo, const char *path)
+{
+    if (anInfo->count == anInfo->alloc)
+    {
+        uint alloc = anInfo->alloc ? 2 * anInfo->alloc : 64;
+        char **paths = realloc(anInfo->paths, alloc * sizeof(*paths));
+        if (paths == NULL)
+            return e_failure;
+        anInfo->paths = paths;
+        anInfo->alloc = alloc;
+    }
+    if ((anInfo->paths[anInfo->count] = strdup(path)) == NULL)
+        return e_failure;
+    anInfo->count++;
+    return e_success;
+}
+
+static int collect_file(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)st;
+    (void)ftw;
+    if (type == FTW_F && analysis_candidate(path) && add_path(collecting, path) == e_failure)
+        return -1;
+    return 0;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+Status read_and_validate_analysis_args(char *argv[], AnalysisInfo *anInfo)
+{
+    struct stat st;
+
+    collecting = anInfo;
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (stat(argv[i], &st) < 0)
+        {
+            perror(argv[i]);
+            return e_failure;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            // a whole corpus: every image below the directory, in name order
+            uint first = anInfo->count;
+            if (nftw(argv[i], collect_file, 16, FTW_PHYS) != 0)
+            {
+                perror(argv[i]);
+                return e_failure;
+            }
+            qsort(anInfo->paths + first, anInfo->count - first, sizeof(*anInfo->paths), compare_paths);
+        }
+        else if (analysis_candidate(argv[i]))
+        {
+            if (add_path(anInfo, argv[i]) == e_failure)
+                return e_failure;
+        }
+        else
+        {
+            printf("Error: '%s' must be a .bmp, .ppm or .pgm image or a directory\n", argv[i]);
+            return e_failure;
+        }
+    }
+    if (anInfo->count == 0)
+    {
+        printf("Error: -a found no .bmp, .ppm or .pgm images\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*
+ * Channel samples of one row, pixel after pixel: 8 bit formats are used
+ * in place, alpha is dropped and 16 bit fields are shifted down so each
+ * sample is the value whose LSB an embedding would replace.
+ */
+static const unsigned char *row_samples(const ImageGeometry *geometry, const unsigned char *row, unsigned char *samples)
+{
+    switch (geometry->format)
+    {
+    case e_pixel_bgra32:
+        for (uint x = 0; x < geometry->width; x++)
+        {
+            samples[3 * x] = row[4 * x];
+            samples[3 * x + 1] = row[4 * x + 1];
+            samples[3 * x + 2] = row[4 * x + 2];
+        }
+        return samples;
+    case e_pixel_rgb565:
+    case e_pixel_rgb555:
+        for (uint x = 0; x < geometry->width; x++)
+        {
+            uint pixel = row[2 * x] | (uint)row[2 * x + 1] << 8;
+            samples[3 * x] = pixel & 0x1F;
+            samples[3 * x + 1] = geometry->format == e_pixel_rgb565 ? (pixel >> 5) & 0x3F : (pixel >> 5) & 0x1F;
+            samples[3 * x + 2] = geometry->format == e_pixel_rgb565 ? pixel >> 11 : (pixel >> 10) & 0x1F;
+        }
+        return samples;
+    default:
+        return row;
+    }
+}
+
+/* Smoothness of a group: the sum of its neighbour differences */
+static inline int rs_smoothness(int a, int b, int c, int d)
+{
+    return abs(b - a) + abs(c - b) + abs(d - c);
+}
+
+/* F-1: the shifted LSB flip, -1 <-> 0, 1 <-> 2, ... */
+static inline int rs_flip_neg(int x)
+{
+    return x & 1 ? x + 1 : x - 1;
+}
+
+/* Class one group under M = [0 1 1 0] and -M: regular when flipping makes it rougher, singular when smoother */
+static inline void rs_group(int a, int b, int c, int d, unsigned long long *rs)
+{
+    int f = rs_smoothness(a, b, c, d);
+    int f_pos = rs_smoothness(a, b ^ 1, c ^ 1, d);
+    int f_neg = rs_smoothness(a, rs_flip_neg(b), rs_flip_neg(c), d);
+    rs[0] += f_pos > f;
+    rs[1] += f_pos < f;
+    rs[2] += f_neg > f;
+    rs[3] += f_neg < f;
+}
+
+static void analyse_row(const AnalysisJob *job, const unsigned char *samples, unsigned long long *hist, AnalysisStats *stats)
+{
+    uint width = job->geometry->width, channels = job->channels;
+    size_t n = (size_t)width * channels;
+
+    for (size_t i = 0; i < n; i++)
+        hist[samples[i]]++;
+
+    // groups of 4 horizontal neighbours of one channel, on the samples and on their LSB flipped copy
+    for (uint c = 0; c < channels; c++)
+    {
+        unsigned long long *rs = stats->rs[c];
+        for (uint x = 0; x + 4 <= width; x += 4)
+        {
+            const unsigned char *g = samples + (size_t)x * channels + c;
+            int a = g[0], b = g[channels], cc = g[2 * channels], d = g[3 * channels];
+            rs_group(a, b, cc, d, rs);
+            rs_group(a ^ 1, b ^ 1, cc ^ 1, d ^ 1, rs + 4);
+        }
+    }
+}
+
+static void *analysis_worker(void *arg)
+{
+    AnalysisThread *self = arg;
+    AnalysisJob *job = self->job;
+    const ImageGeometry *geometry = job->geometry;
+    unsigned char *samples = malloc((size_t)geometry->width * 3 + 1);
+    if (samples == NULL)
+        return NULL;
+
+    // tiles are handed out one at a time, so a slow thread never holds up the rest
+    for (uint tile; (tile = __sync_fetch_and_add(&job->next_tile, 1)) < job->tiles;)
+    {
+        uint first = tile * job->rows_per_tile;
+        uint last = first + job->rows_per_tile < geometry->height ? first + job->rows_per_tile : geometry->height;
+        for (uint row = first; row < last; row++)
+        {
+            uint segment = (uint)((unsigned long long)row * ANALYSIS_SEGMENTS / geometry->height);
+            const unsigned char *pixels = job->pixels + (size_t)row * geometry->row_stride;
+            analyse_row(job, row_samples(geometry, pixels, samples), self->stats->hist[segment], self->stats);
+        }
+    }
+    free(samples);
+    return NULL;
+}
+
+/* Regularized upper incomplete gamma Q(a, x): series below a + 1, continued fraction above */
+static double gamma_q(double a, double x)
+{
+    if (x <= 0.0)
+        return 1.0;
+    // lgamma writes signgam, image workers call this at the same time
+    int sign;
+    double front = exp(-x + a * log(x) - lgamma_r(a, &sign));
+    if (x < a + 1.0)
+    {
+        double ap = a, del = 1.0 / a, sum = del;
+        for (int n = 0; n < 1000 && fabs(del) > fabs(sum) * 1e-14; n++)
+        {
+            ap += 1.0;
+            del *= x / ap;
+            sum += del;
+        }
+        return 1.0 - sum * front;
+    }
+    double b = x + 1.0 - a, c = 1e300, d = 1.0 / b, h = d;
+    for (int i = 1; i < 1000; i++)
+    {
+        double an = -i * (i - a);
+        b += 2.0;
+        d = an * d + b;
+        if (fabs(d) < 1e-300)
+            d = 1e-300;
+        c = b + an / c;
+        if (fabs(c) < 1e-300)
+            c = 1e-300;
+        d = 1.0 / d;
+        double del = d * c;
+        h *= del;
+        if (fabs(del - 1.0) < 1e-14)
+            break;
+    }
+    return front * h;
+}
+
+/* Probability that the pairs (2k, 2k + 1) were evened out by embedding */
+static double chi_square_p(const unsigned long long *hist)
+{
+    double chi = 0.0;
+    int pairs = 0;
+    for (int k = 0; k < 128; k++)
+    {
+        unsigned long long n = hist[2 * k] + hist[2 * k + 1];
+        // too few samples for the approximation
+        if (n < 10)
+            continue;
+        double expected = n / 2.0;
+        chi += (hist[2 * k] - expected) * (hist[2 * k] - expected) / expected;
+        pairs++;
+    }
+    return pairs < 2 ? 0.0 : gamma_q((pairs - 1) / 2.0, chi / 2.0);
+}
+
+/*
+ * Embedding rate from the RS counts of one channel: the root of
+ * Fridrich's quadratic that maps to a rate in [0, 1], the one of smaller
+ * magnitude when both do. Towards p = 1 the image and its flipped copy
+ * become the same picture and the quadratic degenerates (x runs off to
+ * infinity, or the roots turn complex), so that end is handled first.
+ */
+static double rs_estimate(const unsigned long long *rs)
+{
+    double n = (double)rs[0] + rs[1] + rs[2] + rs[3];
+    if (n == 0.0)
+        return 0.0;
+    double d0 = (double)rs[0] - rs[1], dn0 = (double)rs[2] - rs[3];
+    double d1 = (double)rs[4] - rs[5], dn1 = (double)rs[6] - rs[7];
+
+    // flipping every LSB changes nothing beyond sampling noise (4 standard errors): the plane is already random
+    if (fabs(d0 - d1) + fabs(dn0 - dn1) < 4.0 * sqrt(n))
+        return 1.0;
+
+    double a = 2.0 * (d1 + d0), b = dn0 - dn1 - d1 - 3.0 * d0, c = d0 - dn0;
+    double roots[2];
+    int count = 2;
+    if (fabs(a) < 1e-9 * (fabs(b) + fabs(c) + 1.0))
+    {
+        roots[0] = fabs(b) > 0.0 ? -c / b : 0.0;
+        count = 1;
+    }
+    else
+    {
+        double disc = b * b - 4.0 * a * c;
+        if (disc < 0.0)
+        {
+            // complex roots of modulus sqrt(c / a), large on this side: the x <= 0 one of that size
+            roots[0] = -sqrt(c / a);
+            count = 1;
+        }
+        else
+        {
+            roots[0] = (-b + sqrt(disc)) / (2.0 * a);
+            roots[1] = (-b - sqrt(disc)) / (2.0 * a);
+        }
+    }
+
+    // rates a little outside [0, 1] are noise around the ends, further out the root is spurious
+    double best = 0.0, best_x = INFINITY, any = 0.0, any_x = INFINITY;
+    for (int i = 0; i < count; i++)
+    {
+        double p = roots[i] / (roots[i] - 0.5);
+        if (!isfinite(p))
+            continue;
+        if (fabs(roots[i]) < any_x)
+            any = p, any_x = fabs(roots[i]);
+        if (p >= -0.1 && p <= 1.1 && fabs(roots[i]) < best_x)
+            best = p, best_x = fabs(roots[i]);
+    }
+    double p = isfinite(best_x) ? best : any;
+    return p < 0.0 ? 0.0 : p > 1.0 ? 1.0 : p;
+}
+
+static void analyse_image(const char *path, AnalysisResult *result, int nthreads)
+{
+    AnalysisThread threads[ANALYSIS_MAX_THREADS];
+    ImageGeometry geometry;
+    struct stat st;
+
+    memset(result, 0, sizeof(*result));
+    result->status = e_failure;
+    FILE *fptr = fopen(path, "rb");
+    if (fptr == NULL)
+    {
+        result->error = "cannot be opened";
+        return;
+    }
+    if (read_image_geometry(fptr, &geometry) == e_failure || fstat(fileno(fptr), &st) < 0 ||
+        (unsigned long long)st.st_size < geometry.data_offset + (unsigned long long)(geometry.height - 1) * geometry.row_stride + (unsigned long long)geometry.width * geometry.bytes_per_pixel)
+    {
+        result->error = "not a supported image";
+        fclose(fptr);
+        return;
+    }
+    if (geometry.format == e_pixel_rgb48 || geometry.format == e_pixel_gray16)
+    {
+        result->error = "16 bit samples are not analysed";
+        fclose(fptr);
+        return;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(fptr), 0);
+    fclose(fptr);
+    if (map == MAP_FAILED)
+    {
+        result->error = "cannot be mapped";
+        return;
+    }
+
+    AnalysisJob job = {0};
+    job.geometry = &geometry;
+    job.pixels = (const unsigned char *)map + geometry.data_offset;
+    job.channels = geometry.format == e_pixel_gray8 ? 1 : 3;
+    job.rows_per_tile = ANALYSIS_TILE_BYTES / geometry.row_stride ? ANALYSIS_TILE_BYTES / geometry.row_stride : 1;
+    job.tiles = (geometry.height + job.rows_per_tile - 1) / job.rows_per_tile;
+    if (nthreads > (int)job.tiles)
+        nthreads = (int)job.tiles;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    int started = 0;
+    for (int t = 0; t < nthreads; t++)
+    {
+        threads[t].job = &job;
+        threads[t].stats = calloc(1, sizeof(AnalysisStats));
+        if (threads[t].stats == NULL)
+            break;
+        started = t + 1;
+        // thread 0 is this one
+        if (t > 0 && pthread_create(&threads[t].thread, NULL, analysis_worker, &threads[t]) != 0)
+        {
+            free(threads[t].stats);
+            started = t;
+            break;
+        }
+    }
+    if (started > 0)
+        analysis_worker(&threads[0]);
+
+    // merge into the stats of thread 0
+    AnalysisStats *total = started > 0 ? threads[0].stats : NULL;
+    for (int t = 1; t < started; t++)
+    {
+        pthread_join(threads[t].thread, NULL);
+        for (int s = 0; s < ANALYSIS_SEGMENTS; s++)
+            for (int v = 0; v < 256; v++)
+                total->hist[s][v] += threads[t].stats->hist[s][v];
+        for (int c = 0; c < 3; c++)
+            for (int k = 0; k < 8; k++)
+                total->rs[c][k] += threads[t].stats->rs[c][k];
+        free(threads[t].stats);
+    }
+    munmap(map, (size_t)st.st_size);
+    if (total == NULL || job.next_tile < job.tiles)
+    {
+        free(total);
+        result->error = "out of memory";
+        return;
+    }
+
+    /*
+     * A sequential payload keeps the chi-square p high in every segment up
+     * to its end. Under embedding p is close to uniform, so one segment
+     * may dip below the flag; the run ends at the second one. The prefix
+     * the run covers has to pass as a whole too, which keeps a clean start
+     * from opening a run on one lucky smooth segment.
+     */
+    unsigned long long prefix[256] = {0};
+    double prefix_p[ANALYSIS_SEGMENTS];
+    int end = 0, misses = 0;
+    for (int s = 0; s < ANALYSIS_SEGMENTS; s++)
+    {
+        for (int v = 0; v < 256; v++)
+            prefix[v] += total->hist[s][v];
+        prefix_p[s] = chi_square_p(prefix);
+        if (misses > 1)
+            continue;
+        if (chi_square_p(total->hist[s]) >= ANALYSIS_CHI_FLAG)
+            end = s + 1;
+        else
+            misses++;
+    }
+    while (end > 0 && prefix_p[end - 1] < ANALYSIS_CHI_FLAG)
+        end--;
+    result->sequential = (double)end / ANALYSIS_SEGMENTS;
+    result->chi_p = prefix_p[ANALYSIS_SEGMENTS - 1];
+
+    result->channels = job.channels;
+    result->names = geometry.format == e_pixel_gray8 ? "G" : geometry.format == e_pixel_rgb24 ? "RGB" : "BGR";
+    for (uint c = 0; c < job.channels; c++)
+        result->rs_rate[c] = rs_estimate(total->rs[c]);
+    result->status = e_success;
+    free(total);
+}
+
+/* Median RS rate of the channels: one channel alone (a flat sky in blue) does not make a verdict */
+static double rs_median(const AnalysisResult *result)
+{
+    const double *r = result->rs_rate;
+    if (result->channels < 3)
+        return r[0];
+    return r[0] > r[1] ? (r[1] > r[2] ? r[1] : r[0] < r[2] ? r[0] : r[2]) : (r[0] > r[2] ? r[0] : r[1] < r[2] ? r[1] : r[2]);
+}
+
+static int result_flagged(const AnalysisResult *result)
+{
+    return rs_median(result) >= ANALYSIS_RS_FLAG || result->sequential > 0.0;
+}
+
+static void print_result(const char *path, const AnalysisResult *result)
+{
+    if (result->status == e_failure)
+    {
+        printf("❌ %s: %s\n", path, result->error);
+        return;
+    }
+    printf("%s %s  RS", result_flagged(result) ? "⚠️ " : "✅", path);
+    for (uint c = 0; c < result->channels; c++)
+        printf(" %c %.3f", result->names[c], result->rs_rate[c]);
+    printf("  | χ² p %.3f", result->chi_p);
+    if (result->sequential > 0.0)
+        printf(", sequential ~%.0f%%", 100.0 * result->sequential);
+    printf("\n");
+}
+
+/* Whole images per worker, results printed as they come in */
+static void *image_worker(void *arg)
+{
+    AnalysisInfo *anInfo = arg;
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nproc > ANALYSIS_MAX_THREADS)
+        nproc = ANALYSIS_MAX_THREADS;
+    // fewer images than cores: the spare cores share the tiles of each image
+    uint workers = anInfo->count < (uint)nproc ? anInfo->count : (uint)nproc;
+    int per_image = workers > 0 && nproc / workers > 1 ? (int)(nproc / workers) : 1;
+
+    for (uint i; (i = __sync_fetch_and_add(&anInfo->next, 1)) < anInfo->count;)
+    {
+        analyse_image(anInfo->paths[i], &anInfo->results[i], per_image);
+        pthread_mutex_lock(&print_lock);
+        print_result(anInfo->paths[i], &anInfo->results[i]);
+        fflush(stdout);
+        pthread_mutex_unlock(&print_lock);
+    }
+    return NULL;
+}
+
+Status do_analysis(AnalysisInfo *anInfo)
+{
+    pthread_t workers[ANALYSIS_MAX_THREADS];
+    struct timespec start, end;
+
+    printf("\n=============================================\n");
+    printf("🔬 ANALYSIS MODE SELECTED\n");
+    printf("=============================================\n");
+    printf("📂 Images : %u\n", anInfo->count);
+    printf("📏 RS estimate per channel (flagged from a median of %.2f), chi-square p-value of the pairs of values\n", ANALYSIS_RS_FLAG);
+    printf("---------------------------------------------\n");
+
+    anInfo->results = calloc(anInfo->count, sizeof(*anInfo->results));
+    if (anInfo->results == NULL)
+        return e_failure;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers > ANALYSIS_MAX_THREADS)
+        nworkers = ANALYSIS_MAX_THREADS;
+    if (nworkers > (long)anInfo->count)
+        nworkers = anInfo->count;
+    int started = 0;
+    for (long i = 1; i < nworkers; i++)
+    {
+        if (pthread_create(&workers[started], NULL, image_worker, anInfo) == 0)
+            started++;
+    }
+    image_worker(anInfo);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint failed = 0;
+    for (uint i = 0; i < anInfo->count; i++)
+    {
+        if (anInfo->results[i].status == e_failure)
+            failed++;
+        else if (result_flagged(&anInfo->results[i]))
+            anInfo->flagged++;
+    }
+    printf("-------------------------------------------------\n");
+    printf("🔬 %u images analysed in %.2f s: %u look like they carry data", anInfo->count - failed,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, anInfo->flagged);
+    if (failed > 0)
+        printf(", %u skipped", failed);
+    printf("\n-------------------------------------------------\n");
+
+    for (uint i = 0; i < anInfo->count; i++)
+        free(anInfo->paths[i]);
+    free(anInfo->paths);
+    free(anInfo->results);
+    anInfo->paths = NULL;
+    anInfo->results = NULL;
+    return failed < anInfo->count ? e_success : e_failure;
+}
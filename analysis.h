@@ -0,0 +1,64 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdio.h>
+
+#include "types.h" // Contains user defined types
+#include "image.h" // Pixel geometry
+
+/*
+ * LSB steganalysis (-a)
+ * ---------------------
+ * Two classic detectors run over the samples of every image, to audit
+ * how visible our own embedding is:
+ *  - chi-square pairs of values (Westfeld / Pfitzmann): LSB replacement
+ *    evens out the counts of 2k and 2k + 1. The p-value is computed over
+ *    the whole image and over every segment of the pixel data; the run
+ *    of embedded looking segments from the start (one dip allowed)
+ *    estimates how much of a sequential payload is there.
+ *  - RS analysis (Fridrich): groups of 4 neighbouring samples of a
+ *    channel are classed regular / singular under the flip masks M and
+ *    -M, on the image and on its LSB flipped copy; the quadratic of the
+ *    four differences gives the embedding rate per channel. The verdict
+ *    takes the median channel, single channels misread on flat areas.
+ * Threads take tiles of rows sized to stay in cache, count into their
+ * own histograms and RS counters, and the counts are merged at the end.
+ * Many images are analysed in parallel, one image per worker.
+ */
+
+#define ANALYSIS_SEGMENTS 64            // Prefixes of the pixel data tested by the chi-square
+#define ANALYSIS_TILE_BYTES (256 << 10) // Pixel bytes of one tile
+#define ANALYSIS_MAX_THREADS 16         // Upper bound of the worker threads
+#define ANALYSIS_RS_FLAG 0.05           // Median RS rate from which an image is reported as carrying data
+#define ANALYSIS_CHI_FLAG 0.95          // Chi-square p-value from which a segment counts as embedded
+
+/* Result of one image */
+typedef struct _AnalysisResult
+{
+    Status status;        // To store e_failure when the image could not be analysed
+    const char *error;    // To store why it could not
+    uint channels;        // To store the number of channels analysed
+    const char *names;    // To store the channel names, one letter each
+    double rs_rate[3];    // To store the RS estimate of every channel (0 = clean, 1 = every LSB)
+    double chi_p;         // To store the chi-square p-value of the whole image
+    double sequential;    // To store the share of the pixel data a sequential payload covers
+} AnalysisResult;
+
+/* Structure to store the inputs and results of -a */
+typedef struct _AnalysisInfo
+{
+    char **paths;          // To store the images to analyse
+    uint count;            // To store the number of images
+    uint alloc;            // To store the allocated entries of paths
+    AnalysisResult *results; // To store one result per image
+    uint next;             // To store the next image a worker takes
+    uint flagged;          // To store the images that look like they carry data
+} AnalysisInfo;
+
+/* Collect the -a arguments: image files, and directories searched for .bmp / .ppm / .pgm */
+Status read_and_validate_analysis_args(char *argv[], AnalysisInfo *anInfo);
+
+/* Analyse every image and print one line per image */
+Status do_analysis(AnalysisInfo *anInfo);
+
+#endif
@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include "archive.h"
+#include "encode.h"
+#include "decode.h"
+#include "common.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+
+/* Little endian 32 bit fields of the directory table */
+static void put_u32(unsigned char *p, uint value)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint get_u32(const unsigned char *p)
+{
+    return (uint)p[0] | (uint)p[1] << 8 | (uint)p[2] << 16 | (uint)p[3] << 24;
+}
+
+/* A name we are willing to create in the current directory */
+static int valid_entry_name(const char *name)
+{
+    return name[0] != '\0' && strchr(name, '/') == NULL && strcmp(name, ".") && strcmp(name, "..");
+}
+
+Status read_and_validate_archive_args(char *argv[], ArchiveInfo *aInfo)
+{
+    /*
+     *   -A <source.bmp> <output.bmp> <file>...
+     *   -l <archive.bmp>
+     *   -x <archive.bmp> <name> [output]
+     */
+    if (aInfo->operation == e_archive)
+    {
+        if (argv[2] == NULL || !checkExtension(argv[2], ".bmp") || argv[3] == NULL || !checkExtension(argv[3], ".bmp") || argv[4] == NULL)
+        {
+            printf("Error: -A expects <source.bmp> <output.bmp> <file>...\n");
+            return e_failure;
+        }
+        aInfo->src_image_fname = argv[2];
+        aInfo->stego_image_fname = argv[3];
+        aInfo->member_fnames = &argv[4];
+        for (aInfo->member_count = 0; argv[4 + aInfo->member_count] != NULL; aInfo->member_count++)
+            ;
+        if (aInfo->member_count > ARCHIVE_MAX_ENTRIES)
+        {
+            printf("Error: an archive holds at most %d files\n", ARCHIVE_MAX_ENTRIES);
+            return e_failure;
+        }
+        return e_success;
+    }
+
+    if (argv[2] == NULL || !checkExtension(argv[2], ".bmp"))
+    {
+        printf("Error: '%s' must have a .bmp extension.\n", argv[2] ? argv[2] : "");
+        return e_failure;
+    }
+    aInfo->stego_image_fname = argv[2];
+    if (aInfo->operation == e_extract)
+    {
+        if (argv[3] == NULL)
+        {
+            printf("Error: -x expects <archive.bmp> <name> [output]\n");
+            return e_failure;
+        }
+        aInfo->entry_name = argv[3];
+        aInfo->out_fname = argv[4] != NULL ? argv[4] : argv[3];
+    }
+    return e_success;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/* -x finds entries by name, a second entry of the same name could never be extracted */
+static Status check_unique_names(const ArchiveInfo *aInfo)
+{
+    const char **names = malloc(aInfo->entry_count * sizeof(*names) + 1);
+    Status status = e_success;
+    if (names == NULL)
+    {
+        return e_failure;
+    }
+    for (uint i = 0; i < aInfo->entry_count; i++)
+        names[i] = aInfo->entries[i].name;
+    qsort(names, aInfo->entry_count, sizeof(*names), compare_names);
+    for (uint i = 1; i < aInfo->entry_count && status == e_success; i++)
+    {
+        if (!strcmp(names[i - 1], names[i]))
+        {
+            printf("Error: two files are named '%s', entry names must be unique\n", names[i]);
+            status = e_failure;
+        }
+    }
+    free(names);
+    return status;
+}
+
+/* Open the members, fill the directory and serialize it */
+static unsigned char *build_directory(ArchiveInfo *aInfo, FILE **members, size_t *dir_size, size_t *data_size)
+{
+    *dir_size = 4;
+    *data_size = 0;
+    for (int i = 0; i < aInfo->member_count; i++)
+    {
+        const char *fname = aInfo->member_fnames[i];
+        const char *name = strrchr(fname, '/') != NULL ? strrchr(fname, '/') + 1 : fname;
+        ArchiveEntry *entry = &aInfo->entries[i];
+
+        members[i] = fopen(fname, "rb");
+        if (members[i] == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "Error: unable to open '%s'\n", fname);
+            return NULL;
+        }
+        if (strlen(name) > ARCHIVE_NAME_MAX || !valid_entry_name(name))
+        {
+            printf("Error: '%s' is not a valid entry name\n", name);
+            return NULL;
+        }
+        long size = get_file_size(members[i]);
+        if (size < 0 || (unsigned long long)*data_size + size > UINT_MAX)
+        {
+            printf("Error: the files are too large for one archive\n");
+            return NULL;
+        }
+        strcpy(entry->name, name);
+        entry->size = (uint)size;
+        entry->offset = (uint)*data_size;
+        *data_size += (size_t)size;
+        *dir_size += 1 + strlen(name) + 8;
+    }
+    aInfo->entry_count = (uint)aInfo->member_count;
+    if (check_unique_names(aInfo) == e_failure)
+    {
+        return NULL;
+    }
+
+    unsigned char *dir = malloc(*dir_size);
+    if (dir == NULL)
+    {
+        return NULL;
+    }
+    unsigned char *p = dir;
+    put_u32(p, aInfo->entry_count);
+    p += 4;
+    for (uint i = 0; i < aInfo->entry_count; i++)
+    {
+        size_t len = strlen(aInfo->entries[i].name);
+        *p++ = (unsigned char)len;
+        memcpy(p, aInfo->entries[i].name, len);
+        p += len;
+        put_u32(p, aInfo->entries[i].size);
+        put_u32(p + 4, aInfo->entries[i].offset);
+        p += 8;
+    }
+    return dir;
+}
+
+/* Embed the directory and every member, then write the image */
+static Status embed_archive(ArchiveInfo *aInfo, EncodeInfo *encInfo, FILE **members, const unsigned char *dir, size_t dir_size, size_t data_size)
+{
+    const LsbKernels *kernels = lsb_select_kernels(e_layout_bytes);
+
+    if (read_image_geometry(encInfo->fptr_src_image, &encInfo->geometry) == e_failure)
+    {
+        printf("Error: unable to read the bmp header of '%s'\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    // The directory and the members use every byte, which only 24 bit pixels allow
+    if (encInfo->geometry.format != e_pixel_bgr24)
+    {
+        printf("Error: archives need a 24 bit carrier, '%s' is %u bit\n", encInfo->src_image_fname, encInfo->geometry.bytes_per_pixel * 8);
+        return e_failure;
+    }
+    unsigned long long needed = strlen(MAGIC_STRING) * 8 + 32 + 32 + 8ULL * (dir_size + data_size);
+    long file_size = get_file_size(encInfo->fptr_src_image);
+    long offset = encInfo->geometry.data_offset;
+    if (file_size < offset || (unsigned long long)(file_size - offset) < needed)
+    {
+        printf("Error: '%s' can hold %ld bytes, the archive needs %llu\n", encInfo->src_image_fname, file_size < offset ? 0 : (file_size - offset) / 8, needed / 8);
+        return e_failure;
+    }
+
+    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure || load_image_data(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    encInfo->header_data = encInfo->image_data;
+    encode_magic_string(MAGIC_STRING, encInfo);
+    encode_secret_file_extn_size(OPT_ARCHIVE, encInfo);
+    encode_size_to_lsb((int)dir_size, encInfo->image_data + encInfo->data_pos);
+    encInfo->data_pos += 32;
+    kernels->embed_block((const char *)dir, dir_size, encInfo->image_data + encInfo->data_pos);
+    encInfo->data_pos += dir_size * 8;
+
+    // Members back to back, in directory order
+    char buffer[4096];
+    for (uint i = 0; i < aInfo->entry_count; i++)
+    {
+        rewind(members[i]);
+        for (size_t remaining = aInfo->entries[i].size; remaining > 0;)
+        {
+            size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+            if (fread(buffer, 1, chunk, members[i]) != chunk)
+            {
+                printf("Error: unable to read '%s'\n", aInfo->member_fnames[i]);
+                return e_failure;
+            }
+            kernels->embed_block(buffer, chunk, encInfo->image_data + encInfo->data_pos);
+            encInfo->data_pos += chunk * 8;
+            remaining -= chunk;
+        }
+    }
+    return write_image_data(encInfo);
+}
+
+static Status build_archive(ArchiveInfo *aInfo)
+{
+    EncodeInfo encInfo = {0};
+    Status status = e_failure;
+    size_t dir_size = 0, data_size = 0;
+    unsigned char *dir = NULL;
+
+    FILE **members = calloc(aInfo->member_count, sizeof(*members));
+    aInfo->entries = calloc(aInfo->member_count, sizeof(*aInfo->entries));
+    if (members != NULL && aInfo->entries != NULL)
+    {
+        dir = build_directory(aInfo, members, &dir_size, &data_size);
+    }
+
+    encInfo.src_image_fname = aInfo->src_image_fname;
+    encInfo.stego_image_fname = aInfo->stego_image_fname;
+    if (dir != NULL)
+    {
+        encInfo.fptr_src_image = fopen(encInfo.src_image_fname, "rb");
+        if (encInfo.fptr_src_image == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "Error: unable to open '%s'\n", encInfo.src_image_fname);
+        }
+        else if ((encInfo.fptr_stego_image = atomic_out_open(&encInfo.stego_out, encInfo.stego_image_fname, "wb")) == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "Error: unable to open '%s'\n", encInfo.stego_image_fname);
+        }
+        else
+        {
+            status = embed_archive(aInfo, &encInfo, members, dir, dir_size, data_size);
+            if (status == e_success)
+                status = publish_stego_image(&encInfo);
+        }
+    }
+
+    if (status == e_failure)
+    {
+        discard_stego_image(&encInfo);
+    }
+    else
+    {
+        printf("📦 Archived %u files (%zu bytes, %zu byte directory) into %s\n", aInfo->entry_count, data_size, dir_size, aInfo->stego_image_fname);
+    }
+    close_files(&encInfo);
+    for (int i = 0; members != NULL && i < aInfo->member_count; i++)
+    {
+        if (members[i] != NULL)
+            fclose(members[i]);
+    }
+    free(members);
+    free(dir);
+    free(aInfo->entries);
+    aInfo->entries = NULL;
+    free(encInfo.image_data);
+    return status;
+}
+
+/* Map the archive and read its directory, the data itself stays untouched */
+static Status read_directory(ArchiveInfo *aInfo, DecodeInfo *dcdInfo)
+{
+    dcdInfo->stego1_image_fname = aInfo->stego_image_fname;
+    if (open_file_decode(dcdInfo) == e_failure || decode_magic_string(dcdInfo) == e_failure ||
+        decode_secret_file_extn_size(dcdInfo) == e_failure || !dcdInfo->archive)
+    {
+        printf("Error: '%s' does not contain an archive\n", aInfo->stego_image_fname);
+        return e_failure;
+    }
+
+    int dir_size;
+    const char *carrier;
+    if (dcdInfo->data_pos + 32 > dcdInfo->image_data_size || (carrier = decode_carrier_bytes(dcdInfo, dcdInfo->data_pos, 32)) == NULL)
+    {
+        return e_failure;
+    }
+    decode_size_to_lsb(&dir_size, (char *)carrier);
+    dcdInfo->data_pos += 32;
+    if (dir_size < 4 || (size_t)dir_size > (dcdInfo->image_data_size - dcdInfo->data_pos) / 8)
+    {
+        printf("Error: corrupted archive directory\n");
+        return e_failure;
+    }
+
+    unsigned char *dir = malloc((size_t)dir_size);
+    if (dir == NULL || (carrier = decode_carrier_bytes(dcdInfo, dcdInfo->data_pos, (size_t)dir_size * 8)) == NULL)
+    {
+        free(dir);
+        return e_failure;
+    }
+    lsb_kernel_table[e_layout_bytes].extract_block((char *)dir, (size_t)dir_size, carrier);
+    aInfo->data_pos = dcdInfo->data_pos + (size_t)dir_size * 8;
+    size_t data_capacity = (dcdInfo->image_data_size - aInfo->data_pos) / 8;
+
+    // Every entry has to lie inside the directory and its data inside the image
+    Status status = e_failure;
+    const unsigned char *p = dir + 4, *end = dir + dir_size;
+    uint count = get_u32(dir);
+    if (count <= ARCHIVE_MAX_ENTRIES && (aInfo->entries = calloc(count ? count : 1, sizeof(*aInfo->entries))) != NULL)
+    {
+        for (aInfo->entry_count = 0; aInfo->entry_count < count; aInfo->entry_count++)
+        {
+            ArchiveEntry *entry = &aInfo->entries[aInfo->entry_count];
+            if (p >= end || (size_t)(end - p) < 1u + *p + 8)
+                break;
+            memcpy(entry->name, p + 1, *p);
+            entry->name[*p] = '\0';
+            p += 1 + *p;
+            entry->size = get_u32(p);
+            entry->offset = get_u32(p + 4);
+            p += 8;
+            if (!valid_entry_name(entry->name) || (size_t)entry->offset + entry->size > data_capacity)
+                break;
+        }
+        status = aInfo->entry_count == count ? e_success : e_failure;
+    }
+    if (status == e_failure)
+    {
+        printf("Error: corrupted archive directory\n");
+    }
+    free(dir);
+    return status;
+}
+
+static Status list_archive(ArchiveInfo *aInfo)
+{
+    printf("📚 %s: %u entries\n", aInfo->stego_image_fname, aInfo->entry_count);
+    printf("---------------------------------------------\n");
+    for (uint i = 0; i < aInfo->entry_count; i++)
+    {
+        printf("%12u  %s\n", aInfo->entries[i].size, aInfo->entries[i].name);
+    }
+    printf("---------------------------------------------\n");
+    return e_success;
+}
+
+/* Decode one entry straight from its carrier offset */
+static Status extract_entry(ArchiveInfo *aInfo, DecodeInfo *dcdInfo)
+{
+    ArchiveEntry *entry = NULL;
+    for (uint i = 0; i < aInfo->entry_count && entry == NULL; i++)
+    {
+        if (!strcmp(aInfo->entries[i].name, aInfo->entry_name))
+            entry = &aInfo->entries[i];
+    }
+    if (entry == NULL)
+    {
+        printf("Error: '%s' is not in %s\n", aInfo->entry_name, aInfo->stego_image_fname);
+        return e_failure;
+    }
+
+    AtomicOut out;
+    FILE *fptr_out = atomic_out_open(&out, aInfo->out_fname, "wb");
+    if (fptr_out == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "Error: unable to open '%s'\n", aInfo->out_fname);
+        return e_failure;
+    }
+
+    char buffer[4096];
+    size_t offset = aInfo->data_pos + (size_t)entry->offset * 8;
+    Status status = e_success;
+    for (size_t remaining = entry->size; remaining > 0 && status == e_success;)
+    {
+        size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        const char *carrier = decode_carrier_bytes(dcdInfo, offset, chunk * 8);
+        if (carrier == NULL)
+        {
+            status = e_failure;
+            break;
+        }
+        lsb_kernel_table[e_layout_bytes].extract_block(buffer, chunk, carrier);
+        offset += chunk * 8;
+        if (fwrite(buffer, 1, chunk, fptr_out) != chunk)
+            status = e_failure;
+        remaining -= chunk;
+    }
+    if (status == e_success && atomic_out_publish(&out, fptr_out, 1) == e_failure)
+        status = e_failure;
+    if (fclose(fptr_out) != 0)
+        status = e_failure;
+    atomic_out_close(&out);
+    if (status == e_success)
+        printf("📤 Extracted %s (%u bytes) -> %s\n", entry->name, entry->size, aInfo->out_fname);
+    return status;
+}
+
+Status do_archive(ArchiveInfo *aInfo)
+{
+    if (aInfo->operation == e_archive)
+    {
+        return build_archive(aInfo);
+    }
+
+    DecodeInfo dcdInfo = {0};
+    Status status = read_directory(aInfo, &dcdInfo);
+    if (status == e_success)
+    {
+        status = aInfo->operation == e_list ? list_archive(aInfo) : extract_entry(aInfo, &dcdInfo);
+    }
+    close_file_decode(&dcdInfo);
+    free(aInfo->entries);
+    aInfo->entries = NULL;
+    return status;
+}
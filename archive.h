@@ -0,0 +1,57 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Multi-file archive (-A / -l / -x)
+ * ---------------------------------
+ * After the magic string, in the plain one bit per carrier byte layout:
+ *   options word   OPT_ARCHIVE, extension size 0
+ *   32 bit size of the directory table in bytes
+ *   directory      32 bit entry count, then per entry a 1 byte name
+ *                  length, the name, 32 bit size and 32 bit offset
+ *   data           the files back to back, offsets count from here
+ * Every entry sits at a fixed carrier offset, so one file is extracted
+ * without decoding the others.
+ */
+
+#define ARCHIVE_NAME_MAX 255      // Longest entry name
+#define ARCHIVE_MAX_ENTRIES 65536 // Most entries a directory may list
+
+typedef struct _ArchiveEntry
+{
+    char name[ARCHIVE_NAME_MAX + 1]; // To store the file name (no directories)
+    uint size;                       // To store the size of the file
+    uint offset;                     // To store the offset in the data region
+} ArchiveEntry;
+
+/*
+ * Structure to store the arguments and the directory of an
+ * archive being built, listed or extracted from
+ */
+typedef struct _ArchiveInfo
+{
+    OperationType operation;  // To store e_archive, e_list or e_extract
+    char *src_image_fname;    // To store the carrier image name (-A)
+    char *stego_image_fname;  // To store the archive image name
+    char **member_fnames;     // To store the files to add (-A)
+    int member_count;         // To store the number of files to add
+    char *entry_name;         // To store the entry to extract (-x)
+    char *out_fname;          // To store the output of -x (entry name by default)
+
+    ArchiveEntry *entries;    // To store the directory table
+    uint entry_count;         // To store the number of entries
+    size_t data_pos;          // To store the carrier offset of the data region
+} ArchiveInfo;
+
+/* Read and validate -A / -l / -x args from argv */
+Status read_and_validate_archive_args(char *argv[], ArchiveInfo *aInfo);
+
+/* Build, list or extract from an archive */
+Status do_archive(ArchiveInfo *aInfo);
+
+#endif
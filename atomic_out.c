@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "atomic_out.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Names handed out for links next to an existing file, unique per process */
+static unsigned int atomic_out_serial;
+
+/* Directory and base name of a path ("." for a bare name) */
+static void split_path(const char *path, char *dir, size_t size, const char **base)
+{
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL)
+    {
+        snprintf(dir, size, ".");
+        *base = path;
+    }
+    else
+    {
+        snprintf(dir, size, "%.*s", slash == path ? 1 : (int)(slash - path), path);
+        *base = slash + 1;
+    }
+}
+
+FILE *atomic_out_open(AtomicOut *out, const char *path, const char *mode)
+{
+    char dir[PATH_MAX];
+    const char *base;
+
+    if (snprintf(out->path, sizeof(out->path), "%s", path) >= (int)sizeof(out->path))
+    {
+        out->path[0] = '\0';
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    out->tmp[0] = '\0';
+    split_path(path, dir, sizeof(dir), &base);
+
+    int fd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+    // no O_TMPFILE on this file system (or kernel): a hidden name next to the output
+    if (fd < 0 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL))
+    {
+        if (snprintf(out->tmp, sizeof(out->tmp), "%s/.%s.XXXXXX", dir, base) >= (int)sizeof(out->tmp))
+        {
+            out->tmp[0] = '\0';
+            errno = ENAMETOOLONG;
+        }
+        else if ((fd = mkostemp(out->tmp, O_CLOEXEC)) >= 0)
+            fchmod(fd, 0644);
+        else
+            out->tmp[0] = '\0';
+    }
+    FILE *fptr = fd < 0 ? NULL : fdopen(fd, mode);
+    if (fptr == NULL)
+    {
+        int err = errno;
+        if (fd >= 0)
+            close(fd);
+        atomic_out_close(out);
+        errno = err;
+    }
+    return fptr;
+}
+
+Status atomic_out_publish(AtomicOut *out, FILE *fptr, int sync)
+{
+    char dir[PATH_MAX], proc[64];
+    const char *base;
+
+    // not opened here (a daemon fd): nothing to name
+    if (out->path[0] == '\0')
+        return fflush(fptr) == 0 ? e_success : e_failure;
+    if (fflush(fptr) != 0 || (sync && fdatasync(fileno(fptr)) < 0))
+        return e_failure;
+    split_path(out->path, dir, sizeof(dir), &base);
+
+    if (out->tmp[0] == '\0')
+    {
+        // the unnamed file is linked in through procfs, straight to its name when that is free
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fileno(fptr));
+        if (linkat(AT_FDCWD, proc, AT_FDCWD, out->path, AT_SYMLINK_FOLLOW) == 0)
+            goto published;
+        // an older file has the name: link next to it and rename over it
+        for (int tries = 0; errno == EEXIST && tries < 100; tries++)
+        {
+            if (snprintf(out->tmp, sizeof(out->tmp), "%s/.%s.%ld.%u", dir, base, (long)getpid(), __sync_fetch_and_add(&atomic_out_serial, 1)) >= (int)sizeof(out->tmp))
+            {
+                out->tmp[0] = '\0';
+                errno = ENAMETOOLONG;
+                return e_failure;
+            }
+            if (linkat(AT_FDCWD, proc, AT_FDCWD, out->tmp, AT_SYMLINK_FOLLOW) == 0)
+                break;
+            out->tmp[0] = '\0';
+        }
+        if (out->tmp[0] == '\0')
+            return e_failure;
+    }
+    if (rename(out->tmp, out->path) < 0)
+        return e_failure;
+
+published:
+    out->tmp[0] = '\0';
+    out->path[0] = '\0';
+    // the new directory entry is durable too
+    if (sync)
+    {
+        int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0 || fsync(dir_fd) < 0)
+        {
+            if (dir_fd >= 0)
+                close(dir_fd);
+            return e_failure;
+        }
+        close(dir_fd);
+    }
+    return e_success;
+}
+
+void atomic_out_close(AtomicOut *out)
+{
+    if (out->tmp[0] != '\0')
+        unlink(out->tmp);
+    out->tmp[0] = '\0';
+    out->path[0] = '\0';
+}
@@ -0,0 +1,36 @@
+#ifndef ATOMIC_OUT_H
+#define ATOMIC_OUT_H
+
+#include <stdio.h>
+#include <limits.h>
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Crash safe outputs
+ * ------------------
+ * An output file is written without a name: an O_TMPFILE in the
+ * directory of its final path, or a hidden mkostemp name next to it on
+ * file systems without O_TMPFILE. Only a job that went through links it
+ * in (linkat, or rename over an older file), so a crash or a failed
+ * stage never leaves a truncated file under the real name. Publishing
+ * can make the file durable on its own (fdatasync + directory fsync) or
+ * leave that to a caller that syncs a whole batch of outputs at once.
+ */
+
+typedef struct _AtomicOut
+{
+    char path[PATH_MAX]; // To store the final name ("" = not in use)
+    char tmp[PATH_MAX];  // To store the temporary name ("" for an O_TMPFILE)
+} AtomicOut;
+
+/* Open an unnamed output that becomes path once published, NULL (errno set) on error */
+FILE *atomic_out_open(AtomicOut *out, const char *path, const char *mode);
+
+/* Flush the stream and give it its name, fdatasync'ed first when sync is set */
+Status atomic_out_publish(AtomicOut *out, FILE *fptr, int sync);
+
+/* Forget the output after fclose, a temporary name that was never published is removed */
+void atomic_out_close(AtomicOut *out);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include "carrier_cache.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static Carrier *cache_head;  // Most recently used
+static Carrier *cache_tail;  // Least recently used
+static size_t cache_bytes;   // Pixel bytes of the cached carriers
+static size_t cache_budget;  // 0 = cache disabled
+
+void carrier_cache_init(size_t budget)
+{
+    cache_budget = budget;
+}
+
+static void carrier_free(Carrier *carrier)
+{
+    free(carrier->pixels);
+    free(carrier);
+}
+
+static void lru_unlink(Carrier *carrier)
+{
+    if (carrier->prev != NULL)
+        carrier->prev->next = carrier->next;
+    else
+        cache_head = carrier->next;
+    if (carrier->next != NULL)
+        carrier->next->prev = carrier->prev;
+    else
+        cache_tail = carrier->prev;
+    carrier->prev = carrier->next = NULL;
+}
+
+static void lru_push_front(Carrier *carrier)
+{
+    carrier->prev = NULL;
+    carrier->next = cache_head;
+    if (cache_head != NULL)
+        cache_head->prev = carrier;
+    cache_head = carrier;
+    if (cache_tail == NULL)
+        cache_tail = carrier;
+}
+
+/* Drop unused carriers from the cold end until the budget holds (lock held) */
+static void evict(void)
+{
+    Carrier *carrier = cache_tail;
+    while (carrier != NULL && cache_bytes > cache_budget)
+    {
+        Carrier *prev = carrier->prev;
+        if (carrier->refs == 0)
+        {
+            lru_unlink(carrier);
+            cache_bytes -= carrier->pixels_size;
+            carrier_free(carrier);
+        }
+        carrier = prev;
+    }
+}
+
+/* The file is still the one a carrier was read from: an in-place rewrite moves the ctime even when the mtime is put back */
+static int same_file(const Carrier *carrier, const struct stat *st)
+{
+    return carrier->dev == st->st_dev && carrier->ino == st->st_ino && carrier->size == st->st_size &&
+           carrier->mtime.tv_sec == st->st_mtim.tv_sec && carrier->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+           carrier->ctime.tv_sec == st->st_ctim.tv_sec && carrier->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+static Carrier *lookup(const struct stat *st)
+{
+    for (Carrier *carrier = cache_head; carrier != NULL; carrier = carrier->next)
+    {
+        if (same_file(carrier, st))
+            return carrier;
+    }
+    return NULL;
+}
+
+/* Parse and read a whole carrier, outside the lock */
+static Carrier *carrier_load(FILE *fptr_image, const struct stat *st)
+{
+    Carrier *carrier = calloc(1, sizeof(*carrier));
+    if (carrier == NULL)
+    {
+        return NULL;
+    }
+    if (read_image_geometry(fptr_image, &carrier->geometry) == e_failure || st->st_size < carrier->geometry.data_offset)
+    {
+        carrier_free(carrier);
+        return NULL;
+    }
+    uint offset = carrier->geometry.data_offset;
+    carrier->pixels_size = (size_t)st->st_size - offset;
+    carrier->pixels = malloc(carrier->pixels_size);
+
+    int fd = fileno(fptr_image);
+    if (carrier->pixels == NULL || pread(fd, carrier->header, offset, 0) != offset)
+    {
+        carrier_free(carrier);
+        return NULL;
+    }
+    for (size_t done = 0; done < carrier->pixels_size;)
+    {
+        ssize_t n = pread(fd, carrier->pixels + done, carrier->pixels_size - done, offset + done);
+        if (n <= 0)
+        {
+            carrier_free(carrier);
+            return NULL;
+        }
+        done += (size_t)n;
+    }
+
+    carrier->dev = st->st_dev;
+    carrier->ino = st->st_ino;
+    carrier->size = st->st_size;
+    carrier->mtime = st->st_mtim;
+    carrier->ctime = st->st_ctim;
+
+    // written to while it was read: the pixels may be half old, half new
+    struct stat after;
+    if (fstat(fd, &after) < 0 || !same_file(carrier, &after))
+    {
+        carrier_free(carrier);
+        return NULL;
+    }
+    return carrier;
+}
+
+const Carrier *carrier_cache_acquire(FILE *fptr_image)
+{
+    struct stat st;
+    if (cache_budget == 0 || fstat(fileno(fptr_image), &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    Carrier *carrier = lookup(&st);
+    if (carrier != NULL)
+    {
+        carrier->refs++;
+        lru_unlink(carrier);
+        lru_push_front(carrier);
+        pthread_mutex_unlock(&cache_lock);
+        return carrier;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    Carrier *loaded = carrier_load(fptr_image, &st);
+    if (loaded == NULL)
+    {
+        return NULL;
+    }
+    loaded->refs = 1;
+
+    pthread_mutex_lock(&cache_lock);
+    // Another worker may have loaded the same carrier meanwhile
+    carrier = lookup(&st);
+    if (carrier != NULL)
+    {
+        carrier->refs++;
+        pthread_mutex_unlock(&cache_lock);
+        carrier_free(loaded);
+        return carrier;
+    }
+    // a ctime within the last CARRIER_RACY_NS could still be shared by a rewrite in the same timestamp tick,
+    // such a carrier serves this job only
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    long long age = (now.tv_sec - st.st_ctim.tv_sec) * 1000000000LL + (now.tv_nsec - st.st_ctim.tv_nsec);
+    if (loaded->pixels_size <= cache_budget && age >= CARRIER_RACY_NS)
+    {
+        loaded->cached = 1;
+        lru_push_front(loaded);
+        cache_bytes += loaded->pixels_size;
+        evict();
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return loaded;
+}
+
+void carrier_cache_release(const Carrier *carrier)
+{
+    Carrier *entry = (Carrier *)carrier;
+    if (entry == NULL)
+    {
+        return;
+    }
+    if (!entry->cached)
+    {
+        carrier_free(entry);
+        return;
+    }
+    pthread_mutex_lock(&cache_lock);
+    entry->refs--;
+    evict();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void carrier_cache_destroy(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    while (cache_head != NULL)
+    {
+        Carrier *carrier = cache_head;
+        lru_unlink(carrier);
+        carrier_free(carrier);
+    }
+    cache_bytes = 0;
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,55 @@
+#ifndef CARRIER_CACHE_H
+#define CARRIER_CACHE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "types.h" // Contains user defined types
+#include "image.h" // Pixel geometry
+
+/*
+ * Carrier cache for the daemon.
+ * Parsed bmp headers and pixel buffers of recently used carriers stay in
+ * memory, keyed by device / inode / size / mtime / ctime of the source
+ * file, and are evicted least recently used first once the byte budget is
+ * exceeded. A carrier changed within the last timestamp tick is not kept,
+ * a rewrite in the same tick would leave its stamps as they were.
+ * The pixels of a cached carrier are never written: an encode copies the
+ * part it embeds into and writes the untouched tail straight from here.
+ */
+
+typedef struct _Carrier
+{
+    char header[BMP_HEADER_MAX]; // To store the bmp header as read (geometry.data_offset bytes)
+    ImageGeometry geometry; // To store the pixel geometry
+    char *pixels;           // To store the pixel bytes after the header (read only)
+    size_t pixels_size;     // To store the number of pixel bytes
+
+    /* Cache bookkeeping, owned by carrier_cache.c */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    int refs;                  // Jobs currently using the carrier
+    int cached;                // 0 for a carrier larger than the whole budget or changed too recently
+    struct _Carrier *prev, *next; // LRU list, most recent first
+} Carrier;
+
+#define CARRIER_RACY_NS 1000000000LL // Carriers whose ctime is younger than this are not kept
+
+/* Enable the cache with a byte budget (0 leaves it disabled) */
+void carrier_cache_init(size_t budget);
+
+/* Carrier of an open bmp, loaded on a miss; NULL when disabled or on error */
+const Carrier *carrier_cache_acquire(FILE *fptr_image);
+
+/* Done with a carrier from carrier_cache_acquire */
+void carrier_cache_release(const Carrier *carrier);
+
+/* Free every carrier, call once no job holds one */
+void carrier_cache_destroy(void);
+
+#endif
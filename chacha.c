@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include "chacha.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "sha256.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHACHA_HAVE_X86 1
+#endif
+
+#define CHACHA_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+/* One quarter round on four words of a state */
+#define CHACHA_QR(x, a, b, c, d)                  \
+    do                                            \
+    {                                             \
+        x[a] += x[b], x[d] = CHACHA_ROTL(x[d] ^ x[a], 16); \
+        x[c] += x[d], x[b] = CHACHA_ROTL(x[b] ^ x[c], 12); \
+        x[a] += x[b], x[d] = CHACHA_ROTL(x[d] ^ x[a], 8);  \
+        x[c] += x[d], x[b] = CHACHA_ROTL(x[b] ^ x[c], 7);  \
+    } while (0)
+
+/* 20 rounds: a column round and a diagonal round, ten times */
+#define CHACHA_ROUNDS(x, QR)                               \
+    do                                                     \
+    {                                                      \
+        for (int round = 0; round < 10; round++)           \
+        {                                                  \
+            QR(x, 0, 4, 8, 12);                            \
+            QR(x, 1, 5, 9, 13);                            \
+            QR(x, 2, 6, 10, 14);                           \
+            QR(x, 3, 7, 11, 15);                           \
+            QR(x, 0, 5, 10, 15);                           \
+            QR(x, 1, 6, 11, 12);                           \
+            QR(x, 2, 7, 8, 13);                            \
+            QR(x, 3, 4, 9, 14);                            \
+        }                                                  \
+    } while (0)
+
+static inline uint32_t chacha_load32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* One 64 byte keystream block, as 16 words */
+static void chacha_block(const uint32_t *state, uint32_t counter, uint32_t *out)
+{
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    x[12] = counter;
+    CHACHA_ROUNDS(x, CHACHA_QR);
+    for (int i = 0; i < 16; i++)
+        out[i] = x[i] + (i == 12 ? counter : state[i]);
+}
+
+/* XOR n <= 64 bytes with block bytes [skip, skip + n) */
+static void chacha_xor_block(const uint32_t *block, size_t skip, char *data, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        data[i] ^= (char)(block[(skip + i) / 4] >> (8 * ((skip + i) % 4)));
+}
+
+#ifdef __SSE2__
+#define CHACHA_ROTL_SSE2(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define CHACHA_QR_SSE2(x, a, b, c, d)                                                        \
+    do                                                                                       \
+    {                                                                                        \
+        x[a] = _mm_add_epi32(x[a], x[b]), x[d] = CHACHA_ROTL_SSE2(_mm_xor_si128(x[d], x[a]), 16); \
+        x[c] = _mm_add_epi32(x[c], x[d]), x[b] = CHACHA_ROTL_SSE2(_mm_xor_si128(x[b], x[c]), 12); \
+        x[a] = _mm_add_epi32(x[a], x[b]), x[d] = CHACHA_ROTL_SSE2(_mm_xor_si128(x[d], x[a]), 8);  \
+        x[c] = _mm_add_epi32(x[c], x[d]), x[b] = CHACHA_ROTL_SSE2(_mm_xor_si128(x[b], x[c]), 7);  \
+    } while (0)
+
+/*
+ * Four blocks at once: vector i holds word i of blocks counter .. counter + 3.
+ * After the rounds each group of four word vectors is a 4 x 4 transpose
+ * away from 16 keystream bytes of every block, XORed straight into data.
+ */
+static void chacha_xor4_sse2(const uint32_t *state, uint32_t counter, char *data)
+{
+    __m128i x[16], in[16];
+    for (int i = 0; i < 16; i++)
+        in[i] = _mm_set1_epi32((int)state[i]);
+    in[12] = _mm_add_epi32(_mm_set1_epi32((int)counter), _mm_set_epi32(3, 2, 1, 0));
+    memcpy(x, in, sizeof(x));
+    CHACHA_ROUNDS(x, CHACHA_QR_SSE2);
+
+    for (int g = 0; g < 4; g++)
+    {
+        __m128i w0 = _mm_add_epi32(x[4 * g], in[4 * g]), w1 = _mm_add_epi32(x[4 * g + 1], in[4 * g + 1]);
+        __m128i w2 = _mm_add_epi32(x[4 * g + 2], in[4 * g + 2]), w3 = _mm_add_epi32(x[4 * g + 3], in[4 * g + 3]);
+        __m128i lo01 = _mm_unpacklo_epi32(w0, w1), lo23 = _mm_unpacklo_epi32(w2, w3);
+        __m128i hi01 = _mm_unpackhi_epi32(w0, w1), hi23 = _mm_unpackhi_epi32(w2, w3);
+        __m128i t[4] = {_mm_unpacklo_epi64(lo01, lo23), _mm_unpackhi_epi64(lo01, lo23), _mm_unpacklo_epi64(hi01, hi23), _mm_unpackhi_epi64(hi01, hi23)};
+        for (int b = 0; b < 4; b++)
+        {
+            __m128i *p = (__m128i *)(data + 64 * b + 16 * g);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), t[b]));
+        }
+    }
+}
+#endif
+
+#ifdef CHACHA_HAVE_X86
+static int chacha_have_avx2;
+
+#define CHACHA_ROTL_AVX2(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define CHACHA_QR_AVX2(x, a, b, c, d)                                                              \
+    do                                                                                             \
+    {                                                                                              \
+        x[a] = _mm256_add_epi32(x[a], x[b]), x[d] = CHACHA_ROTL_AVX2(_mm256_xor_si256(x[d], x[a]), 16); \
+        x[c] = _mm256_add_epi32(x[c], x[d]), x[b] = CHACHA_ROTL_AVX2(_mm256_xor_si256(x[b], x[c]), 12); \
+        x[a] = _mm256_add_epi32(x[a], x[b]), x[d] = CHACHA_ROTL_AVX2(_mm256_xor_si256(x[d], x[a]), 8);  \
+        x[c] = _mm256_add_epi32(x[c], x[d]), x[b] = CHACHA_ROTL_AVX2(_mm256_xor_si256(x[b], x[c]), 7);  \
+    } while (0)
+
+/*
+ * Eight blocks at once, same layout as the SSE2 version. The unpacks
+ * work per 128 bit lane, so the low lane of a transposed vector belongs
+ * to block b and the high lane to block b + 4.
+ */
+__attribute__((target("avx2"))) static void chacha_xor8_avx2(const uint32_t *state, uint32_t counter, char *data)
+{
+    __m256i x[16], in[16];
+    for (int i = 0; i < 16; i++)
+        in[i] = _mm256_set1_epi32((int)state[i]);
+    in[12] = _mm256_add_epi32(_mm256_set1_epi32((int)counter), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    memcpy(x, in, sizeof(x));
+    CHACHA_ROUNDS(x, CHACHA_QR_AVX2);
+
+    for (int g = 0; g < 4; g++)
+    {
+        __m256i w0 = _mm256_add_epi32(x[4 * g], in[4 * g]), w1 = _mm256_add_epi32(x[4 * g + 1], in[4 * g + 1]);
+        __m256i w2 = _mm256_add_epi32(x[4 * g + 2], in[4 * g + 2]), w3 = _mm256_add_epi32(x[4 * g + 3], in[4 * g + 3]);
+        __m256i lo01 = _mm256_unpacklo_epi32(w0, w1), lo23 = _mm256_unpacklo_epi32(w2, w3);
+        __m256i hi01 = _mm256_unpackhi_epi32(w0, w1), hi23 = _mm256_unpackhi_epi32(w2, w3);
+        __m256i t[4] = {_mm256_unpacklo_epi64(lo01, lo23), _mm256_unpackhi_epi64(lo01, lo23), _mm256_unpacklo_epi64(hi01, hi23), _mm256_unpackhi_epi64(hi01, hi23)};
+        for (int b = 0; b < 4; b++)
+        {
+            __m128i *lo = (__m128i *)(data + 64 * b + 16 * g);
+            __m128i *hi = (__m128i *)(data + 64 * (b + 4) + 16 * g);
+            _mm_storeu_si128(lo, _mm_xor_si128(_mm_loadu_si128(lo), _mm256_castsi256_si128(t[b])));
+            _mm_storeu_si128(hi, _mm_xor_si128(_mm_loadu_si128(hi), _mm256_extracti128_si256(t[b], 1)));
+        }
+    }
+}
+#endif
+
+void chacha_init_kernels(void)
+{
+#ifdef CHACHA_HAVE_X86
+    __builtin_cpu_init();
+    chacha_have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+void chacha_setup(ChachaCtx *ctx, const unsigned char *key, const unsigned char *nonce)
+{
+    // "expand 32-byte k"
+    ctx->state[0] = 0x61707865;
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++)
+        ctx->state[4 + i] = chacha_load32(key + 4 * i);
+    ctx->state[12] = 0;
+    for (int i = 0; i < 3; i++)
+        ctx->state[13 + i] = chacha_load32(nonce + 4 * i);
+}
+
+void chacha_derive_key(const char *passphrase, const unsigned char *nonce, unsigned char *key)
+{
+    // PBKDF2-HMAC-SHA256 salted with the image's nonce: a fresh key per image, and every guess costs the iterations
+    pbkdf2_sha256(passphrase, strlen(passphrase), nonce, CHACHA_NONCE_SIZE, CHACHA_KDF_ITERATIONS, key, CHACHA_KEY_SIZE);
+}
+
+void chacha_key_check(const ChachaCtx *ctx, unsigned char *check)
+{
+    // the last block of the keystream, payloads end gigabytes before it
+    uint32_t block[16];
+    chacha_block(ctx->state, 0xFFFFFFFF, block);
+    for (int i = 0; i < CHACHA_CHECK_SIZE; i++)
+        check[i] = (unsigned char)(block[i / 4] >> (8 * (i % 4)));
+}
+
+Status chacha_read_passphrase(const char *option, char *value, char **passphrase)
+{
+    char line[CHACHA_PASSPHRASE_MAX + 2];
+    const char *source = value;
+
+    if (value == NULL || value[0] == '\0')
+    {
+        printf("Error: %s expects %s\n", option, !strcmp(option, "--key-fd") ? "a file descriptor" : !strcmp(option, "--key-env") ? "a variable name" : "a passphrase");
+        return e_failure;
+    }
+    if (!strcmp(option, "--key-fd"))
+    {
+        // the first line of the fd, without its newline
+        char *end;
+        long fd = strtol(value, &end, 10);
+        size_t len = 0;
+        ssize_t n = 0;
+        if (*end != '\0' || fd < 0 || fd > INT_MAX)
+        {
+            printf("Error: --key-fd expects a file descriptor\n");
+            return e_failure;
+        }
+        while (len < sizeof(line) - 1 && (n = read((int)fd, line + len, 1)) == 1 && line[len] != '\n')
+            len++;
+        if (n < 0)
+        {
+            perror("--key-fd");
+            return e_failure;
+        }
+        if (len > CHACHA_PASSPHRASE_MAX)
+        {
+            printf("Error: the passphrase on --key-fd is longer than %d bytes\n", CHACHA_PASSPHRASE_MAX);
+            memset(line, 0, sizeof(line));
+            return e_failure;
+        }
+        if (len > 0 && line[len - 1] == '\r')
+            len--;
+        line[len] = '\0';
+        source = line;
+    }
+    else if (!strcmp(option, "--key-env"))
+    {
+        source = getenv(value);
+        if (source == NULL)
+        {
+            printf("Error: --key-env: %s is not set\n", value);
+            return e_failure;
+        }
+    }
+    if (source[0] == '\0')
+    {
+        printf("Error: %s gave an empty passphrase\n", option);
+        return e_failure;
+    }
+
+    free(*passphrase);
+    *passphrase = strdup(source);
+    memset(line, 0, sizeof(line));
+    if (*passphrase == NULL)
+    {
+        perror("strdup");
+        return e_failure;
+    }
+    // --key: wipe the argv copy, /proc/<pid>/cmdline shows it for as long as we run
+    if (!strcmp(option, "--key"))
+        memset(value, 0, strlen(value));
+    return e_success;
+}
+
+Status chacha_random_nonce(unsigned char *nonce)
+{
+    if (getrandom(nonce, CHACHA_NONCE_SIZE, 0) != CHACHA_NONCE_SIZE)
+    {
+        perror("getrandom");
+        return e_failure;
+    }
+    return e_success;
+}
+
+void chacha_xor(const ChachaCtx *ctx, unsigned long long offset, char *data, size_t n)
+{
+    uint32_t counter = (uint32_t)(offset / 64);
+    uint32_t block[16];
+
+    // finish the block the offset starts in
+    size_t skip = offset % 64;
+    if (skip != 0 && n > 0)
+    {
+        size_t take = 64 - skip < n ? 64 - skip : n;
+        chacha_block(ctx->state, counter++, block);
+        chacha_xor_block(block, skip, data, take);
+        data += take;
+        n -= take;
+    }
+#ifdef CHACHA_HAVE_X86
+    if (chacha_have_avx2)
+    {
+        for (; n >= 8 * 64; data += 8 * 64, n -= 8 * 64, counter += 8)
+            chacha_xor8_avx2(ctx->state, counter, data);
+    }
+#endif
+#ifdef __SSE2__
+    for (; n >= 4 * 64; data += 4 * 64, n -= 4 * 64, counter += 4)
+        chacha_xor4_sse2(ctx->state, counter, data);
+#endif
+    for (; n > 0; counter++)
+    {
+        size_t take = n < 64 ? n : 64;
+        chacha_block(ctx->state, counter, block);
+        chacha_xor_block(block, 0, data, take);
+        data += take;
+        n -= take;
+    }
+}
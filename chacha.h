@@ -0,0 +1,53 @@
+#ifndef CHACHA_H
+#define CHACHA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h" // Contains user defined types
+
+/*
+ * ChaCha20 stream cipher (RFC 8439) for --key.
+ * The payload is XORed with the keystream at its byte offset, so any
+ * chunk of it can be encrypted or decrypted on its own, in place, while
+ * it sits in the chunk buffer between the secret file and the kernels.
+ * Blocks are generated 8 at a time with AVX2 or 4 at a time with SSE2.
+ * The key is PBKDF2-HMAC-SHA256 of the passphrase salted with the
+ * image's nonce. A short tag from the last keystream block follows the
+ * nonce, so a wrong passphrase fails before anything is written; the
+ * payload itself is not authenticated.
+ */
+
+#define CHACHA_KEY_SIZE 32           // Key bytes
+#define CHACHA_NONCE_SIZE 12         // Nonce bytes, one random nonce per image
+#define CHACHA_CHECK_SIZE 4          // Key check tag bytes, after the nonce
+#define CHACHA_KDF_ITERATIONS 200000 // PBKDF2 rounds per key
+#define CHACHA_PASSPHRASE_MAX 1024   // Longest passphrase read from --key-fd
+
+typedef struct _ChachaCtx
+{
+    uint32_t state[16]; // Constants, key, block counter (word 12) and nonce
+} ChachaCtx;
+
+/* Pick the keystream variant for this CPU, call once at startup */
+void chacha_init_kernels(void);
+
+/* Derive the key from a --key passphrase and the image's nonce */
+void chacha_derive_key(const char *passphrase, const unsigned char *nonce, unsigned char *key);
+
+/* Key check tag of a set up cipher */
+void chacha_key_check(const ChachaCtx *ctx, unsigned char *check);
+
+/* Take the passphrase of --key PASS, --key-fd N (first line) or --key-env VAR into a private copy */
+Status chacha_read_passphrase(const char *option, char *value, char **passphrase);
+
+/* Fresh nonce from the kernel's random source */
+Status chacha_random_nonce(unsigned char *nonce);
+
+/* Set up the cipher for one key and nonce */
+void chacha_setup(ChachaCtx *ctx, const unsigned char *key, const unsigned char *nonce);
+
+/* XOR n bytes of data with the keystream from byte offset on (encrypts and decrypts) */
+void chacha_xor(const ChachaCtx *ctx, unsigned long long offset, char *data, size_t n);
+
+#endif
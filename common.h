@@ -4,4 +4,43 @@
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/*
+ * The 32 bit extension size field right after the magic string holds
+ * the extension length in its low byte; the bits above it are option
+ * bits, all zero for images written by older versions.
+ */
+#define EXTN_SIZE_MASK 0xFF
+#define OPT_CHANNEL_SHIFT 8                         // --channels mask (0 = every byte)
+#define OPT_CHANNEL_MASK (0x7 << OPT_CHANNEL_SHIFT)
+#define OPT_ECC (1 << 11)                           // --ecc: Hamming(7,4) coded fields
+#define OPT_MATRIX_SHIFT 12                         // --matrix k (0 = one bit per byte)
+#define OPT_MATRIX_MASK (0x7 << OPT_MATRIX_SHIFT)
+#define OPT_ARCHIVE (1 << 15)                       // -A: directory table + many files
+#define OPT_ALPHA (1 << 16)                         // --channels ...A: alpha of a 32 bit image
+#define OPT_ADAPTIVE (1 << 17)                      // --adaptive: busiest tiles first
+#define OPT_CIPHER (1 << 18)                        // --key: ChaCha20 payload, nonce and key check after the option word
+#define OPT_KNOWN_MASK (EXTN_SIZE_MASK | OPT_CHANNEL_MASK | OPT_ECC | OPT_MATRIX_MASK | OPT_ARCHIVE | OPT_ALPHA | OPT_ADAPTIVE | OPT_CIPHER)
+
+/*
+ * With --ecc the option word, which says how everything after it is
+ * coded, is written OPT_WORD_COPIES times and read back by bitwise
+ * majority. The first copy is where older readers expect the word; the
+ * copies after it only count when their majority has OPT_ECC set and
+ * they disagree in at most OPT_WORD_MAX_SPLIT bit positions, which
+ * plain images never do (their nonce / extension follow the word).
+ */
+#define OPT_WORD_COPIES 3
+#define OPT_WORD_MAX_SPLIT 8
+
+/*
+ * The magic string itself is not coded. A magic at most MAGIC_MAX_FLIPS
+ * bits off is still accepted when the option word copies after it agree
+ * on an --ecc word: a plain or untouched image passes both by chance
+ * well under once in a million.
+ */
+#define MAGIC_MAX_FLIPS 2
+
+/* Carrier bytes of the longest header: magic, option word copies, nonce (3 ECC groups), key check, extension and size (an ECC group each) */
+#define HEADER_FIELDS_MAX (8 * (sizeof(MAGIC_STRING) - 1) + OPT_WORD_COPIES * 32 + 6 * 7 * 8)
+
 #endif
@@ -2,10 +2,25 @@
 #include "decode.h"
 #include "types.h"
 #include "common.h"
+#include "ecc.h"
+#include "adaptive.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <sys/mman.h>
 // #include "encode.h"
 
+/* Progress messages of a job, left out for quiet jobs (daemon) that print one line of their own */
+static void report(const DecodeInfo *dcdInfo, const char *format, ...)
+{
+    va_list args;
+    if (dcdInfo->quiet)
+        return;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
 int checkExtension1(char *str, char *extension)
 {
     /*
@@ -32,6 +47,29 @@ int checkExtension1(char *str, char *extension)
     return 1;
 }
 
+/* Options may appear anywhere after -d, they are removed from argv like the encoder's */
+static Status read_decode_options(char *argv[], DecodeInfo *dcdInfo)
+{
+    int out = 2;
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (!strcmp(argv[i], "--key") || !strcmp(argv[i], "--key-fd") || !strcmp(argv[i], "--key-env"))
+        {
+            if (chacha_read_passphrase(argv[i], argv[i + 1], &dcdInfo->key) == e_failure)
+            {
+                return e_failure;
+            }
+            i++;
+        }
+        else
+        {
+            argv[out++] = argv[i];
+        }
+    }
+    argv[out] = NULL;
+    return e_success;
+}
+
 Status read_and_validate_decode_args(char *argv[], DecodeInfo *dcdInfo)
 {
     /*
@@ -39,15 +77,19 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *dcdInfo)
      * Expects argv[2] to be the stego BMP file and optional argv[3]
      * to be the desired output base filename for the secret.
      */
+    if (read_decode_options(argv, dcdInfo) == e_failure || argv[2] == NULL)
+    {
+        return e_failure;
+    }
 
-    if (checkExtension1(argv[2], ".bmp"))
+    if (checkExtension1(argv[2], ".bmp") || checkExtension1(argv[2], ".ppm") || checkExtension1(argv[2], ".pgm"))
     {
         dcdInfo->stego1_image_fname = argv[2];
         // return e_success;
     }
     else
     {
-        printf("Error: '%s' must have a .bmp extension.\n", argv[2]);
+        printf("Error: '%s' must have a .bmp, .ppm or .pgm extension.\n", argv[2]);
         return e_failure;
     }
 
@@ -70,12 +112,19 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *dcdInfo)
 Status open_file_decode(DecodeInfo *dcdInfo)
 {
     /*
-     * Open the stego image file and store the FILE* in the structure.
-     * Returns e_success on success or e_failure on error.
+     * Open the stego image file and store the FILE* in the structure,
+     * then map its pixel data. A stream handed over by the daemon is
+     * already open. Returns e_success on success or e_failure on error.
      */
 
     // Src Image file
-    dcdInfo->fptr_stego1_image = fopen(dcdInfo->stego1_image_fname, "rb");
+    if (dcdInfo->fptr_stego1_image == NULL)
+    {
+        dcdInfo->fptr_stego1_image = fopen(dcdInfo->stego1_image_fname, "rb");
+        // An image opened by name may have an LSB index next to it
+        if (dcdInfo->fptr_stego1_image != NULL && lsbindex_open(dcdInfo->stego1_image_fname, dcdInfo->fptr_stego1_image, &dcdInfo->index) == e_success)
+            report(dcdInfo, "🗂️  Reading the LSB index %s%s\n", dcdInfo->stego1_image_fname, LSBINDEX_SUFFIX);
+    }
     // Do Error handling
     if (dcdInfo->fptr_stego1_image == NULL)
     {
@@ -85,49 +134,220 @@ Status open_file_decode(DecodeInfo *dcdInfo)
         return e_failure;
     }
 
+    return load_stego_image_data(dcdInfo);
+}
+
+void close_file_decode(DecodeInfo *dcdInfo)
+{
+    if (dcdInfo->map_base != NULL)
+        munmap(dcdInfo->map_base, dcdInfo->map_size);
+    else
+        free(dcdInfo->image_data);
+    free(dcdInfo->header_slots);
+    free(dcdInfo->view);
+    lsbindex_close(&dcdInfo->index);
+    dcdInfo->map_base = NULL;
+    dcdInfo->image_data = NULL;
+    dcdInfo->header_slots = NULL;
+    dcdInfo->view = NULL;
+    dcdInfo->view_alloc = 0;
+
+    if (dcdInfo->fptr_secret != NULL)
+        fclose(dcdInfo->fptr_secret);
+    atomic_out_close(&dcdInfo->secret_out);
+    if (dcdInfo->fptr_stego1_image != NULL)
+        fclose(dcdInfo->fptr_stego1_image);
+    dcdInfo->fptr_secret = NULL;
+    dcdInfo->fptr_stego1_image = NULL;
+}
+
+const char *decode_carrier_bytes(DecodeInfo *dcdInfo, size_t offset, size_t n)
+{
+    if (dcdInfo->index.plane == NULL)
+    {
+        return dcdInfo->image_data + offset;
+    }
+    // Whole plane bytes around the range, spread back into one LSB per byte
+    size_t first = offset / 8, last = (offset + n + 7) / 8;
+    size_t size = (last - first) * 8;
+    if (lsbindex_check(&dcdInfo->index, first, last) == e_failure)
+    {
+        return NULL;
+    }
+    if (size > dcdInfo->view_alloc)
+    {
+        char *view = realloc(dcdInfo->view, size);
+        if (view == NULL)
+        {
+            perror("realloc");
+            return NULL;
+        }
+        memset(view + dcdInfo->view_alloc, 0, size - dcdInfo->view_alloc);
+        dcdInfo->view = view;
+        dcdInfo->view_alloc = size;
+    }
+    lsb_kernel_table[e_layout_bytes].embed_block((const char *)dcdInfo->index.plane + first, last - first, dcdInfo->view);
+    return dcdInfo->view + offset % 8;
+}
+
+/*
+ * The header fields of a packed format are in the default channel slots
+ * of the first rows (mirror of gather_header_fields in encode.c). Enough
+ * rows for the longest header are gathered once, the fields are read
+ * from there. With an LSB index a bytewise header is unpacked the same way.
+ */
+static Status load_header_fields(DecodeInfo *dcdInfo)
+{
+    const ImageGeometry *geometry = &dcdInfo->geometry;
+
+    if (pixel_format_bytewise(geometry->format) && dcdInfo->index.plane == NULL)
+    {
+        dcdInfo->header_data = dcdInfo->image_data;
+        dcdInfo->header_data_size = dcdInfo->image_data_size;
+        return e_success;
+    }
+    if (pixel_format_bytewise(geometry->format))
+    {
+        size_t size = dcdInfo->image_data_size < HEADER_FIELDS_MAX ? dcdInfo->image_data_size : HEADER_FIELDS_MAX;
+        const char *pixels = decode_carrier_bytes(dcdInfo, 0, size);
+        if (pixels == NULL || (dcdInfo->header_slots = malloc(size + 1)) == NULL)
+        {
+            return e_failure;
+        }
+        memcpy(dcdInfo->header_slots, pixels, size);
+        dcdInfo->header_data = dcdInfo->header_slots;
+        dcdInfo->header_data_size = size;
+        return e_success;
+    }
+    uint field_mask = default_channel_mask(geometry->format);
+    const LsbKernels *fields = lsb_select_pixel_kernels(geometry->format, field_mask);
+    size_t row_slots = (size_t)geometry->width * channel_count(field_mask);
+    uint rows = payload_start_row(geometry, HEADER_FIELDS_MAX);
+    if (rows > dcdInfo->image_data_size / geometry->row_stride)
+        rows = (uint)(dcdInfo->image_data_size / geometry->row_stride);
+
+    const char *pixels = decode_carrier_bytes(dcdInfo, 0, (size_t)rows * geometry->row_stride);
+    dcdInfo->header_slots = malloc(rows * row_slots + 1);
+    if (pixels == NULL || dcdInfo->header_slots == NULL)
+    {
+        return e_failure;
+    }
+    for (uint r = 0; r < rows; r++)
+        fields->gather(pixels + (size_t)r * geometry->row_stride, geometry->width, dcdInfo->header_slots + r * row_slots);
+    dcdInfo->header_data = dcdInfo->header_slots;
+    dcdInfo->header_data_size = rows * row_slots;
     return e_success;
 }
 
-/* Copy bmp image header */
-Status skip_bmp_header(FILE *fptr_stego1_image)
+Status load_stego_image_data(DecodeInfo *dcdInfo)
 {
     /*
-     * Skip the BMP header (54 bytes) so we are positioned at the
-     * start of the pixel data where embedded bits are stored.
+     * Map the whole stego file and point image_data just past the header
+     * (bfOffBits, 54 bytes for a plain 24 bit bmp), so only the pages we
+     * actually decode are read from disk. Streams that cannot be mapped
+     * (pipes) are read into memory instead.
      */
+    FILE *fptr = dcdInfo->fptr_stego1_image;
+    if (read_image_geometry(fptr, &dcdInfo->geometry) == e_failure)
+    {
+        return e_failure;
+    }
+    // The index stands in for the pixels, they are never read
+    if (dcdInfo->index.plane != NULL)
+    {
+        dcdInfo->image_data = NULL;
+        dcdInfo->image_data_size = dcdInfo->index.bits;
+        dcdInfo->data_pos = 0;
+        return load_header_fields(dcdInfo);
+    }
+    long offset = dcdInfo->geometry.data_offset;
+    fseek(fptr, 0, SEEK_END);
+    long file_size = ftell(fptr);
+    if (file_size < offset)
+    {
+        return e_failure;
+    }
 
-    fseek(fptr_stego1_image, 54, SEEK_SET);
-    return e_success;
+    void *map = mmap(NULL, (size_t)file_size, PROT_READ, MAP_PRIVATE, fileno(fptr), 0);
+    if (map != MAP_FAILED)
+    {
+        dcdInfo->map_base = map;
+        dcdInfo->map_size = (size_t)file_size;
+        dcdInfo->image_data = (char *)map + offset;
+    }
+    else
+    {
+        dcdInfo->map_base = NULL;
+        dcdInfo->image_data = malloc((size_t)(file_size - offset));
+        if (dcdInfo->image_data == NULL)
+        {
+            return e_failure;
+        }
+        fseek(fptr, offset, SEEK_SET);
+        if (fread(dcdInfo->image_data, 1, (size_t)(file_size - offset), fptr) != (size_t)(file_size - offset))
+        {
+            return e_failure;
+        }
+    }
+    dcdInfo->image_data_size = (size_t)(file_size - offset);
+    dcdInfo->data_pos = 0;
+    return load_header_fields(dcdInfo);
 }
 
 /* Store Magic String */
+/* Bitwise majority of the option word copies at pos: 1 when they are the copies of an --ecc word */
+static int ecc_option_word(const DecodeInfo *dcdInfo, size_t pos, uint *majority, uint *split)
+{
+    int copy[OPT_WORD_COPIES];
+    if (pos + OPT_WORD_COPIES * 32 > dcdInfo->header_data_size)
+    {
+        return 0;
+    }
+    for (int i = 0; i < OPT_WORD_COPIES; i++)
+        decode_size_to_lsb(&copy[i], dcdInfo->header_data + pos + 32 * i);
+    uint a = (uint)copy[0], b = (uint)copy[1], c = (uint)copy[2];
+    *majority = (a & b) | (a & c) | (b & c);
+    *split = __builtin_popcount((a ^ *majority) | (b ^ *majority) | (c ^ *majority));
+    return (*majority & OPT_ECC) && *split <= OPT_WORD_MAX_SPLIT;
+}
+
 Status decode_magic_string(DecodeInfo *dcdInfo)
 {
     /*
      * Read and reconstruct the Magic string from LSBs and compare
-     * it to MAGIC_STRING. Returns e_success if it matches.
+     * it to MAGIC_STRING. Returns e_success if it matches, or if it is
+     * at most MAGIC_MAX_FLIPS bits off and an --ecc option word follows.
      */
 
-    char buffer[8];
     char str[100];
-    skip_bmp_header(dcdInfo->fptr_stego1_image);
     int i;
+    uint flips = 0, majority, split;
+    // Start right after the bmp header
+    dcdInfo->data_pos = 0;
+    if (dcdInfo->header_data_size < strlen(MAGIC_STRING) * 8)
+    {
+        return e_failure;
+    }
     for (i = 0; i < strlen(MAGIC_STRING); i++)
     {
         char ch;
-        fread(buffer, 8, 1, dcdInfo->fptr_stego1_image);
-        decode_lsb_to_byte(&ch, buffer);
+        decode_lsb_to_byte(&ch, dcdInfo->header_data + dcdInfo->data_pos);
+        dcdInfo->data_pos += 8;
         str[i] = ch;
+        flips += __builtin_popcount((unsigned char)(ch ^ MAGIC_STRING[i]));
     }
     str[i] = '\0';
     if (!strcmp(MAGIC_STRING, str))
     {
         return e_success;
     }
-    else
+    // the magic is not coded, a damaged one still counts when the copies of an --ecc word follow it
+    if (flips <= MAGIC_MAX_FLIPS && ecc_option_word(dcdInfo, dcdInfo->data_pos, &majority, &split) && !(majority & ~OPT_KNOWN_MASK))
     {
-        return e_failure;
+        dcdInfo->ecc_corrected += flips;
+        return e_success;
     }
+    return e_failure;
 }
 
 /*Encode extension size*/
@@ -137,9 +357,129 @@ Status decode_secret_file_extn_size(DecodeInfo *dcdInfo)
      * Read the 32 image-bytes that encode the extension size and
      * decode that into dcdInfo->extn_size.
      */
-    char buffer[32];
-    fread(buffer, 32, 1, dcdInfo->fptr_stego1_image);
-    decode_size_to_lsb(&dcdInfo->extn_size, buffer);
+    if (dcdInfo->data_pos + 32 > dcdInfo->header_data_size)
+    {
+        return e_failure;
+    }
+    int word;
+    decode_size_to_lsb(&word, dcdInfo->header_data + dcdInfo->data_pos);
+    dcdInfo->data_pos += 32;
+    // --ecc copies of the word: bitwise majority, when they really are copies
+    uint majority, split;
+    if (ecc_option_word(dcdInfo, dcdInfo->data_pos - 32, &majority, &split))
+    {
+        word = (int)majority;
+        dcdInfo->data_pos += (OPT_WORD_COPIES - 1) * 32;
+        dcdInfo->ecc_corrected += split;
+    }
+    else if (word & OPT_ECC)
+    {
+        // the copies of an --ecc word disagree too much to trust any of them
+        return e_failure;
+    }
+    // Option bits we do not know mean a newer format (or no stego data)
+    if (word & ~OPT_KNOWN_MASK)
+    {
+        return e_failure;
+    }
+    dcdInfo->extn_size = word & EXTN_SIZE_MASK;
+    dcdInfo->channel_mask = (word & OPT_CHANNEL_MASK) >> OPT_CHANNEL_SHIFT | (word & OPT_ALPHA ? CHANNEL_A : 0);
+    dcdInfo->ecc = (word & OPT_ECC) != 0;
+    dcdInfo->archive = (word & OPT_ARCHIVE) != 0;
+    dcdInfo->adaptive = (word & OPT_ADAPTIVE) != 0;
+    dcdInfo->cipher = (word & OPT_CIPHER) != 0;
+    dcdInfo->matrix_k = (word & OPT_MATRIX_MASK) >> OPT_MATRIX_SHIFT;
+    if (dcdInfo->matrix_k != 0 && (dcdInfo->matrix_k < LSB_MATRIX_MIN_K || dcdInfo->matrix_k > LSB_MATRIX_MAX_K))
+    {
+        return e_failure;
+    }
+    // The extension has to fit extn_secret_file[5]
+    if (dcdInfo->extn_size > 4)
+    {
+        return e_failure;
+    }
+    // Kernels for the pixel format and payload layout of this job
+    dcdInfo->kernels = lsb_select_pixel_kernels(dcdInfo->geometry.format, dcdInfo->channel_mask);
+    if (dcdInfo->kernels == NULL || (dcdInfo->adaptive && dcdInfo->kernels->gather == NULL))
+    {
+        return e_failure;
+    }
+    // The tile ranking needs the bits above the LSBs, which the index does not hold
+    if (dcdInfo->adaptive && dcdInfo->index.plane != NULL)
+    {
+        size_t data_pos = dcdInfo->data_pos;
+        report(dcdInfo, "🗂️  Adaptive layout, the LSB index is not used\n");
+        lsbindex_close(&dcdInfo->index);
+        free(dcdInfo->header_slots);
+        dcdInfo->header_slots = NULL;
+        if (load_stego_image_data(dcdInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        dcdInfo->data_pos = data_pos;
+    }
+    return e_success;
+}
+
+/* Read one Hamming coded header group back into 4 bytes */
+static Status decode_ecc_group(DecodeInfo *dcdInfo, char *data)
+{
+    char coded[ECC_GROUP_CODED];
+    if (dcdInfo->data_pos + ECC_GROUP_CODED * 8 > dcdInfo->header_data_size)
+    {
+        return e_failure;
+    }
+    for (int i = 0; i < ECC_GROUP_CODED; i++)
+    {
+        decode_lsb_to_byte(&coded[i], dcdInfo->header_data + dcdInfo->data_pos);
+        dcdInfo->data_pos += 8;
+    }
+    dcdInfo->ecc_corrected += ecc_decode_groups(coded, 1, data);
+    return e_success;
+}
+
+Status decode_secret_file_nonce(DecodeInfo *dcdInfo)
+{
+    unsigned char key[CHACHA_KEY_SIZE], fields[CHACHA_NONCE_SIZE + CHACHA_CHECK_SIZE], check[CHACHA_CHECK_SIZE];
+    if (!dcdInfo->cipher)
+    {
+        return e_success;
+    }
+    if (dcdInfo->key == NULL)
+    {
+        printf("🔑 The payload is encrypted, pass the passphrase with --key\n");
+        dcdInfo->key_refused = 1;
+        return e_failure;
+    }
+    for (int i = 0; i < (int)sizeof(fields); i += dcdInfo->ecc ? ECC_GROUP_DATA : 1)
+    {
+        if (dcdInfo->ecc)
+        {
+            if (decode_ecc_group(dcdInfo, (char *)fields + i) == e_failure)
+            {
+                return e_failure;
+            }
+            continue;
+        }
+        if (dcdInfo->data_pos + 8 > dcdInfo->header_data_size)
+        {
+            return e_failure;
+        }
+        decode_lsb_to_byte((char *)&fields[i], dcdInfo->header_data + dcdInfo->data_pos);
+        dcdInfo->data_pos += 8;
+    }
+    chacha_derive_key(dcdInfo->key, fields, key);
+    chacha_setup(&dcdInfo->cipher_ctx, key, fields);
+    memset(key, 0, sizeof(key));
+
+    // the tag after the nonce: a wrong passphrase stops here, before any output exists
+    chacha_key_check(&dcdInfo->cipher_ctx, check);
+    if (memcmp(check, fields + CHACHA_NONCE_SIZE, CHACHA_CHECK_SIZE) != 0)
+    {
+        printf("🔑 Wrong passphrase for this image\n");
+        dcdInfo->key_refused = 1;
+        return e_failure;
+    }
     return e_success;
 }
 
@@ -150,14 +490,25 @@ Status decode_secret_file_extn(DecodeInfo *dncInfo)
      * Reconstruct the secret file extension by decoding extn_size
      * bytes (each byte is encoded across 8 image bytes).
      */
-    char buffer[8];
     char str[100];
     int i;
+    if (dncInfo->ecc)
+    {
+        // one zero padded group
+        char group[ECC_GROUP_DATA];
+        if (decode_ecc_group(dncInfo, group) == e_failure)
+        {
+            return e_failure;
+        }
+        memcpy(dncInfo->extn_secret_file, group, dncInfo->extn_size);
+        dncInfo->extn_secret_file[dncInfo->extn_size] = '\0';
+        return e_success;
+    }
     for (i = 0; i < dncInfo->extn_size; i++)
     {
         char ch;
-        fread(buffer, 8, 1, dncInfo->fptr_stego1_image);
-        decode_lsb_to_byte(&ch, buffer);
+        decode_lsb_to_byte(&ch, dncInfo->header_data + dncInfo->data_pos);
+        dncInfo->data_pos += 8;
         str[i] = ch;
     }
     str[i] = '\0';
@@ -173,11 +524,37 @@ Status decode_secret_file_size(DecodeInfo *dcdInfo)
      * Decode the next 32 image-bytes into the secret file size
      * (stored in dcdInfo->size_secret_file).
      */
-    char buffer[32];
     int num;
-    fread(buffer, 32, 1, dcdInfo->fptr_stego1_image);
-    decode_size_to_lsb(&num, buffer);
+    if (dcdInfo->ecc)
+    {
+        char group[ECC_GROUP_DATA];
+        if (decode_ecc_group(dcdInfo, group) == e_failure)
+        {
+            return e_failure;
+        }
+        num = 0;
+        for (int i = 0; i < ECC_GROUP_DATA; i++)
+            num |= (int)((uint)(unsigned char)group[i] << (8 * i));
+    }
+    else
+    {
+        if (dcdInfo->data_pos + 32 > dcdInfo->header_data_size)
+        {
+            return e_failure;
+        }
+        decode_size_to_lsb(&num, dcdInfo->header_data + dcdInfo->data_pos);
+        dcdInfo->data_pos += 32;
+    }
     dcdInfo->size_secret_file = (long)num;
+    dcdInfo->payload_size = dcdInfo->ecc ? ecc_coded_size((size_t)num) : (size_t)num;
+    // Reject sizes the image cannot possibly hold
+    size_t capacity = dcdInfo->adaptive   ? adaptive_payload_capacity(&dcdInfo->geometry, dcdInfo->image_data_size, dcdInfo->data_pos, dcdInfo->channel_mask, dcdInfo->matrix_k)
+                      : dcdInfo->matrix_k ? matrix_payload_capacity(&dcdInfo->geometry, dcdInfo->image_data_size, dcdInfo->data_pos, dcdInfo->channel_mask, dcdInfo->matrix_k)
+                                          : payload_capacity(&dcdInfo->geometry, dcdInfo->image_data_size, dcdInfo->data_pos, dcdInfo->channel_mask);
+    if (num < 0 || dcdInfo->payload_size > capacity)
+    {
+        return e_failure;
+    }
     return e_success;
 }
 
@@ -186,9 +563,12 @@ Status open_file_decode_to_store(DecodeInfo *dcdInfo){
      * Append the decoded extension to the output base name and write
      * the decoded secret bytes to that output file.
      */
-    strcat(dcdInfo->secret_fname, dcdInfo->extn_secret_file);
+    snprintf(dcdInfo->out_fname, sizeof(dcdInfo->out_fname), "%s%s", dcdInfo->secret_fname, dcdInfo->extn_secret_file);
+    dcdInfo->secret_fname = dcdInfo->out_fname;
 
-    dcdInfo->fptr_secret = fopen(dcdInfo->secret_fname, "w");
+    // A stream handed over by the daemon is already open, ours stays unnamed until the decode went through
+    if (dcdInfo->fptr_secret == NULL)
+        dcdInfo->fptr_secret = atomic_out_open(&dcdInfo->secret_out, dcdInfo->secret_fname, "w");
 
     if (dcdInfo->fptr_secret == NULL)
     {
@@ -201,20 +581,226 @@ Status open_file_decode_to_store(DecodeInfo *dcdInfo){
     return e_success;
 }
 
+/*
+ * Hand n extracted bytes to the secret file: decrypted in place with
+ * --key, then as they are, or decoded group by group with --ecc. A group
+ * split by the chunk boundary waits in stage_carry, the padding of the
+ * last group is dropped.
+ */
+static Status write_payload_data(DecodeInfo *dcdInfo, char *buffer, size_t n)
+{
+    if (dcdInfo->cipher)
+    {
+        chacha_xor(&dcdInfo->cipher_ctx, dcdInfo->cipher_pos, buffer, n);
+        dcdInfo->cipher_pos += n;
+    }
+    if (!dcdInfo->ecc)
+    {
+        return fwrite(buffer, 1, n, dcdInfo->fptr_secret) == n ? e_success : e_failure;
+    }
+
+    char data[1024 * ECC_GROUP_DATA];
+    while (n > 0)
+    {
+        size_t groups;
+        if (dcdInfo->stage_carry_len > 0 || n < ECC_GROUP_CODED)
+        {
+            size_t take = ECC_GROUP_CODED - dcdInfo->stage_carry_len;
+            if (take > n)
+                take = n;
+            memcpy(dcdInfo->stage_carry + dcdInfo->stage_carry_len, buffer, take);
+            dcdInfo->stage_carry_len += take;
+            buffer += take;
+            n -= take;
+            if (dcdInfo->stage_carry_len < ECC_GROUP_CODED)
+                break;
+            groups = 1;
+            dcdInfo->ecc_corrected += ecc_decode_groups(dcdInfo->stage_carry, 1, data);
+            dcdInfo->stage_carry_len = 0;
+        }
+        else
+        {
+            groups = n / ECC_GROUP_CODED;
+            if (groups > 1024)
+                groups = 1024;
+            dcdInfo->ecc_corrected += ecc_decode_groups(buffer, groups, data);
+            buffer += groups * ECC_GROUP_CODED;
+            n -= groups * ECC_GROUP_CODED;
+        }
+
+        size_t have = groups * ECC_GROUP_DATA;
+        if ((long)have > dcdInfo->secret_remaining)
+            have = (size_t)dcdInfo->secret_remaining;
+        if (fwrite(data, 1, have, dcdInfo->fptr_secret) != have)
+        {
+            return e_failure;
+        }
+        dcdInfo->secret_remaining -= have;
+    }
+    return e_success;
+}
+
+/* Extract n payload bytes from carrier and return the carrier bytes used */
+static size_t extract_payload_block(DecodeInfo *dcdInfo, char *data, size_t n, const char *carrier)
+{
+    uint k = dcdInfo->matrix_k;
+    if (k == 0)
+    {
+        dcdInfo->kernels->extract_block(data, n, carrier);
+        return n * 8;
+    }
+    // the padding of the last group lands after data[n]
+    size_t padded = (n + k - 1) / k * k;
+    lsb_matrix_extract(data, padded, k, carrier);
+    return lsb_matrix_carrier_size(padded, k);
+}
+
+/*
+ * Channel selective layout: mirror of the encoder, gather the selected
+ * channels of ROWS_PER_CHUNK rows at a time and extract from the slots.
+ */
+static Status decode_secret_file_data_channels(DecodeInfo *dcdInfo)
+{
+    const ImageGeometry *geometry = &dcdInfo->geometry;
+    const LsbKernels *kernels = dcdInfo->kernels;
+    size_t row_slots = (size_t)geometry->width * channel_count(dcdInfo->channel_mask);
+    size_t chunk_slots = row_slots * ROWS_PER_CHUNK;
+
+    char *slots = malloc(chunk_slots + chunk_slots / 8);
+    if (slots == NULL)
+    {
+        return e_failure;
+    }
+    char *secret_data = slots + chunk_slots;
+
+    size_t remaining = dcdInfo->payload_size;
+    for (uint row = payload_start_row(geometry, dcdInfo->data_pos); remaining > 0 && row < geometry->height; row += ROWS_PER_CHUNK)
+    {
+        uint rows = geometry->height - row < ROWS_PER_CHUNK ? geometry->height - row : ROWS_PER_CHUNK;
+        uint k = dcdInfo->matrix_k;
+        size_t chunk = k ? rows * row_slots / lsb_matrix_carrier_size(k, k) * k : rows * row_slots / 8;
+        if (chunk > remaining)
+            chunk = remaining;
+        size_t used = k ? lsb_matrix_carrier_size(chunk, k) : chunk * 8;
+        uint rows_used = (uint)((used + row_slots - 1) / row_slots);
+
+        const char *pixels = decode_carrier_bytes(dcdInfo, (size_t)row * geometry->row_stride, (size_t)rows_used * geometry->row_stride);
+        if (pixels == NULL)
+        {
+            break;
+        }
+        for (uint r = 0; r < rows_used; r++)
+            kernels->gather(pixels + (size_t)r * geometry->row_stride, geometry->width, slots + r * row_slots);
+        extract_payload_block(dcdInfo, secret_data, chunk, slots);
+        if (write_payload_data(dcdInfo, secret_data, chunk) == e_failure)
+        {
+            break;
+        }
+        remaining -= chunk;
+    }
+    free(slots);
+    return remaining == 0 ? e_success : e_failure;
+}
+
+/*
+ * Content adaptive layout: rebuild the tile ranking from the stego
+ * pixels (the cost ignores the bits embedding changed) and extract
+ * ADAPTIVE_BATCH tiles at a time in the encoder's order.
+ */
+static Status decode_secret_file_data_adaptive(DecodeInfo *dcdInfo)
+{
+    const ImageGeometry *geometry = &dcdInfo->geometry;
+    const LsbKernels *kernels = dcdInfo->kernels;
+    size_t tile_slots = (size_t)ADAPTIVE_TILE_W * ROWS_PER_CHUNK * channel_count(dcdInfo->channel_mask);
+    size_t batch_slots = tile_slots * ADAPTIVE_BATCH;
+    uint k = dcdInfo->matrix_k;
+    AdaptiveMap map;
+
+    char *slots = malloc(batch_slots + batch_slots / 8);
+    if (slots == NULL || adaptive_build_map(geometry, dcdInfo->image_data, dcdInfo->image_data_size, dcdInfo->data_pos, &map) == e_failure)
+    {
+        free(slots);
+        return e_failure;
+    }
+    char *secret_data = slots + batch_slots;
+
+    size_t remaining = dcdInfo->payload_size;
+    for (size_t first = 0; remaining > 0 && first < map.tiles; first += ADAPTIVE_BATCH)
+    {
+        size_t tiles = map.tiles - first < ADAPTIVE_BATCH ? map.tiles - first : ADAPTIVE_BATCH;
+        size_t chunk = k ? tiles * tile_slots / lsb_matrix_carrier_size(k, k) * k : tiles * tile_slots / 8;
+        if (chunk > remaining)
+            chunk = remaining;
+        size_t used = k ? lsb_matrix_carrier_size(chunk, k) : chunk * 8;
+        size_t tiles_used = (used + tile_slots - 1) / tile_slots;
+
+        adaptive_gather(&map, geometry, kernels, dcdInfo->image_data, first, tiles_used, slots);
+        extract_payload_block(dcdInfo, secret_data, chunk, slots);
+        if (write_payload_data(dcdInfo, secret_data, chunk) == e_failure)
+        {
+            break;
+        }
+        remaining -= chunk;
+    }
+    adaptive_free_map(&map);
+    free(slots);
+    return remaining == 0 ? e_success : e_failure;
+}
+
 // /* Encode secret file data*/
 Status decode_secret_file_data(DecodeInfo *dcdInfo)
 {
-    open_file_decode_to_store(dcdInfo);
+    if (open_file_decode_to_store(dcdInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    dcdInfo->secret_remaining = dcdInfo->size_secret_file;
+    dcdInfo->stage_carry_len = 0;
+    dcdInfo->cipher_pos = 0;
+    if (dcdInfo->adaptive)
+    {
+        return decode_secret_file_data_adaptive(dcdInfo);
+    }
+    if (dcdInfo->kernels->gather != NULL)
+    {
+        return decode_secret_file_data_channels(dcdInfo);
+    }
 
-    char buffer[8];
-    for (int i = 0; i < dcdInfo->size_secret_file; i++)
+    // Rebuild the secret in chunks and write each chunk at once
+    char secret_data[4096];
+    size_t max_chunk = dcdInfo->matrix_k ? sizeof(secret_data) / dcdInfo->matrix_k * dcdInfo->matrix_k : sizeof(secret_data);
+    size_t remaining = dcdInfo->payload_size;
+    while (remaining > 0)
     {
-        char ch;
-        fread(buffer, 8, 1, dcdInfo->fptr_stego1_image);
-        decode_lsb_to_byte(&ch, buffer);
-        fwrite(&ch, 1, 1, dcdInfo->fptr_secret);
+        size_t chunk = remaining < max_chunk ? remaining : max_chunk;
+        uint k = dcdInfo->matrix_k;
+        size_t used = k ? lsb_matrix_carrier_size((chunk + k - 1) / k * k, k) : chunk * 8;
+        if (dcdInfo->index.plane != NULL && k == 0)
+        {
+            // one bit per byte from a multiple of 8 on: the plane holds the bytes as they are
+            if (lsbindex_check(&dcdInfo->index, dcdInfo->data_pos / 8, dcdInfo->data_pos / 8 + chunk) == e_failure)
+            {
+                return e_failure;
+            }
+            memcpy(secret_data, dcdInfo->index.plane + dcdInfo->data_pos / 8, chunk);
+            dcdInfo->data_pos += used;
+        }
+        else
+        {
+            const char *carrier = decode_carrier_bytes(dcdInfo, dcdInfo->data_pos, used);
+            if (carrier == NULL)
+            {
+                return e_failure;
+            }
+            dcdInfo->data_pos += extract_payload_block(dcdInfo, secret_data, chunk, carrier);
+        }
+        if (write_payload_data(dcdInfo, secret_data, chunk) == e_failure)
+        {
+            return e_failure;
+        }
+        remaining -= chunk;
     }
-    /* Note: file is not explicitly closed here to preserve original logic */
+    /* Note: file is closed by do_decoding / close_file_decode */
 
     return e_success;
 }
@@ -222,14 +808,8 @@ Status decode_secret_file_data(DecodeInfo *dcdInfo)
 /* Encode a byte into LSB of image data array */
 Status decode_lsb_to_byte(char *data, char *image_buffer)
 {
-    // char decode
-    /* initialize accumulator to zero before assembling bits */
-    unsigned char acc = 0;
-    for (int i = 0; i < 8; i++)
-    {
-        acc |= (unsigned char)(image_buffer[i] & 1) << i;
-    }
-    *data = (char)acc;
+    // char decode (header fields always use the plain byte layout)
+    *data = lsb_kernel_table[e_layout_bytes].extract_byte(image_buffer);
     return e_success;
 }
 
@@ -237,12 +817,7 @@ Status decode_lsb_to_byte(char *data, char *image_buffer)
 Status decode_size_to_lsb(int *size, char *imageBuffer)
 {
     // integer decode
-    uint size1 = 0;
-    for (int i = 0; i < 32; i++)
-    {
-        size1 |= (uint)(imageBuffer[i] & 1) << i;
-    }
-    *size = (int)size1;
+    *size = lsb_kernel_table[e_layout_bytes].extract_size(imageBuffer);
     return e_success;
 }
 
@@ -252,7 +827,13 @@ Status do_decoding(DecodeInfo *dcdInfo)
     /* Run decode steps in sequence and print a user-friendly result */
     /* Print the same project banner used for encoding so both flows match */
     
-    if (decode_secret_file_extn_size(dcdInfo) == e_success)
+    Status header = decode_secret_file_extn_size(dcdInfo);
+    if (header == e_success && dcdInfo->archive)
+    {
+        printf("\n📚 This image holds an archive, use -l to list it or -x to extract an entry.\n");
+        return e_failure;
+    }
+    if (header == e_success)
     {
         /* Friendly decode header and progress messages */
         
@@ -261,31 +842,34 @@ Status do_decoding(DecodeInfo *dcdInfo)
         // printf("💾 Output Text File  : %s%s\n", dcdInfo->secret_fname, dcdInfo->extn_secret_file);
         // printf("---------------------------------------------\n");
 
-        printf("🔍 Validating and reading image data...\n");
-        printf("✅ Image file verified successfully!\n");
-        printf("\n🧩 Extracting hidden bits from image...\n");
+        report(dcdInfo, "🔍 Validating and reading image data...\n");
+        report(dcdInfo, "✅ Image file verified successfully!\n");
+        report(dcdInfo, "\n🧩 Extracting hidden bits from image...\n");
 
-        if (decode_secret_file_extn(dcdInfo) == e_success)
+        if (decode_secret_file_nonce(dcdInfo) == e_success && decode_secret_file_extn(dcdInfo) == e_success)
         {
             /* Secret file extension reconstructed */
-            printf("📜 Reconstructing the hidden message (ext: %s)...\n", dcdInfo->extn_secret_file);
+            report(dcdInfo, "📜 Reconstructing the hidden message (ext: %s)...\n", dcdInfo->extn_secret_file);
             if (decode_secret_file_size(dcdInfo) == e_success)
             {
                 /* Secret file size decoded */
-                printf("⏳ Decoding in progress, please wait... (%ld bytes)\n", dcdInfo->size_secret_file);
+                report(dcdInfo, "⏳ Decoding in progress, please wait... (%ld bytes)\n", dcdInfo->size_secret_file);
 
-                if (decode_secret_file_data(dcdInfo) == e_success)
+                if (decode_secret_file_data(dcdInfo) == e_success && atomic_out_publish(&dcdInfo->secret_out, dcdInfo->fptr_secret, 1) == e_success)
                 {
                     /* Successful decode summary */
-                    printf("\n🎉 Hidden message extracted successfully!\n");
-                    printf("💾 Decoded text saved as: %s\n", dcdInfo->secret_fname);
-                    printf("-------------------------------------------------\n");
-                    printf("✨ Decoding Completed Successfully! ✨\n");
-                    printf("✅ Secret data retrieved without loss.\n");
-                    printf("-------------------------------------------------\n\n");
-
-                    fclose(dcdInfo->fptr_secret);
-                    fclose(dcdInfo->fptr_stego1_image);
+                    report(dcdInfo, "\n🎉 Hidden message extracted successfully!\n");
+                    if (dcdInfo->ecc_corrected > 0)
+                    {
+                        report(dcdInfo, "🩹 ECC corrected %u bit errors\n", dcdInfo->ecc_corrected);
+                    }
+                    report(dcdInfo, "💾 Decoded text saved as: %s\n", dcdInfo->secret_fname);
+                    report(dcdInfo, "-------------------------------------------------\n");
+                    report(dcdInfo, "✨ Decoding Completed Successfully! ✨\n");
+                    report(dcdInfo, "✅ Secret data retrieved without loss.\n");
+                    report(dcdInfo, "-------------------------------------------------\n\n");
+
+                    close_file_decode(dcdInfo);
 
                     return e_success;
                 }
@@ -4,6 +4,11 @@
 #include <stdio.h>
 
 #include "types.h" // Contains user defined types
+#include "lsb.h"   // Embed / extract kernels
+#include "image.h" // Pixel geometry
+#include "lsbindex.h" // LSB plane sidecar
+#include "chacha.h" // Payload cipher
+#include "atomic_out.h" // Outputs published only on success
 
 typedef struct decodeInfo{
 
@@ -13,10 +18,47 @@ typedef struct decodeInfo{
     /* Secret File Info */
     char *secret_fname;       // To store the secret file name
     FILE *fptr_secret;        // To store the secret file address
+    AtomicOut secret_out;     // To store the unnamed output until it is published
     char extn_secret_file[5]; // To store the Secret file extension
     //char secret_data[100];    // To store the secret data
     long size_secret_file;    // To store the size of the secret data
     int extn_size;
+    char out_fname[256];      // To store the base name + decoded extension
+    int quiet;                // To store 1 for daemon jobs: no banners, the caller prints one line
+
+    /* Stego pixel data (mapped when possible) */
+    char *image_data;         // To store the pixel bytes after the bmp header
+    size_t image_data_size;   // To store the number of pixel bytes
+    size_t data_pos;          // To store the next pixel byte to decode from
+    char *header_data;        // To store where the header fields are (image_data, or header_slots)
+    size_t header_data_size;  // To store the number of bytes at header_data
+    char *header_slots;       // To store the gathered header rows of a packed format
+    LsbIndex index;           // To store the LSB plane sidecar (plane NULL = read the pixels)
+    char *view;               // To store pixel bytes unpacked from the index
+    size_t view_alloc;        // To store the allocated size of view
+    void *map_base;           // To store the mmap'ed file (NULL when read)
+    size_t map_size;          // To store the length of the mapping
+    const LsbKernels *kernels; // To store the kernels picked for the payload layout
+    ImageGeometry geometry;   // To store the pixel geometry of the stego image
+    uint channel_mask;        // To store the channel mask read from the header
+
+    /* Payload stages between the kernels and the secret file */
+    int ecc;                  // To store whether the header has the --ecc bit
+    size_t payload_size;      // To store the bytes embedded for the secret (after ECC)
+    long secret_remaining;    // To store the secret bytes not written yet
+    char stage_carry[8];      // To store coded bytes of a group split across chunks
+    size_t stage_carry_len;   // To store the number of bytes in stage_carry
+    uint ecc_corrected;       // To store the number of bit errors ECC corrected
+    uint matrix_k;            // To store the --matrix code parameter k (0 = off)
+    int archive;              // To store whether the image holds a -A archive
+    int adaptive;             // To store whether the payload is in --adaptive tile order
+
+    /* Payload encryption (--key) */
+    char *key;                // To store the --key passphrase (NULL = none given)
+    int cipher;               // To store whether the header has the --key bit
+    ChachaCtx cipher_ctx;     // To store the cipher state for the key and the image's nonce
+    int key_refused;          // To store 1 when the passphrase was missing or wrong
+    unsigned long long cipher_pos; // To store the payload bytes decrypted so far
 
 }DecodeInfo;
 
@@ -32,12 +74,18 @@ Status do_decoding(DecodeInfo *dcdInfo);
 /* Get File pointers for i/p and o/p files */
 Status open_file_decode(DecodeInfo *dcdInfo);
 
+/* Unmap / free the pixel data and close whatever files are still open */
+void close_file_decode(DecodeInfo *dcdInfo);
+
 
 Status open_file_decode_to_store(DecodeInfo *dcdInfo);
 
 
-/* Copy bmp image header */
-Status skip_bmp_header(FILE *fptr_stego_image);
+/* Map the pixel data after the bmp header (or the LSB index of the image) */
+Status load_stego_image_data(DecodeInfo *dcdInfo);
+
+/* Pixel bytes [offset, offset + n): mapped, or unpacked from the LSB index (NULL on failure) */
+const char *decode_carrier_bytes(DecodeInfo *dcdInfo, size_t offset, size_t n);
 
 /* Store Magic String */
 Status decode_magic_string(DecodeInfo *dcdInfo);
@@ -48,6 +96,9 @@ Status decode_magic_string(DecodeInfo *dcdInfo);
 // /* Encode secret file extenstion */
 Status decode_secret_file_extn(DecodeInfo *dncInfo);
 
+/* Read the nonce of an encrypted payload, set up the cipher and check the key (nothing without the --key bit) */
+Status decode_secret_file_nonce(DecodeInfo *dcdInfo);
+
 // /* Encode secret file size */
 Status decode_secret_file_size(DecodeInfo *dcdInfo);
 
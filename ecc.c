@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include "ecc.h"
+#include "types.h"
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Codeword bit k holds Hamming position k + 1: parity at positions 1, 2
+ * and 4, data at 3, 5, 6 and 7. The syndrome of a received word is the
+ * XOR of the positions of its set bits, which is the position of a
+ * single flipped bit (0 when the word is clean).
+ *
+ * Both directions are table driven on whole bytes:
+ *   ecc_encode_table[byte]  -> 14 bit code (low nibble in bits 0..6)
+ *   ecc_decode_table[code]  -> byte | corrected bits << 8
+ */
+static uint16_t ecc_encode_table[256];
+static uint16_t ecc_decode_table[1 << 14];
+
+static uint ecc_syndrome(uint word)
+{
+    uint syndrome = 0;
+    for (uint pos = 1; pos <= 7; pos++)
+    {
+        if (word & (1u << (pos - 1)))
+            syndrome ^= pos;
+    }
+    return syndrome;
+}
+
+static uint ecc_encode_nibble(uint nibble)
+{
+    // data bits to positions 3, 5, 6, 7
+    uint word = ((nibble & 1) << 2) | ((nibble >> 1 & 1) << 4) | ((nibble >> 2 & 1) << 5) | ((nibble >> 3 & 1) << 6);
+    // parity bits 1, 2, 4 are the syndrome bits that zero the syndrome
+    uint syndrome = ecc_syndrome(word);
+    return word | (syndrome & 1) | ((syndrome >> 1 & 1) << 1) | ((syndrome >> 2 & 1) << 3);
+}
+
+/* Corrected nibble of a received codeword, sets *corrected on a flip */
+static uint ecc_decode_word(uint word, uint *corrected)
+{
+    uint syndrome = ecc_syndrome(word);
+    if (syndrome != 0)
+    {
+        word ^= 1u << (syndrome - 1);
+        (*corrected)++;
+    }
+    return (word >> 2 & 1) | ((word >> 4 & 1) << 1) | ((word >> 5 & 1) << 2) | ((word >> 6 & 1) << 3);
+}
+
+void ecc_init_tables(void)
+{
+    for (uint byte = 0; byte < 256; byte++)
+    {
+        ecc_encode_table[byte] = (uint16_t)(ecc_encode_nibble(byte & 0xF) | ecc_encode_nibble(byte >> 4) << 7);
+    }
+    for (uint code = 0; code < (1u << 14); code++)
+    {
+        uint corrected = 0;
+        uint byte = ecc_decode_word(code & 0x7F, &corrected) | ecc_decode_word(code >> 7, &corrected) << 4;
+        ecc_decode_table[code] = (uint16_t)(byte | corrected << 8);
+    }
+}
+
+size_t ecc_coded_size(size_t n)
+{
+    return (n + ECC_GROUP_DATA - 1) / ECC_GROUP_DATA * ECC_GROUP_CODED;
+}
+
+void ecc_encode_groups(const char *data, size_t groups, char *coded)
+{
+    const unsigned char *in = (const unsigned char *)data;
+
+    for (size_t g = 0; g < groups; g++, in += ECC_GROUP_DATA, coded += ECC_GROUP_CODED)
+    {
+        uint64_t word = (uint64_t)ecc_encode_table[in[0]] | (uint64_t)ecc_encode_table[in[1]] << 14 |
+                        (uint64_t)ecc_encode_table[in[2]] << 28 | (uint64_t)ecc_encode_table[in[3]] << 42;
+        for (int i = 0; i < ECC_GROUP_CODED; i++)
+            coded[i] = (char)(word >> (8 * i));
+    }
+}
+
+uint ecc_decode_groups(const char *coded, size_t groups, char *data)
+{
+    const unsigned char *in = (const unsigned char *)coded;
+    uint corrected = 0;
+
+    for (size_t g = 0; g < groups; g++, in += ECC_GROUP_CODED, data += ECC_GROUP_DATA)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < ECC_GROUP_CODED; i++)
+            word |= (uint64_t)in[i] << (8 * i);
+        for (int i = 0; i < ECC_GROUP_DATA; i++)
+        {
+            uint entry = ecc_decode_table[(word >> (14 * i)) & 0x3FFF];
+            data[i] = (char)(entry & 0xFF);
+            corrected += entry >> 8;
+        }
+    }
+    return corrected;
+}
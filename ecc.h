@@ -0,0 +1,30 @@
+#ifndef ECC_H
+#define ECC_H
+
+#include <stddef.h>
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Hamming(7,4) error correcting code for --ecc.
+ * Every nibble becomes a 7 bit codeword that survives one flipped bit.
+ * Codewords are packed back to back, so a group of 4 data bytes
+ * (8 codewords, 56 bits) becomes exactly 7 coded bytes.
+ */
+
+#define ECC_GROUP_DATA 4  // Data bytes per group
+#define ECC_GROUP_CODED 7 // Coded bytes per group
+
+/* Build the encode / decode tables, call once at startup */
+void ecc_init_tables(void);
+
+/* Coded size of n data bytes (the last group is zero padded) */
+size_t ecc_coded_size(size_t n);
+
+/* Encode groups * 4 data bytes into groups * 7 coded bytes */
+void ecc_encode_groups(const char *data, size_t groups, char *coded);
+
+/* Decode groups * 7 coded bytes, returns the number of corrected bits */
+uint ecc_decode_groups(const char *coded, size_t groups, char *data);
+
+#endif
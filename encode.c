@@ -2,43 +2,30 @@
 #include "encode.h"
 #include "types.h"
 #include "common.h"
+#include "ecc.h"
+#include "outcache.h"
+#include "adaptive.h"
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <stdarg.h>
 
-/* Function Definitions */
+/* Bytes read / written between two progress updates and cancel checks */
+#define IO_CHUNK (1 << 20)
 
-/* Get image size
- * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
- */
-uint get_image_size_for_bmp(FILE *fptr_image)
+/* Progress messages of a job, left out for quiet jobs (daemon / watch) that print one line of their own */
+static void report(const EncodeInfo *encInfo, const char *format, ...)
 {
-    /*
-     * get_image_size_for_bmp
-     * ----------------------
-     * Read BMP width and height from the header (offset 18) and
-     * return the image capacity in bytes (width * height * 3).
-     */
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
-
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    /* Informative message about image width */
-    //printf("Image width: %u pixels\n", width);
-
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    /* Informative message about image height */
-    //printf("Image height: %u pixels\n", height);
-
-    // Return image capacity
-    return width * height * 3;
+    va_list args;
+    if (encInfo->quiet)
+        return;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
 }
 
+/* Function Definitions */
+
 uint get_file_size(FILE *fptr)
 {
     // Find the size of secret file data
@@ -75,18 +62,124 @@ int checkExtension(char *str, char *extension)
     return 1;
 }
 
+Status read_encode_options(char *argv[], EncodeInfo *encInfo)
+{
+    /*
+     * Options may appear anywhere after -e. Each one is removed from argv
+     * so argv[2], argv[3] and argv[4] stay the positional arguments.
+     */
+    int out = 2;
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (!strcmp(argv[i], "--channels"))
+        {
+            if (argv[i + 1] == NULL || parse_channel_mask(argv[i + 1], &encInfo->channel_mask) == e_failure)
+            {
+                printf("Error: --channels expects a subset of B, G and R, plus A on 32 bit images (e.g. B or BGA)\n");
+                return e_failure;
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "--matrix"))
+        {
+            if (argv[i + 1] == NULL || (encInfo->matrix_k = atoi(argv[i + 1])) < LSB_MATRIX_MIN_K || encInfo->matrix_k > LSB_MATRIX_MAX_K)
+            {
+                printf("Error: --matrix expects k between %d and %d\n", LSB_MATRIX_MIN_K, LSB_MATRIX_MAX_K);
+                return e_failure;
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "--ecc"))
+        {
+            encInfo->ecc = 1;
+        }
+        else if (!strcmp(argv[i], "--adaptive"))
+        {
+            encInfo->adaptive = 1;
+        }
+        else if (!strcmp(argv[i], "--verify"))
+        {
+            encInfo->verify = 1;
+        }
+        else if (!strcmp(argv[i], "--key") || !strcmp(argv[i], "--key-fd") || !strcmp(argv[i], "--key-env"))
+        {
+            if (chacha_read_passphrase(argv[i], argv[i + 1], &encInfo->key) == e_failure)
+            {
+                return e_failure;
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "--cache-dir"))
+        {
+            if (argv[i + 1] == NULL)
+            {
+                printf("Error: --cache-dir expects a directory\n");
+                return e_failure;
+            }
+            encInfo->cache_dir = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--cache-mb"))
+        {
+            if (argv[i + 1] == NULL || atoll(argv[i + 1]) <= 0)
+            {
+                printf("Error: --cache-mb expects a size in MB\n");
+                return e_failure;
+            }
+            encInfo->cache_budget = (unsigned long long)atoll(argv[++i]) << 20;
+        }
+        else if (!strcmp(argv[i], "--progress-fd"))
+        {
+            if (argv[i + 1] == NULL || (encInfo->progress.fd = atoi(argv[i + 1])) <= 0)
+            {
+                printf("Error: --progress-fd expects an open file descriptor number\n");
+                return e_failure;
+            }
+            i++;
+        }
+        else
+        {
+            argv[out++] = argv[i];
+        }
+    }
+    argv[out] = NULL;
+    return e_success;
+}
+
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
+    if (read_encode_options(argv, encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    if (argv[2] == NULL || argv[3] == NULL)
+    {
+        printf("Error: missing <source.bmp> or <secret> argument\n");
+        return e_failure;
+    }
+
     // check whether the file name is present or not(before .)
-    //  Check Source file is having (.bmp) or not
+    //  Check Source file is having (.bmp, .ppm or .pgm) or not
     // encInfo -> src_image_fname = argv[2]
+    char *image_extn = NULL;
     if (checkExtension(argv[2], ".bmp"))
+    {
+        image_extn = ".bmp";
+    }
+    else if (checkExtension(argv[2], ".ppm"))
+    {
+        image_extn = ".ppm";
+    }
+    else if (checkExtension(argv[2], ".pgm"))
+    {
+        image_extn = ".pgm";
+    }
+    if (image_extn != NULL)
     {
         encInfo->src_image_fname = argv[2];
     }
     else
     {
-        printf("Error: '%s' must have a .bmp extension\n", argv[2]);
+        printf("Error: '%s' must have a .bmp, .ppm or .pgm extension\n", argv[2]);
         return e_failure;
     }
 
@@ -107,21 +200,21 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     // encInfor -> stego_image_fname = "default.bmp"
     // or
     // check whether the file name is present or not(before .)
-    //  Check Source file is having (.bmp) or not
+    //  Check Stego file has the extension of the source (the header is copied as is)
     // encInfor -> stego_image_fname = argv[4]
     if (argv[4] == NULL)
     {
-        encInfo->stego_image_fname = "output.bmp";
+        encInfo->stego_image_fname = !strcmp(image_extn, ".ppm") ? "output.ppm" : !strcmp(image_extn, ".pgm") ? "output.pgm" : "output.bmp";
     }
     else
     {
-        if (checkExtension(argv[4], ".bmp"))
+        if (checkExtension(argv[4], image_extn))
         {
             encInfo->stego_image_fname = argv[4];
         }
         else
         {
-            printf("Error: '%s' must have a .bmp extension\n", argv[4]);
+            printf("Error: '%s' must have a %s extension\n", argv[4], image_extn);
             return e_failure;
         }
     }
@@ -131,8 +224,11 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 
 Status open_files(EncodeInfo *encInfo)
 {
+    /* Streams handed over by the daemon (fdopen'ed fds) are already open */
+
     // Src Image file
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb");
+    if (encInfo->fptr_src_image == NULL)
+        encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb");
     // Do Error handling
     if (encInfo->fptr_src_image == NULL)
     {
@@ -143,7 +239,8 @@ Status open_files(EncodeInfo *encInfo)
     }
 
     // Secret file
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "rb");
+    if (encInfo->fptr_secret == NULL)
+        encInfo->fptr_secret = fopen(encInfo->secret_fname, "rb");
     // Do Error handling
     if (encInfo->fptr_secret == NULL)
     {
@@ -153,8 +250,9 @@ Status open_files(EncodeInfo *encInfo)
         return e_failure;
     }
 
-    // Stego Image file
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "wb");
+    // Stego Image file, unnamed until the encoding went through
+    if (encInfo->fptr_stego_image == NULL)
+        encInfo->fptr_stego_image = atomic_out_open(&encInfo->stego_out, encInfo->stego_image_fname, "wb");
     // Do Error handling
     if (encInfo->fptr_stego_image == NULL)
     {
@@ -168,14 +266,57 @@ Status open_files(EncodeInfo *encInfo)
     return e_success;
 }
 
-int extn_size;
+void close_files(EncodeInfo *encInfo)
+{
+    // Close and forget every stream that is still open
+    if (encInfo->fptr_src_image != NULL)
+        fclose(encInfo->fptr_src_image);
+    if (encInfo->fptr_secret != NULL)
+        fclose(encInfo->fptr_secret);
+    if (encInfo->fptr_stego_image != NULL)
+        fclose(encInfo->fptr_stego_image);
+    atomic_out_close(&encInfo->stego_out);
+
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+}
+
+/* Carrier bytes of the header fields, with --ecc the extension, the size and the key check are one coded group (56 bytes) each, the nonce three */
+static size_t payload_header_bytes(const EncodeInfo *encInfo)
+{
+    size_t nonce_bytes = encInfo->key == NULL ? 0 : encInfo->ecc ? (CHACHA_NONCE_SIZE + CHACHA_CHECK_SIZE) / ECC_GROUP_DATA * ECC_GROUP_CODED * 8 : (CHACHA_NONCE_SIZE + CHACHA_CHECK_SIZE) * 8;
+    return (strlen(MAGIC_STRING) * 8) + (encInfo->ecc ? OPT_WORD_COPIES : 1) * 32 + nonce_bytes + (encInfo->ecc ? 2 * ECC_GROUP_CODED * 8 : (encInfo->extn_size * 8) + 32);
+}
 
 Status check_capacity(EncodeInfo *encInfo)
 {
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
+    // A cached carrier is already parsed
+    if (encInfo->carrier != NULL)
+    {
+        encInfo->geometry = encInfo->carrier->geometry;
+    }
+    else if (read_image_geometry(encInfo->fptr_src_image, &encInfo->geometry) == e_failure)
+    {
+        printf("Error: '%s' is not a 16 bit (5-6-5 / 5-5-5), 24 bit or 32 bit (BGRA) uncompressed bmp, nor a binary ppm / pgm (P6 / P5) with an odd maxval\n", encInfo->src_image_fname);
+        return e_failure;
+    }
     encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
 
-    char *extn;
+    // Packed pixels have no every byte layout, they default to every color channel (so do the tiles of --adaptive)
+    if ((!pixel_format_bytewise(encInfo->geometry.format) || encInfo->adaptive) && encInfo->channel_mask == 0)
+    {
+        encInfo->channel_mask = default_channel_mask(encInfo->geometry.format);
+    }
+    // Kernels for the pixel format and payload layout of this job
+    encInfo->kernels = lsb_select_pixel_kernels(encInfo->geometry.format, encInfo->channel_mask);
+    if (encInfo->kernels == NULL)
+    {
+        printf("Error: the channels do not fit the image (A needs a 32 bit bmp, a pgm only has G)\n");
+        return e_failure;
+    }
+
+    char *extn = NULL;
     if (strstr(encInfo->secret_fname, ".txt") != NULL)
     {
         extn = ".txt";
@@ -192,19 +333,30 @@ Status check_capacity(EncodeInfo *encInfo)
     {
         extn = ".h";
     }
+    if (extn == NULL)
+    {
+        return e_failure;
+    }
     strcpy(encInfo->extn_secret_file, extn);
     // printf("%s\n",encInfo->extn_secret_file);
-    extn_size = (int)strlen(extn);
+    encInfo->extn_size = (int)strlen(extn);
     // printf("%d\n",extn_size);
-    //  54 header data of image file
-    //  length of magic string
-    // extension size (.txt) size is 4 store in integer so it takes 32 bytes
-    // extension size no of character to store (.txt) = 4*8 or (.c) = 2*8 like that
-    // stores the size of file int integer 36 so 32 bytes will needed
-    // to store data from secret file so 36 characters * 8 that also added.
-    int total_bytes = 54 + (strlen(MAGIC_STRING) * 8) + 32 + (extn_size * 8) + 32 + (encInfo->size_secret_file * 8);
+    // carrier bytes taken by the magic string, the option word, the extension and the
+    // secret size (one bit each), and the secret grows to 7 bytes per 4 with --ecc
+    size_t header_bytes = payload_header_bytes(encInfo);
+    encInfo->payload_size = encInfo->ecc ? ecc_coded_size(encInfo->size_secret_file) : (size_t)encInfo->size_secret_file;
+    // only the pixel bits the format can carry count: one per byte of a plain layout,
+    // one per color field of a 16 bit pixel, only the selected channels with --channels,
+    // with --matrix k every 2^k - 1 of them carry k bits, with --adaptive only whole tiles count
+    size_t data_size = encInfo->carrier != NULL ? encInfo->carrier->pixels_size : get_file_size(encInfo->fptr_src_image) - encInfo->geometry.data_offset;
+    // bytes after the pixel rows (a trailing profile or metadata) are not carrier bytes
+    if (data_size > (size_t)encInfo->geometry.row_stride * encInfo->geometry.height)
+        data_size = (size_t)encInfo->geometry.row_stride * encInfo->geometry.height;
+    size_t capacity = encInfo->adaptive   ? adaptive_payload_capacity(&encInfo->geometry, data_size, header_bytes, encInfo->channel_mask, encInfo->matrix_k)
+                      : encInfo->matrix_k ? matrix_payload_capacity(&encInfo->geometry, data_size, header_bytes, encInfo->channel_mask, encInfo->matrix_k)
+                                          : payload_capacity(&encInfo->geometry, data_size, header_bytes, encInfo->channel_mask);
 
-    if (encInfo->image_capacity > total_bytes)
+    if (capacity >= encInfo->payload_size)
     {
         return e_success;
     }
@@ -214,105 +366,724 @@ Status check_capacity(EncodeInfo *encInfo)
 
 Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
 {
-    char buffer[54];
+    // Everything up to the pixels (bfOffBits, or the end of a pnm header): info header, masks, comments
+    char buffer[BMP_HEADER_MAX];
+    ImageGeometry geometry;
 
+    if (read_image_geometry(fptr_src_image, &geometry) == e_failure)
+        return e_failure;
+    uint size = geometry.data_offset;
     rewind(fptr_src_image);
-    fread(buffer, 54, 1, fptr_src_image);
-    fwrite(buffer, 54, 1, fptr_dest_image);
+    fread(buffer, size, 1, fptr_src_image);
+    fwrite(buffer, size, 1, fptr_dest_image);
 
     if (ftell(fptr_src_image) == ftell(fptr_dest_image))
         return e_success;
     else
         return e_failure;
 }
+Status load_image_data(EncodeInfo *encInfo)
+{
+    /*
+     * Read every pixel byte after the header (54 bytes for a plain 24 bit
+     * bmp, see geometry.data_offset) into the image buffer. The buffer is
+     * only grown, never shrunk, so a daemon worker that encodes many
+     * images keeps it warm between requests.
+     */
+    long file_size = get_file_size(encInfo->fptr_src_image);
+    long offset = encInfo->geometry.data_offset;
+    if (file_size < offset)
+    {
+        return e_failure;
+    }
+    size_t size = (size_t)(file_size - offset);
+
+    if (size > encInfo->image_data_alloc)
+    {
+        char *data = realloc(encInfo->image_data, size);
+        if (data == NULL)
+        {
+            perror("realloc");
+            return e_failure;
+        }
+        encInfo->image_data = data;
+        encInfo->image_data_alloc = size;
+    }
+
+    fseek(encInfo->fptr_src_image, offset, SEEK_SET);
+    for (size_t done = 0; done < size; done += IO_CHUNK)
+    {
+        size_t chunk = size - done < IO_CHUNK ? size - done : IO_CHUNK;
+        if (progress_cancelled() || fread(encInfo->image_data + done, 1, chunk, encInfo->fptr_src_image) != chunk)
+        {
+            return e_failure;
+        }
+        progress_add(&encInfo->progress, chunk);
+    }
+    encInfo->image_data_size = size;
+    encInfo->image_data_private = size;
+    encInfo->data_pos = 0;
+    return e_success;
+}
+
+/*
+ * Set up the job from a cached carrier instead of the file: write the
+ * cached header and size the image buffer, but copy nothing yet. Pixels
+ * are copied on demand by touch_image_data, everything after the last
+ * touched byte is written straight from the cache.
+ */
+static Status load_cached_carrier(EncodeInfo *encInfo)
+{
+    const Carrier *carrier = encInfo->carrier;
+    if (fwrite(carrier->header, 1, carrier->geometry.data_offset, encInfo->fptr_stego_image) != carrier->geometry.data_offset)
+    {
+        return e_failure;
+    }
+    if (carrier->pixels_size > encInfo->image_data_alloc)
+    {
+        char *data = realloc(encInfo->image_data, carrier->pixels_size);
+        if (data == NULL)
+        {
+            perror("realloc");
+            return e_failure;
+        }
+        encInfo->image_data = data;
+        encInfo->image_data_alloc = carrier->pixels_size;
+    }
+    encInfo->image_data_size = carrier->pixels_size;
+    encInfo->image_data_private = 0;
+    encInfo->data_pos = 0;
+    progress_add(&encInfo->progress, carrier->pixels_size);
+    return e_success;
+}
+
+/* Make image_data[0, end) private before embedding into it */
+static void touch_image_data(EncodeInfo *encInfo, size_t end)
+{
+    if (end > encInfo->image_data_size)
+        end = encInfo->image_data_size;
+    if (end > encInfo->image_data_private)
+    {
+        memcpy(encInfo->image_data + encInfo->image_data_private, encInfo->carrier->pixels + encInfo->image_data_private, end - encInfo->image_data_private);
+        encInfo->image_data_private = end;
+    }
+}
+
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 {
-    char buffer[8];
     for (int i = 0; i < strlen(magic_string); i++)
     {
-        fread(buffer, 8, 1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(magic_string[i], buffer);
-        fwrite(buffer, 8, 1, encInfo->fptr_stego_image);
+        encode_byte_to_lsb(magic_string[i], encInfo->header_data + encInfo->data_pos);
+        encInfo->data_pos += 8;
     }
     return e_success;
 }
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
 {
-    char buffer[32];
-    fread(buffer, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(size, buffer);
-    fwrite(buffer, 32, 1, encInfo->fptr_stego_image);
+    // --ecc repeats the word, one flipped bit must not turn the rest of the header into noise
+    for (int copy = 0; copy < (size & OPT_ECC ? OPT_WORD_COPIES : 1); copy++)
+    {
+        encode_size_to_lsb(size, encInfo->header_data + encInfo->data_pos);
+        encInfo->data_pos += 32;
+    }
+    return e_success;
+}
+
+/* Embed 4 header bytes as one Hamming coded group */
+static void encode_ecc_group(const char *data, EncodeInfo *encInfo)
+{
+    char coded[ECC_GROUP_CODED];
+    ecc_encode_groups(data, 1, coded);
+    for (int i = 0; i < ECC_GROUP_CODED; i++)
+    {
+        encode_byte_to_lsb(coded[i], encInfo->header_data + encInfo->data_pos);
+        encInfo->data_pos += 8;
+    }
+}
+
+Status encode_secret_file_nonce(EncodeInfo *encInfo)
+{
+    unsigned char key[CHACHA_KEY_SIZE], fields[CHACHA_NONCE_SIZE + CHACHA_CHECK_SIZE];
+    if (encInfo->key == NULL)
+    {
+        return e_success;
+    }
+    // a fresh nonce per image, so one key never reuses a keystream and the KDF salt is new too
+    if (chacha_random_nonce(fields) == e_failure)
+    {
+        return e_failure;
+    }
+    chacha_derive_key(encInfo->key, fields, key);
+    chacha_setup(&encInfo->cipher, key, fields);
+    memset(key, 0, sizeof(key));
+    chacha_key_check(&encInfo->cipher, fields + CHACHA_NONCE_SIZE);
+
+    for (int i = 0; i < (int)sizeof(fields); i += encInfo->ecc ? ECC_GROUP_DATA : 1)
+    {
+        if (encInfo->ecc)
+        {
+            encode_ecc_group((const char *)fields + i, encInfo);
+            continue;
+        }
+        encode_byte_to_lsb((char)fields[i], encInfo->header_data + encInfo->data_pos);
+        encInfo->data_pos += 8;
+    }
+    return e_success;
 }
 
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 {
-    char buffer[8];
+    if (encInfo->ecc)
+    {
+        // zero padded to a full group
+        char group[ECC_GROUP_DATA] = {0};
+        memcpy(group, file_extn, strlen(file_extn));
+        encode_ecc_group(group, encInfo);
+        return e_success;
+    }
     for (int i = 0; i < strlen(file_extn); i++)
     {
-        fread(buffer, 8, 1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(file_extn[i], buffer);
-        fwrite(buffer, 8, 1, encInfo->fptr_stego_image);
+        encode_byte_to_lsb(file_extn[i], encInfo->header_data + encInfo->data_pos);
+        encInfo->data_pos += 8;
     }
     return e_success;
 }
 
 Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
 {
-    char buffer[32];
-    fread(buffer, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(file_size, buffer);
-    fwrite(buffer, 32, 1, encInfo->fptr_stego_image);
+    if (encInfo->ecc)
+    {
+        // little endian, same bit order as the plain size field
+        char group[ECC_GROUP_DATA];
+        for (int i = 0; i < ECC_GROUP_DATA; i++)
+            group[i] = (char)((uint)file_size >> (8 * i));
+        encode_ecc_group(group, encInfo);
+        return e_success;
+    }
+    encode_size_to_lsb(file_size, encInfo->header_data + encInfo->data_pos);
+    encInfo->data_pos += 32;
+    return e_success;
+}
+
+/* With --key, encrypt n payload bytes in place while they are still in cache */
+static void encrypt_payload_data(EncodeInfo *encInfo, char *buffer, size_t n)
+{
+    if (encInfo->key != NULL)
+    {
+        chacha_xor(&encInfo->cipher, encInfo->cipher_pos, buffer, n);
+        encInfo->cipher_pos += n;
+    }
+}
+
+/*
+ * Hand out the next n bytes to embed: the secret itself, or its
+ * Hamming coded form with --ecc, encrypted with --key. Whole groups are
+ * coded straight into the caller's buffer; a group split by the chunk
+ * boundary is parked in stage_carry until the next call.
+ */
+static Status read_payload_data(EncodeInfo *encInfo, char *buffer, size_t n)
+{
+    if (!encInfo->ecc)
+    {
+        if (fread(buffer, 1, n, encInfo->fptr_secret) != n)
+        {
+            return e_failure;
+        }
+        encrypt_payload_data(encInfo, buffer, n);
+        return e_success;
+    }
+
+    char *start = buffer;
+    size_t total = n;
+    while (n > 0)
+    {
+        if (encInfo->stage_carry_pos < encInfo->stage_carry_len)
+        {
+            size_t take = encInfo->stage_carry_len - encInfo->stage_carry_pos;
+            if (take > n)
+                take = n;
+            memcpy(buffer, encInfo->stage_carry + encInfo->stage_carry_pos, take);
+            encInfo->stage_carry_pos += take;
+            buffer += take;
+            n -= take;
+            continue;
+        }
+
+        char data[1024 * ECC_GROUP_DATA];
+        size_t groups = n / ECC_GROUP_CODED;
+        if (groups > 1024)
+            groups = 1024;
+        int to_carry = groups == 0;
+        if (to_carry)
+            groups = 1;
+
+        // the last group of the secret is zero padded
+        size_t want = groups * ECC_GROUP_DATA;
+        size_t have = encInfo->secret_remaining < (long)want ? (size_t)encInfo->secret_remaining : want;
+        memset(data + have, 0, want - have);
+        if (fread(data, 1, have, encInfo->fptr_secret) != have)
+        {
+            return e_failure;
+        }
+        encInfo->secret_remaining -= have;
+
+        if (to_carry)
+        {
+            ecc_encode_groups(data, 1, encInfo->stage_carry);
+            encInfo->stage_carry_len = ECC_GROUP_CODED;
+            encInfo->stage_carry_pos = 0;
+        }
+        else
+        {
+            ecc_encode_groups(data, groups, buffer);
+            buffer += groups * ECC_GROUP_CODED;
+            n -= groups * ECC_GROUP_CODED;
+        }
+    }
+    encrypt_payload_data(encInfo, start, total);
+    return e_success;
+}
+
+/*
+ * Embed n payload bytes at carrier and return the carrier bytes used.
+ * Matrix embedding pads the last group with zeros, data has room for it.
+ */
+static size_t embed_payload_block(EncodeInfo *encInfo, char *data, size_t n, char *carrier)
+{
+    uint k = encInfo->matrix_k;
+    if (k == 0)
+    {
+        encInfo->kernels->embed_block(data, n, carrier);
+        return n * 8;
+    }
+    size_t padded = (n + k - 1) / k * k;
+    memset(data + n, 0, padded - n);
+    encInfo->matrix_changed += lsb_matrix_embed(data, padded, k, carrier);
+    return lsb_matrix_carrier_size(padded, k);
+}
+
+/*
+ * --verify: extract the n payload bytes just embedded back out of the
+ * carrier (the stego buffer itself, or slots gathered again from it)
+ * and compare them with what went in. check needs room for the padding
+ * of the last matrix group.
+ */
+static Status verify_payload_block(EncodeInfo *encInfo, const char *data, size_t n, const char *carrier, char *check)
+{
+    uint k = encInfo->matrix_k;
+    if (k == 0)
+        encInfo->kernels->extract_block(check, n, carrier);
+    else
+        lsb_matrix_extract(check, (n + k - 1) / k * k, k, carrier);
+
+    if (memcmp(check, data, n) != 0)
+    {
+        size_t i = 0;
+        while (check[i] == data[i])
+            i++;
+        printf("\n⚠️ ERROR: --verify read back a different payload byte at offset %zu\n", encInfo->verified + i);
+        return e_failure;
+    }
+    encInfo->verified += n;
     return e_success;
 }
 
+/* Grow the warm slot buffer to at least size bytes */
+static Status reserve_slot_buffer(EncodeInfo *encInfo, size_t size)
+{
+    if (size > encInfo->slot_buffer_alloc)
+    {
+        char *buffer = realloc(encInfo->slot_buffer, size);
+        if (buffer == NULL)
+        {
+            perror("realloc");
+            return e_failure;
+        }
+        encInfo->slot_buffer = buffer;
+        encInfo->slot_buffer_alloc = size;
+    }
+    return e_success;
+}
+
+/*
+ * Point header_data at the carrier of the header fields. A 24 bit image
+ * (or 8 bit ppm / pgm) holds them from the first pixel byte on. Packed
+ * formats must not have bits of their fields flipped, so the default
+ * channel slots of the first rows are gathered (B G R, or the low bytes
+ * of 16 bit samples), the fields go in there and scatter_header_fields
+ * puts them back.
+ */
+static Status gather_header_fields(EncodeInfo *encInfo)
+{
+    const ImageGeometry *geometry = &encInfo->geometry;
+    size_t header_bytes = payload_header_bytes(encInfo);
+
+    if (pixel_format_bytewise(geometry->format))
+    {
+        touch_image_data(encInfo, header_bytes);
+        encInfo->header_data = encInfo->image_data;
+        return e_success;
+    }
+    uint field_mask = default_channel_mask(geometry->format);
+    const LsbKernels *fields = lsb_select_pixel_kernels(geometry->format, field_mask);
+    size_t row_slots = (size_t)geometry->width * channel_count(field_mask);
+    uint rows = payload_start_row(geometry, header_bytes);
+    if ((size_t)rows * geometry->row_stride > encInfo->image_data_size || reserve_slot_buffer(encInfo, rows * row_slots) == e_failure)
+    {
+        return e_failure;
+    }
+    touch_image_data(encInfo, (size_t)rows * geometry->row_stride);
+    for (uint r = 0; r < rows; r++)
+        fields->gather(encInfo->image_data + (size_t)r * geometry->row_stride, geometry->width, encInfo->slot_buffer + r * row_slots);
+    encInfo->header_data = encInfo->slot_buffer;
+    return e_success;
+}
+
+static void scatter_header_fields(EncodeInfo *encInfo)
+{
+    const ImageGeometry *geometry = &encInfo->geometry;
+    if (encInfo->header_data == encInfo->image_data)
+    {
+        return;
+    }
+    uint field_mask = default_channel_mask(geometry->format);
+    const LsbKernels *fields = lsb_select_pixel_kernels(geometry->format, field_mask);
+    size_t row_slots = (size_t)geometry->width * channel_count(field_mask);
+    uint rows = payload_start_row(geometry, encInfo->data_pos);
+    for (uint r = 0; r < rows; r++)
+        fields->scatter(encInfo->image_data + (size_t)r * geometry->row_stride, geometry->width, encInfo->slot_buffer + r * row_slots);
+}
+
+/* --verify: keep the header fields as embedded, they are read back once the payload is in */
+static void save_header_check(EncodeInfo *encInfo)
+{
+    if (encInfo->verify)
+        lsb_kernel_table[e_layout_bytes].extract_block(encInfo->header_check, payload_header_bytes(encInfo) / 8, encInfo->header_data);
+}
+
+/* Read the header fields back out of the stego buffer (gathering the header rows again for packed formats) */
+static Status verify_header_fields(EncodeInfo *encInfo)
+{
+    const ImageGeometry *geometry = &encInfo->geometry;
+    size_t header_bytes = payload_header_bytes(encInfo);
+    char fields[HEADER_FIELDS_MAX / 8];
+    const char *carrier = encInfo->image_data;
+    char *header_rows = NULL;
+
+    if (!pixel_format_bytewise(geometry->format))
+    {
+        uint field_mask = default_channel_mask(geometry->format);
+        const LsbKernels *field_kernels = lsb_select_pixel_kernels(geometry->format, field_mask);
+        size_t row_slots = (size_t)geometry->width * channel_count(field_mask);
+        uint rows = payload_start_row(geometry, header_bytes);
+        if ((header_rows = malloc(rows * row_slots)) == NULL)
+        {
+            return e_failure;
+        }
+        for (uint r = 0; r < rows; r++)
+            field_kernels->gather(encInfo->image_data + (size_t)r * geometry->row_stride, geometry->width, header_rows + r * row_slots);
+        carrier = header_rows;
+    }
+    lsb_kernel_table[e_layout_bytes].extract_block(fields, header_bytes / 8, carrier);
+    free(header_rows);
+
+    if (memcmp(fields, encInfo->header_check, header_bytes / 8) != 0)
+    {
+        printf("\n⚠️ ERROR: --verify read back different header fields\n");
+        return e_failure;
+    }
+    report(encInfo, "🔎 Verified: header and %zu payload bytes read back from the stego buffer\n", encInfo->verified);
+    return e_success;
+}
+
+/*
+ * Channel selective layout: the payload starts on the row after the
+ * header. ROWS_PER_CHUNK rows at a time, the selected channels are
+ * gathered into contiguous slots, embedded with the block kernel and
+ * scattered back, so row padding and unselected channels stay untouched.
+ */
+static Status encode_secret_file_data_channels(EncodeInfo *encInfo)
+{
+    const ImageGeometry *geometry = &encInfo->geometry;
+    const LsbKernels *kernels = encInfo->kernels;
+    size_t row_slots = (size_t)geometry->width * channel_count(encInfo->channel_mask);
+    size_t chunk_slots = row_slots * ROWS_PER_CHUNK;
+
+    if (reserve_slot_buffer(encInfo, chunk_slots + 2 * (chunk_slots / 8 + 8)) == e_failure)
+    {
+        return e_failure;
+    }
+    char *slots = encInfo->slot_buffer;
+    char *secret_data = encInfo->slot_buffer + chunk_slots;
+    char *check = secret_data + chunk_slots / 8 + 8;
+
+    size_t remaining = encInfo->payload_size;
+    for (uint row = payload_start_row(geometry, encInfo->data_pos); remaining > 0 && row < geometry->height; row += ROWS_PER_CHUNK)
+    {
+        uint rows = geometry->height - row < ROWS_PER_CHUNK ? geometry->height - row : ROWS_PER_CHUNK;
+        uint k = encInfo->matrix_k;
+        // whole groups of k bytes (one group per 8 * (2^k - 1) slots) with --matrix
+        size_t chunk = k ? rows * row_slots / lsb_matrix_carrier_size(k, k) * k : rows * row_slots / 8;
+        if (chunk > remaining)
+            chunk = remaining;
+        // only the rows this chunk of the payload reaches
+        size_t used = k ? lsb_matrix_carrier_size(chunk, k) : chunk * 8;
+        uint rows_used = (uint)((used + row_slots - 1) / row_slots);
+
+        if (progress_cancelled() || read_payload_data(encInfo, secret_data, chunk) == e_failure)
+        {
+            return e_failure;
+        }
+        touch_image_data(encInfo, (size_t)(row + rows_used) * geometry->row_stride);
+        char *pixels = encInfo->image_data + (size_t)row * geometry->row_stride;
+        for (uint r = 0; r < rows_used; r++)
+            kernels->gather(pixels + (size_t)r * geometry->row_stride, geometry->width, slots + r * row_slots);
+        embed_payload_block(encInfo, secret_data, chunk, slots);
+        for (uint r = 0; r < rows_used; r++)
+            kernels->scatter(pixels + (size_t)r * geometry->row_stride, geometry->width, slots + r * row_slots);
+        if (encInfo->verify)
+        {
+            // gather the rows again, so the check covers the scatter too
+            for (uint r = 0; r < rows_used; r++)
+                kernels->gather(pixels + (size_t)r * geometry->row_stride, geometry->width, slots + r * row_slots);
+            if (verify_payload_block(encInfo, secret_data, chunk, slots, check) == e_failure)
+            {
+                return e_failure;
+            }
+        }
+
+        progress_add(&encInfo->progress, chunk * 8);
+        remaining -= chunk;
+    }
+    return remaining == 0 ? e_success : e_failure;
+}
+
+/*
+ * Content adaptive layout (--adaptive): the tiles after the header are
+ * ranked by texture once, then filled busiest first, ADAPTIVE_BATCH tiles
+ * per chunk gathered into contiguous slots like the rows of the channel
+ * layout. The ranking ignores the bits embedding changes, so the decoder
+ * rebuilds it from the stego image.
+ */
+static Status encode_secret_file_data_adaptive(EncodeInfo *encInfo)
+{
+    const ImageGeometry *geometry = &encInfo->geometry;
+    const LsbKernels *kernels = encInfo->kernels;
+    size_t tile_slots = (size_t)ADAPTIVE_TILE_W * ROWS_PER_CHUNK * channel_count(encInfo->channel_mask);
+    size_t batch_slots = tile_slots * ADAPTIVE_BATCH;
+    uint k = encInfo->matrix_k;
+    AdaptiveMap map;
+
+    if (reserve_slot_buffer(encInfo, batch_slots + 2 * (batch_slots / 8 + 8)) == e_failure)
+    {
+        return e_failure;
+    }
+    // tiles are spread over the whole image, every pixel becomes private
+    touch_image_data(encInfo, encInfo->image_data_size);
+    if (adaptive_build_map(geometry, encInfo->image_data, encInfo->image_data_size, encInfo->data_pos, &map) == e_failure)
+    {
+        return e_failure;
+    }
+    char *slots = encInfo->slot_buffer;
+    char *secret_data = encInfo->slot_buffer + batch_slots;
+    char *check = secret_data + batch_slots / 8 + 8;
+
+    size_t remaining = encInfo->payload_size;
+    for (size_t first = 0; remaining > 0 && first < map.tiles; first += ADAPTIVE_BATCH)
+    {
+        size_t tiles = map.tiles - first < ADAPTIVE_BATCH ? map.tiles - first : ADAPTIVE_BATCH;
+        // whole groups of k bytes with --matrix, as in the channel layout
+        size_t chunk = k ? tiles * tile_slots / lsb_matrix_carrier_size(k, k) * k : tiles * tile_slots / 8;
+        if (chunk > remaining)
+            chunk = remaining;
+        size_t used = k ? lsb_matrix_carrier_size(chunk, k) : chunk * 8;
+        size_t tiles_used = (used + tile_slots - 1) / tile_slots;
+
+        if (progress_cancelled() || read_payload_data(encInfo, secret_data, chunk) == e_failure)
+        {
+            adaptive_free_map(&map);
+            return e_failure;
+        }
+        adaptive_gather(&map, geometry, kernels, encInfo->image_data, first, tiles_used, slots);
+        embed_payload_block(encInfo, secret_data, chunk, slots);
+        adaptive_scatter(&map, geometry, kernels, encInfo->image_data, first, tiles_used, slots);
+        if (encInfo->verify)
+        {
+            adaptive_gather(&map, geometry, kernels, encInfo->image_data, first, tiles_used, slots);
+            if (verify_payload_block(encInfo, secret_data, chunk, slots, check) == e_failure)
+            {
+                adaptive_free_map(&map);
+                return e_failure;
+            }
+        }
+
+        progress_add(&encInfo->progress, chunk * 8);
+        remaining -= chunk;
+    }
+    adaptive_free_map(&map);
+    return remaining == 0 ? e_success : e_failure;
+}
+
 Status encode_secret_file_data(EncodeInfo *encInfo)
 {
     // rewind it
     rewind(encInfo->fptr_secret);
-    long size = encInfo->size_secret_file;
-    char secret_data[size];
-    fread(secret_data, encInfo->size_secret_file, 1, encInfo->fptr_secret);
-    char buffer[8];
-    for (int i = 0; i < encInfo->size_secret_file; i++)
+    encInfo->secret_remaining = encInfo->size_secret_file;
+    encInfo->stage_carry_len = encInfo->stage_carry_pos = 0;
+    encInfo->cipher_pos = 0;
+    encInfo->verified = 0;
+    if (encInfo->adaptive)
+    {
+        return encode_secret_file_data_adaptive(encInfo);
+    }
+    if (encInfo->kernels->gather != NULL)
     {
-        fread(buffer, 8, 1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(secret_data[i], buffer);
-        fwrite(buffer, 8, 1, encInfo->fptr_stego_image);
+        return encode_secret_file_data_channels(encInfo);
+    }
+    // Stream the secret in chunks straight into the image buffer
+    char secret_data[4096];
+    char check[sizeof(secret_data) + 8];
+    size_t max_chunk = encInfo->matrix_k ? sizeof(secret_data) / encInfo->matrix_k * encInfo->matrix_k : sizeof(secret_data);
+    size_t remaining = encInfo->payload_size;
+    while (remaining > 0)
+    {
+        size_t chunk = remaining < max_chunk ? remaining : max_chunk;
+        if (progress_cancelled() || read_payload_data(encInfo, secret_data, chunk) == e_failure)
+        {
+            return e_failure;
+        }
+        touch_image_data(encInfo, encInfo->data_pos + (encInfo->matrix_k ? lsb_matrix_carrier_size(chunk, encInfo->matrix_k) : chunk * 8));
+        size_t used = embed_payload_block(encInfo, secret_data, chunk, encInfo->image_data + encInfo->data_pos);
+        if (encInfo->verify && verify_payload_block(encInfo, secret_data, chunk, encInfo->image_data + encInfo->data_pos, check) == e_failure)
+        {
+            return e_failure;
+        }
+        encInfo->data_pos += used;
+        progress_add(&encInfo->progress, chunk * 8);
+        remaining -= chunk;
     }
     return e_success;
 }
 
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+Status write_image_data(EncodeInfo *encInfo)
 {
-    char ch;
-    while (fread(&ch, 1, 1, fptr_src) > 0)
+    // Header is already written, dump the pixel buffer in large chunks:
+    // the private prefix first, then the untouched tail of a cached carrier
+    size_t size = encInfo->image_data_size;
+    size_t done = 0;
+    for (size_t chunk; done < size; done += chunk)
     {
-        fwrite(&ch, 1, 1, fptr_dest);
+        size_t end = done < encInfo->image_data_private ? encInfo->image_data_private : size;
+        const char *src = done < encInfo->image_data_private ? encInfo->image_data : encInfo->carrier->pixels;
+        chunk = end - done < IO_CHUNK ? end - done : IO_CHUNK;
+        if (progress_cancelled() || fwrite(src + done, 1, chunk, encInfo->fptr_stego_image) != chunk)
+        {
+            return e_failure;
+        }
+        progress_add(&encInfo->progress, chunk);
     }
     return e_success;
 }
 
 Status encode_byte_to_lsb(char data, char *image_buffer)
 {
-    // char encode
-    for (int i = 0; i < 8; i++)
-    {
-        image_buffer[i] = (image_buffer[i] & (~1)) | (data >> i) & 1;
-    }
+    // char encode (header fields always use the plain byte layout)
+    lsb_kernel_table[e_layout_bytes].embed_byte(data, image_buffer);
     return e_success;
 }
 
 Status encode_size_to_lsb(int size, char *imageBuffer)
 {
     // integer encode
-    for (int i = 0; i < 32; i++)
+    lsb_kernel_table[e_layout_bytes].embed_size(size, imageBuffer);
+    return e_success;
+}
+
+void discard_stego_image(EncodeInfo *encInfo)
+{
+    // An unpublished image never had the real name, a daemon fd is emptied
+    if (encInfo->fptr_stego_image == NULL)
+        return;
+    fflush(encInfo->fptr_stego_image);
+    if (encInfo->stego_fd_handed_over && ftruncate(fileno(encInfo->fptr_stego_image), 0) < 0)
+        perror("ftruncate");
+    fclose(encInfo->fptr_stego_image);
+    encInfo->fptr_stego_image = NULL;
+    atomic_out_close(&encInfo->stego_out);
+}
+
+Status publish_stego_image(EncodeInfo *encInfo)
+{
+    // Durable on its own, unless the caller syncs a whole batch later
+    if (atomic_out_publish(&encInfo->stego_out, encInfo->fptr_stego_image, !encInfo->defer_sync) == e_failure)
     {
-        imageBuffer[i] = (imageBuffer[i] & (~1)) | (size >> i) & 1;
+        perror(encInfo->stego_image_fname);
+        return e_failure;
     }
     return e_success;
 }
 
+/*
+ * Key of the job in the output cache: the SHA-256 of the carrier header,
+ * the carrier pixels (before anything is embedded), the secret and every
+ * option that shapes the output. A hit is taken on the key alone, so it
+ * has to be collision resistant. Returns e_success on a cache hit, with
+ * the output produced.
+ */
+static Status lookup_output_cache(EncodeInfo *encInfo)
+{
+    Sha256Ctx hash;
+    char buffer[65536];
+    uint version = OUTCACHE_VERSION;
+    sha256_init(&hash);
+    sha256_update(&hash, &version, sizeof(version));
+
+    uint header_size = encInfo->geometry.data_offset;
+    if (pread(fileno(encInfo->fptr_src_image), buffer, header_size, 0) != header_size)
+    {
+        return e_failure;
+    }
+    sha256_update(&hash, buffer, header_size);
+    sha256_update(&hash, encInfo->carrier != NULL ? encInfo->carrier->pixels : encInfo->image_data, encInfo->image_data_size);
+
+    rewind(encInfo->fptr_secret);
+    for (size_t n; (n = fread(buffer, 1, sizeof(buffer), encInfo->fptr_secret)) > 0;)
+        sha256_update(&hash, buffer, n);
+
+    uint options[6] = {(uint)encInfo->size_secret_file, encInfo->channel_mask, (uint)encInfo->ecc, encInfo->matrix_k, (uint)encInfo->extn_size, (uint)encInfo->adaptive};
+    sha256_update(&hash, options, sizeof(options));
+    sha256_update(&hash, encInfo->extn_secret_file, (size_t)encInfo->extn_size);
+    sha256_final(&hash, encInfo->cache_key);
+
+    fflush(encInfo->fptr_stego_image);
+    Status hit = outcache_fetch(encInfo->cache_dir, encInfo->cache_key, fileno(encInfo->fptr_stego_image));
+
+    unsigned long long hits, misses;
+    char hex[2 * OUTCACHE_KEY_SIZE + 1];
+    outcache_count(encInfo->cache_dir, hit == e_success, &hits, &misses);
+    outcache_key_hex(encInfo->cache_key, hex);
+    report(encInfo, "🗃️  Output cache %s (%.16s): %llu hits / %llu misses\n", hit == e_success ? "hit" : "miss", hex, hits, misses);
+    return hit;
+}
+
+static Status encode_stages(EncodeInfo *encInfo);
+
 Status do_encoding(EncodeInfo *encInfo)
+{
+    /* Run every stage; on failure or cancel drop the partial output */
+    Status status = encode_stages(encInfo);
+    progress_stop(&encInfo->progress);
+
+    if (status == e_failure)
+    {
+        if (progress_cancelled())
+            printf("\n🛑 Encoding cancelled, partial output removed.\n");
+        discard_stego_image(encInfo);
+    }
+    return status;
+}
+
+static Status encode_stages(EncodeInfo *encInfo)
 {
     /* Orchestrate the encoding steps in sequence. Each helper returns
        e_success or e_failure. Print user-friendly messages for errors. */
@@ -320,63 +1091,104 @@ Status do_encoding(EncodeInfo *encInfo)
     {
         /* Print a friendly header and input/output summary */
         
-        printf("\n=============================================\n");
-        printf("🔐 ENCODING MODE SELECTED\n");
-        printf("=============================================\n");
-        printf("📂 Input BMP Image      : %s\n", encInfo->src_image_fname);
-        printf("📄 Secret Message File  : %s\n", encInfo->secret_fname);
-        printf("💾 Output Image (Stego) : %s\n", encInfo->stego_image_fname);
-        printf("---------------------------------------------\n");
+        report(encInfo, "\n=============================================\n");
+        report(encInfo, "🔐 ENCODING MODE SELECTED\n");
+        report(encInfo, "=============================================\n");
+        report(encInfo, "📂 Input BMP Image      : %s\n", encInfo->src_image_fname);
+        report(encInfo, "📄 Secret Message File  : %s\n", encInfo->secret_fname);
+        report(encInfo, "💾 Output Image (Stego) : %s\n", encInfo->stego_image_fname);
+        if (encInfo->channel_mask != 0)
+        {
+            report(encInfo, "🎨 Channels Used        : %s%s%s%s\n", encInfo->channel_mask & CHANNEL_B ? "B" : "", encInfo->channel_mask & CHANNEL_G ? "G" : "", encInfo->channel_mask & CHANNEL_R ? "R" : "", encInfo->channel_mask & CHANNEL_A ? "A" : "");
+        }
+        if (encInfo->adaptive)
+        {
+            report(encInfo, "🧭 Layout               : adaptive, busiest tiles first\n");
+        }
+        if (encInfo->key != NULL)
+        {
+            report(encInfo, "🔑 Payload Cipher       : ChaCha20\n");
+        }
+        report(encInfo, "---------------------------------------------\n");
         if (check_capacity(encInfo) == e_success)
         {
             /* Capacity check and basic validation messages */
-            printf("🔍 Checking file access and formats...\n");
-            printf("✅ All files validated successfully!\n");
-            printf("\n⚙️  Encoding Process Started...\n");
-            printf("-------------------------------------------------\n");
-            if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+            report(encInfo, "🔍 Checking file access and formats...\n");
+            report(encInfo, "✅ All files validated successfully!\n");
+            report(encInfo, "\n⚙️  Encoding Process Started...\n");
+            report(encInfo, "-------------------------------------------------\n");
+            // load + embed + write, counted in carrier bytes; quiet jobs only report to a fd or callback
+            if (!encInfo->quiet || encInfo->progress.fd > 0 || encInfo->progress.callback != NULL)
+                progress_start(&encInfo->progress, 2ULL * (get_file_size(encInfo->fptr_src_image) - encInfo->geometry.data_offset) + 8ULL * encInfo->payload_size, "Encoding");
+            if (encInfo->carrier != NULL ? load_cached_carrier(encInfo) == e_success
+                                         : copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success && load_image_data(encInfo) == e_success)
             {
+                // the output of --key depends on a fresh nonce, there is nothing to reuse
+                if (encInfo->cache_dir != NULL && encInfo->key != NULL)
+                {
+                    report(encInfo, "🗃️  Output cache skipped for an encrypted payload\n");
+                    encInfo->cache_dir = NULL;
+                }
+                // an identical job done before: clone its output and stop
+                if (encInfo->cache_dir != NULL && lookup_output_cache(encInfo) == e_success)
+                {
+                    Status published = publish_stego_image(encInfo);
+                    if (published == e_success)
+                        report(encInfo, "\n🎯 Stego image reused from the output cache: %s\n", encInfo->stego_image_fname);
+                    close_files(encInfo);
+                    return published;
+                }
                 /* Inform user about header/read phase */
-                printf("📦 Reading source image header...\n");
-                if (encode_magic_string(MAGIC_STRING, encInfo) == e_success)
+                report(encInfo, "📦 Reading source image header...\n");
+                if (gather_header_fields(encInfo) == e_success && encode_magic_string(MAGIC_STRING, encInfo) == e_success)
                 {
                     /* Inform user we're embedding the magic string / bits */
-                    printf("💡 Embedding secret message bits into pixel data...\n");
-                    if (encode_secret_file_extn_size(extn_size, encInfo) == e_success)
+                    report(encInfo, "💡 Embedding secret message bits into pixel data...\n");
+                    if (encode_secret_file_extn_size(encInfo->extn_size | ((encInfo->channel_mask & CHANNEL_ALL) << OPT_CHANNEL_SHIFT) | (encInfo->channel_mask & CHANNEL_A ? OPT_ALPHA : 0) | (encInfo->ecc ? OPT_ECC : 0) | (encInfo->matrix_k << OPT_MATRIX_SHIFT) | (encInfo->adaptive ? OPT_ADAPTIVE : 0) | (encInfo->key != NULL ? OPT_CIPHER : 0), encInfo) == e_success)
                     {
                         /* Extension size encoded */
-                        printf("⏳ Encoding extension metadata...\n");
-                        if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_success)
+                        report(encInfo, "⏳ Encoding extension metadata...\n");
+                        if (encode_secret_file_nonce(encInfo) == e_success && encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_success)
                         {
                             /* Extension encoded */
-                            printf("🔐 Extension encoded: %s\n", encInfo->extn_secret_file);
+                            report(encInfo, "🔐 Extension encoded: %s\n", encInfo->extn_secret_file);
                             if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_success)
                             {
                                 /* Secret size encoded */
-                                printf("📦 Secret file size: %ld bytes encoded.\n", encInfo->size_secret_file);
-                                if (encode_secret_file_data(encInfo) == e_success)
+                                report(encInfo, "📦 Secret file size: %ld bytes encoded.\n", encInfo->size_secret_file);
+                                save_header_check(encInfo);
+                                scatter_header_fields(encInfo);
+                                // with --verify every chunk is read back as it is embedded, the header at the end
+                                if (encode_secret_file_data(encInfo) == e_success && (!encInfo->verify || verify_header_fields(encInfo) == e_success))
                                 {
                                     /* Secret data embedded */
-                                    printf("⏳ Please wait, encoding in progress...\n");
-                                    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+                                    report(encInfo, "⏳ Please wait, encoding in progress...\n");
+                                    if (encInfo->matrix_k != 0)
+                                    {
+                                        report(encInfo, "🧮 Matrix embedding (k = %u): %zu carrier bytes changed for %zu payload bits\n", encInfo->matrix_k, encInfo->matrix_changed, encInfo->payload_size * 8);
+                                    }
+                                    if (write_image_data(encInfo) == e_success && publish_stego_image(encInfo) == e_success)
                                     {
                                         /* Finalize and report success with a friendly block */
-                                        printf("\n🎯 Message successfully embedded into image!\n");
-                                        printf("💾 Stego image created: %s\n", encInfo->stego_image_fname);
-                                        printf("-------------------------------------------------\n");
-                                        printf("✨ Encoding Completed Successfully! ✨\n");
-                                        printf("✅ Your data is now hidden securely inside the image.\n");
-                                        printf("-------------------------------------------------\n\n");
+                                        report(encInfo, "\n🎯 Message successfully embedded into image!\n");
+                                        report(encInfo, "💾 Stego image created: %s\n", encInfo->stego_image_fname);
+                                        report(encInfo, "-------------------------------------------------\n");
+                                        report(encInfo, "✨ Encoding Completed Successfully! ✨\n");
+                                        report(encInfo, "✅ Your data is now hidden securely inside the image.\n");
+                                        report(encInfo, "-------------------------------------------------\n\n");
 
-                                        fclose(encInfo->fptr_secret);
-                                        fclose(encInfo->fptr_src_image);
-                                        fclose(encInfo->fptr_stego_image);
+                                        if (encInfo->cache_dir != NULL && (fflush(encInfo->fptr_stego_image) != 0 ||
+                                            outcache_store(encInfo->cache_dir, encInfo->cache_key, fileno(encInfo->fptr_stego_image), encInfo->cache_budget ? encInfo->cache_budget : (unsigned long long)OUTCACHE_DEFAULT_MB << 20) == e_failure))
+                                        {
+                                            printf("⚠️  Could not add the output to the cache.\n");
+                                        }
+                                        close_files(encInfo);
 
                                         return e_success;
                                     }
                                     else
                                     {
-                                        printf("\n⚠️ ERROR: failed while copying remaining image data.\n");
+                                        printf("\n⚠️ ERROR: failed while writing image data.\n");
                                         return e_failure;
                                     }
                                 }
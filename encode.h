@@ -3,6 +3,14 @@
 #include <stdio.h>
 
 #include "types.h" // Contains user defined types
+#include "lsb.h"   // Embed / extract kernels
+#include "image.h" // Pixel geometry
+#include "progress.h" // Progress reporting / cancellation
+#include "carrier_cache.h" // Cached carriers of the daemon
+#include "chacha.h" // Payload cipher
+#include "common.h" // Header field sizes
+#include "atomic_out.h" // Outputs published only on success
+#include "outcache.h" // Output cache keys
 
 /*
  * Structure to store information required for
@@ -16,7 +24,7 @@ typedef struct _EncodeInfo
     /* Source Image info */
     char *src_image_fname; // To store the src image name
     FILE *fptr_src_image;  // To store the address of the src image
-    uint image_capacity;   // To store the size of image
+    ImageGeometry geometry; // To store the pixel geometry of the src image
 
     /* Secret File Info */
     char *secret_fname;       // To store the secret file name
@@ -25,9 +33,59 @@ typedef struct _EncodeInfo
     long size_secret_file;    // To store the size of the secret data
     //char secret_data[100000];    // To store the secret data
 
+    int extn_size;            // To store the length of the extension
+
     /* Stego Image Info */
     char *stego_image_fname; // To store the dest file name
     FILE *fptr_stego_image;  // To store the address of stego image
+    AtomicOut stego_out;     // To store the unnamed stego image until it is published
+    int defer_sync;          // To store 1 when the caller syncs outputs in batches (watch mode)
+
+    /* Pixel data buffer (kept warm between daemon requests) */
+    char *image_data;        // To store the pixel bytes after the bmp header
+    size_t image_data_size;  // To store the number of valid pixel bytes
+    size_t image_data_alloc; // To store the allocated size of image_data
+    size_t data_pos;         // To store the next pixel byte to embed into
+    char *header_data;       // To store where the header fields go (image_data, or gathered slots)
+    const LsbKernels *kernels; // To store the kernels picked for the payload layout
+    uint channel_mask;       // To store the --channels selection (0 = every byte, 24 bit only)
+    char *slot_buffer;       // To store gathered channel bytes (kept warm)
+    size_t slot_buffer_alloc; // To store the allocated size of slot_buffer
+
+    /* Cached carrier (daemon only): image_data holds just the embedded prefix */
+    const Carrier *carrier;  // To store the cached source image (NULL = read from the file)
+    size_t image_data_private; // To store the bytes of image_data copied from the carrier
+
+    /* Progress of the job (fd / callback are set by the caller) */
+    Progress progress;       // To store the progress counters and reporter
+    int stego_fd_handed_over; // To store 1 when the output is a daemon fd (never unlinked)
+    int quiet;               // To store 1 for daemon / watch jobs: no banners, the caller prints one line
+
+    /* Payload stages between the secret file and the kernels */
+    int ecc;                 // To store whether --ecc is on
+    size_t payload_size;     // To store the bytes embedded for the secret (after ECC)
+    long secret_remaining;   // To store the secret bytes not read yet
+    char stage_carry[8];     // To store coded bytes produced but not embedded yet
+    size_t stage_carry_len;  // To store the number of bytes in stage_carry
+    size_t stage_carry_pos;  // To store the next byte of stage_carry to hand out
+    uint matrix_k;           // To store the --matrix code parameter k (0 = off)
+    size_t matrix_changed;   // To store the carrier bytes matrix embedding flipped
+    int adaptive;            // To store whether --adaptive is on
+
+    /* Payload encryption (--key) */
+    char *key;                        // To store the --key passphrase (NULL = off)
+    ChachaCtx cipher;                 // To store the cipher state for the key and nonce
+    unsigned long long cipher_pos;    // To store the payload bytes encrypted so far
+
+    /* Read back check before the output is written (--verify) */
+    int verify;                       // To store whether --verify is on
+    char header_check[HEADER_FIELDS_MAX / 8]; // To store the header fields as embedded
+    size_t verified;                  // To store the payload bytes read back so far
+
+    /* Content addressed output cache (--cache-dir) */
+    char *cache_dir;                  // To store the cache directory (NULL = off)
+    unsigned long long cache_budget;  // To store the byte budget of the cache
+    unsigned char cache_key[OUTCACHE_KEY_SIZE]; // To store the SHA-256 of carrier, payload and options
 
 } EncodeInfo;
 
@@ -36,33 +94,48 @@ typedef struct _EncodeInfo
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
 
+/* Consume --options from argv, leaving the positional args in place */
+Status read_encode_options(char *argv[], EncodeInfo *encInfo);
+
 /* check extensions of file gave from user */
 int checkExtension(char *str, char *extension);
 
 /* Perform the encoding */
 Status do_encoding(EncodeInfo *encInfo);
 
+/* Throw away a partially written stego image */
+void discard_stego_image(EncodeInfo *encInfo);
+
+/* Give a complete stego image its real name */
+Status publish_stego_image(EncodeInfo *encInfo);
+
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Close whatever files are still open */
+void close_files(EncodeInfo *encInfo);
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
-
 /* Get file size */
 uint get_file_size(FILE *fptr);
 
 /* Copy bmp image header */
 Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
 
+/* Read the pixel data of the src image into the image buffer */
+Status load_image_data(EncodeInfo *encInfo);
+
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 
 /*Encode extension size*/
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 
+/* Encode the random nonce and the key check of --key (nothing without a key) */
+Status encode_secret_file_nonce(EncodeInfo *encInfo);
+
 /* Encode secret file extenstion */
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
@@ -78,7 +151,7 @@ Status encode_byte_to_lsb(char data, char *image_buffer);
 // Encode a size to lsb
 Status encode_size_to_lsb(int size, char *imageBuffer);
 
-/* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
+/* Write the (now encoded) image buffer to the stego image */
+Status write_image_data(EncodeInfo *encInfo);
 
 #endif
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include "image.h"
+#include "types.h"
+#include <string.h>
+#include <ctype.h>
+
+/* biCompression values */
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+#define BI_ALPHABITFIELDS 6
+
+/* File header, 40 byte info header and the R G B masks */
+#define BMP_FIELDS_SIZE (54 + 12)
+
+/* Little endian fields of the bmp header */
+static uint bmp_u16(const unsigned char *p)
+{
+    return p[0] | (uint)p[1] << 8;
+}
+
+static uint bmp_u32(const unsigned char *p)
+{
+    return p[0] | (uint)p[1] << 8 | (uint)p[2] << 16 | (uint)p[3] << 24;
+}
+
+/* Pixel format of biBitCount / biCompression and the R G B masks (BI_BITFIELDS) */
+static Status bmp_pixel_format(uint bits, uint compression, const unsigned char *masks, PixelFormat *format)
+{
+    uint red = bmp_u32(masks), green = bmp_u32(masks + 4), blue = bmp_u32(masks + 8);
+
+    switch (bits)
+    {
+    case 24:
+        *format = e_pixel_bgr24;
+        return compression == BI_RGB ? e_success : e_failure;
+    case 32:
+        // BI_RGB is B G R X, masks are only accepted in the same byte order
+        *format = e_pixel_bgra32;
+        return compression == BI_RGB || (red == 0xFF0000 && green == 0xFF00 && blue == 0xFF) ? e_success : e_failure;
+    case 16:
+        if (compression == BI_RGB || (red == 0x7C00 && green == 0x3E0 && blue == 0x1F))
+        {
+            *format = e_pixel_rgb555;
+            return e_success;
+        }
+        *format = e_pixel_rgb565;
+        return red == 0xF800 && green == 0x7E0 && blue == 0x1F ? e_success : e_failure;
+    default:
+        return e_failure;
+    }
+}
+
+static Status read_bmp_geometry(FILE *fptr_image, ImageGeometry *geometry)
+{
+    /*
+     * bfOffBits is at offset 10, width at 18 and height right after it
+     * (a negative height only means the rows are stored top down), then
+     * biBitCount at 28 and biCompression at 30. The channel masks of
+     * BI_BITFIELDS follow the 40 byte info header, which is also where
+     * the V4 / V5 headers keep them.
+     */
+    unsigned char header[BMP_FIELDS_SIZE] = {0};
+    PixelFormat format;
+
+    rewind(fptr_image);
+    if (fread(header, 1, 54, fptr_image) != 54)
+    {
+        return e_failure;
+    }
+    uint data_offset = bmp_u32(header + 10);
+    uint info_size = bmp_u32(header + 14);
+    int width = (int)bmp_u32(header + 18);
+    int height = (int)bmp_u32(header + 22);
+    uint bits = bmp_u16(header + 28);
+    uint compression = bmp_u32(header + 30);
+
+    if (info_size < 40 || data_offset < 14 + info_size || data_offset > BMP_HEADER_MAX || width <= 0 || height == 0)
+    {
+        return e_failure;
+    }
+    if (compression == BI_BITFIELDS || compression == BI_ALPHABITFIELDS)
+    {
+        if (data_offset < 54 + 12 || fread(header + 54, 1, 12, fptr_image) != 12)
+        {
+            return e_failure;
+        }
+    }
+    else if (compression != BI_RGB)
+    {
+        return e_failure;
+    }
+    if (bmp_pixel_format(bits, compression, header + 54, &format) == e_failure)
+    {
+        return e_failure;
+    }
+
+    geometry->width = (uint)width;
+    geometry->height = height < 0 ? (uint)-height : (uint)height;
+    geometry->bytes_per_pixel = bits / 8;
+    geometry->row_stride = (geometry->width * geometry->bytes_per_pixel + 3) & ~3u;
+    geometry->data_offset = data_offset;
+    geometry->format = format;
+    return e_success;
+}
+
+/* Next decimal field of a pnm header, skipping whitespace and # comments; *end is the byte after it */
+static Status pnm_read_field(FILE *fptr_image, uint *value, int *end)
+{
+    int c = getc(fptr_image);
+    while (c != EOF && (isspace(c) || c == '#'))
+    {
+        // a comment runs to the end of its line
+        if (c == '#')
+        {
+            while (c != EOF && c != '\n')
+                c = getc(fptr_image);
+        }
+        c = getc(fptr_image);
+    }
+    if (c == EOF || !isdigit(c))
+    {
+        return e_failure;
+    }
+    unsigned long number = 0;
+    for (; c != EOF && isdigit(c); c = getc(fptr_image))
+    {
+        number = number * 10 + (unsigned long)(c - '0');
+        if (number > 0xFFFFFF)
+            return e_failure;
+    }
+    // a comment may follow a number directly
+    if (c == '#')
+        ungetc(c, fptr_image);
+    *value = (uint)number;
+    *end = c;
+    return e_success;
+}
+
+static Status read_pnm_geometry(FILE *fptr_image, ImageGeometry *geometry)
+{
+    /*
+     * "P6" or "P5", then width, height and maxval as ASCII fields with
+     * any whitespace and comments in between. Exactly one whitespace
+     * byte ends maxval, the samples start right after it. Samples are
+     * 16 bit big endian from maxval 256 on. maxval has to be odd, so a
+     * flipped LSB can never push a sample past it.
+     */
+    uint width, height, maxval;
+    int end;
+
+    rewind(fptr_image);
+    int kind = getc(fptr_image) == 'P' ? getc(fptr_image) : EOF;
+    if ((kind != '5' && kind != '6') || pnm_read_field(fptr_image, &width, &end) == e_failure ||
+        pnm_read_field(fptr_image, &height, &end) == e_failure || pnm_read_field(fptr_image, &maxval, &end) == e_failure)
+    {
+        return e_failure;
+    }
+    long data_offset = ftell(fptr_image);
+    if (!isspace(end) || width == 0 || height == 0 || maxval == 0 || maxval > 0xFFFF || maxval % 2 == 0 || data_offset > BMP_HEADER_MAX)
+    {
+        return e_failure;
+    }
+
+    uint sample_bytes = maxval > 0xFF ? 2 : 1;
+    if (kind == '6')
+        geometry->format = sample_bytes == 2 ? e_pixel_rgb48 : e_pixel_rgb24;
+    else
+        geometry->format = sample_bytes == 2 ? e_pixel_gray16 : e_pixel_gray8;
+    geometry->width = width;
+    geometry->height = height;
+    geometry->bytes_per_pixel = (kind == '6' ? 3 : 1) * sample_bytes;
+    geometry->row_stride = width * geometry->bytes_per_pixel;
+    geometry->data_offset = (uint)data_offset;
+    return e_success;
+}
+
+Status read_image_geometry(FILE *fptr_image, ImageGeometry *geometry)
+{
+    // pnm files start with 'P', a bmp with "BM"
+    rewind(fptr_image);
+    int c = getc(fptr_image);
+    if (c == 'P')
+        return read_pnm_geometry(fptr_image, geometry);
+    return read_bmp_geometry(fptr_image, geometry);
+}
+
+int pixel_format_bytewise(PixelFormat format)
+{
+    return format == e_pixel_bgr24 || format == e_pixel_rgb24 || format == e_pixel_gray8;
+}
+
+uint default_channel_mask(PixelFormat format)
+{
+    return format == e_pixel_gray8 || format == e_pixel_gray16 ? CHANNEL_G : CHANNEL_ALL;
+}
+
+Status parse_channel_mask(const char *str, uint *channel_mask)
+{
+    uint mask = 0;
+
+    for (; *str != '\0'; str++)
+    {
+        switch (toupper((unsigned char)*str))
+        {
+        case 'B':
+            mask |= CHANNEL_B;
+            break;
+        case 'G':
+            mask |= CHANNEL_G;
+            break;
+        case 'R':
+            mask |= CHANNEL_R;
+            break;
+        case 'A':
+            mask |= CHANNEL_A;
+            break;
+        default:
+            return e_failure;
+        }
+    }
+    if (mask == 0)
+    {
+        return e_failure;
+    }
+    *channel_mask = mask;
+    return e_success;
+}
+
+uint channel_count(uint channel_mask)
+{
+    return (uint)__builtin_popcount(channel_mask);
+}
+
+uint payload_start_row(const ImageGeometry *geometry, size_t header_bytes)
+{
+    size_t row_units = pixel_format_bytewise(geometry->format) ? geometry->row_stride : (size_t)geometry->width * channel_count(default_channel_mask(geometry->format));
+    return (uint)((header_bytes + row_units - 1) / row_units);
+}
+
+size_t payload_capacity(const ImageGeometry *geometry, size_t data_size, size_t header_bytes, uint channel_mask)
+{
+    if (channel_mask == 0)
+    {
+        // Legacy layout: every byte after the header, padding included
+        return data_size > header_bytes ? (data_size - header_bytes) / 8 : 0;
+    }
+
+    uint first_row = payload_start_row(geometry, header_bytes);
+    // Only rows that are fully present in the file count
+    size_t rows = data_size / geometry->row_stride;
+    if (rows > geometry->height)
+        rows = geometry->height;
+    if (rows <= first_row)
+        return 0;
+
+    return (rows - first_row) * geometry->width * channel_count(channel_mask) / 8;
+}
+
+size_t matrix_payload_capacity(const ImageGeometry *geometry, size_t data_size, size_t header_bytes, uint channel_mask, uint k)
+{
+    size_t unit = 8 * (((size_t)1 << k) - 1); // carrier bytes per k data bytes
+
+    if (channel_mask == 0)
+    {
+        return data_size > header_bytes ? (data_size - header_bytes) / unit * k : 0;
+    }
+
+    // Every chunk of ROWS_PER_CHUNK rows is coded on its own
+    size_t rows = data_size / geometry->row_stride;
+    if (rows > geometry->height)
+        rows = geometry->height;
+    size_t row_slots = (size_t)geometry->width * channel_count(channel_mask);
+    size_t capacity = 0;
+    for (size_t row = payload_start_row(geometry, header_bytes); row < rows; row += ROWS_PER_CHUNK)
+    {
+        size_t chunk_rows = rows - row < ROWS_PER_CHUNK ? rows - row : ROWS_PER_CHUNK;
+        capacity += chunk_rows * row_slots / unit * k;
+    }
+    return capacity;
+}
@@ -0,0 +1,80 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Pixel geometry of a carrier image, shared by encoding and decoding.
+ * BMP rows are padded to a multiple of 4 bytes, so the channel of a
+ * byte can only be told from its position inside a row. Binary PPM /
+ * PGM (P6 / P5) rows are the bare samples, top down.
+ */
+
+/* Pixel formats, told apart by biBitCount and the channel masks, or by the pnm magic and maxval */
+typedef enum
+{
+    e_pixel_bgr24,  // 24 bit, one byte per channel
+    e_pixel_bgra32, // 32 bit, B G R and alpha (or unused) bytes
+    e_pixel_rgb565, // 16 bit, 5-6-5 packed fields (BI_BITFIELDS)
+    e_pixel_rgb555, // 16 bit, 5-5-5 packed fields (BI_RGB or BI_BITFIELDS)
+    e_pixel_rgb24,  // P6, 8 bit R G B samples
+    e_pixel_gray8,  // P5, one 8 bit sample
+    e_pixel_rgb48,  // P6, 16 bit big endian R G B samples
+    e_pixel_gray16  // P5, one 16 bit big endian sample
+} PixelFormat;
+
+typedef struct _ImageGeometry
+{
+    uint width;           // To store the width in pixels
+    uint height;          // To store the height in pixels (always positive)
+    uint bytes_per_pixel; // To store the bytes of one pixel (1 to 6)
+    uint row_stride;      // To store the bytes of one padded row
+    uint data_offset;     // To store the file offset of the pixels (bfOffBits, or the end of the pnm header)
+    PixelFormat format;   // To store the pixel format
+} ImageGeometry;
+
+/* Largest image header that is accepted (bmp file + info header + masks, or pnm header with comments) */
+#define BMP_HEADER_MAX 1024
+
+/* Channel bits of --channels, in BMP byte order */
+#define CHANNEL_B 0x1
+#define CHANNEL_G 0x2
+#define CHANNEL_R 0x4
+#define CHANNEL_ALL (CHANNEL_B | CHANNEL_G | CHANNEL_R)
+#define CHANNEL_A 0x8 // 32 bit only, never part of CHANNEL_ALL
+
+/* Rows per gather / scatter chunk, keeps every chunk a whole number of bytes */
+#define ROWS_PER_CHUNK 8
+
+/* Read width / height / pixel format from the bmp or pnm header and derive the row stride */
+Status read_image_geometry(FILE *fptr_image, ImageGeometry *geometry);
+
+/* 1 when every byte of the format may carry a bit: header fields and the legacy layout go straight on the bytes */
+int pixel_format_bytewise(PixelFormat format);
+
+/* Channels used when none are picked: B G R, or the single sample of a gray image (named G) */
+uint default_channel_mask(PixelFormat format);
+
+/* Parse a --channels argument like "B", "bg" or "GRA" into channel bits */
+Status parse_channel_mask(const char *str, uint *channel_mask);
+
+/* Number of selected channels in a mask */
+uint channel_count(uint channel_mask);
+
+/*
+ * First row of the payload, the one after the rows used by the header.
+ * Bytewise formats hold the header fields in every byte, the others in
+ * the default channel slots of the first rows (see the header layout in lsb.h).
+ */
+uint payload_start_row(const ImageGeometry *geometry, size_t header_bytes);
+
+/* Bytes of payload that fit after header_bytes for a channel mask (0 = every byte) */
+size_t payload_capacity(const ImageGeometry *geometry, size_t data_size, size_t header_bytes, uint channel_mask);
+
+/* Same for --matrix k: whole groups of k bytes per chunk of carrier bytes */
+size_t matrix_payload_capacity(const ImageGeometry *geometry, size_t data_size, size_t header_bytes, uint channel_mask, uint k);
+
+#endif
@@ -0,0 +1,734 @@
+#include <stdio.h>
+#include "lsb.h"
+#include "types.h"
+#include "image.h"
+#include <string.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LSB_HAVE_X86 1
+#endif
+
+/*
+ * SWAR helpers
+ * ------------
+ * Eight carrier bytes are loaded as one little endian 64 bit word, so
+ * carrier byte i is byte lane i and its LSB sits at bit 8 * i.
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LSB_LE64(x) __builtin_bswap64(x)
+#else
+#define LSB_LE64(x) (x)
+#endif
+
+#define LSB_LANE_LSBS 0x0101010101010101ULL
+
+static inline uint64_t lsb_load64(const char *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return LSB_LE64(word);
+}
+
+static inline void lsb_store64(char *p, uint64_t word)
+{
+    word = LSB_LE64(word);
+    memcpy(p, &word, sizeof(word));
+}
+
+/* Spread the 8 bits of data over the LSBs of the 8 byte lanes */
+static inline uint64_t lsb_spread8(unsigned char data)
+{
+    uint64_t bits = (data * LSB_LANE_LSBS) & 0x8040201008040201ULL;
+    return ((bits + 0x7F7F7F7F7F7F7F7FULL) >> 7) & LSB_LANE_LSBS;
+}
+
+/* Gather the LSBs of the 8 byte lanes back into one byte */
+static inline unsigned char lsb_gather8(uint64_t word)
+{
+    return (unsigned char)(((word & LSB_LANE_LSBS) * 0x0102040810204080ULL) >> 56);
+}
+
+static inline void lsb_embed8(unsigned char data, char *image_buffer)
+{
+    lsb_store64(image_buffer, (lsb_load64(image_buffer) & ~LSB_LANE_LSBS) | lsb_spread8(data));
+}
+
+static inline unsigned char lsb_extract8(const char *image_buffer)
+{
+    return lsb_gather8(lsb_load64(image_buffer));
+}
+
+/*
+ * Kernel generators
+ * -----------------
+ * LSB_REPEAT_n unrolls a step n times with constant indices, so each
+ * generated kernel is straight line code with every shift folded.
+ */
+#define LSB_REPEAT_1(step, a) step(a, 0)
+#define LSB_REPEAT_4(step, a) step(a, 0) step(a, 1) step(a, 2) step(a, 3)
+
+/* Field of nbytes little endian bytes, byte k in carrier bytes [8k, 8k+8) */
+#define LSB_EMBED_FIELD_STEP(value, k) lsb_embed8((unsigned char)((uint)(value) >> (8 * (k))), image_buffer + 8 * (k));
+#define LSB_EXTRACT_FIELD_STEP(value, k) value |= (uint)lsb_extract8(image_buffer + 8 * (k)) << (8 * (k));
+
+#define LSB_DEFINE_FIELD_KERNELS(layout, field, type, nbytes)                  \
+    static void layout##_embed_##field(type value, char *image_buffer)         \
+    {                                                                          \
+        LSB_REPEAT_##nbytes(LSB_EMBED_FIELD_STEP, value)                       \
+    }                                                                          \
+    static type layout##_extract_##field(const char *image_buffer)             \
+    {                                                                          \
+        uint value = 0;                                                        \
+        LSB_REPEAT_##nbytes(LSB_EXTRACT_FIELD_STEP, value)                     \
+        return (type)value;                                                    \
+    }
+
+/* Payload blocks: 4 data bytes (one 32 carrier byte group) per iteration */
+#define LSB_DEFINE_BLOCK_KERNELS(layout)                                       \
+    static void layout##_embed_block(const char *data, size_t n, char *image_buffer) \
+    {                                                                          \
+        size_t i = 0;                                                          \
+        for (; i + 4 <= n; i += 4)                                             \
+        {                                                                      \
+            lsb_embed8(data[i], image_buffer + 8 * i);                         \
+            lsb_embed8(data[i + 1], image_buffer + 8 * i + 8);                 \
+            lsb_embed8(data[i + 2], image_buffer + 8 * i + 16);                \
+            lsb_embed8(data[i + 3], image_buffer + 8 * i + 24);                \
+        }                                                                      \
+        for (; i < n; i++)                                                     \
+            lsb_embed8(data[i], image_buffer + 8 * i);                         \
+    }                                                                          \
+    static void layout##_extract_block(char *data, size_t n, const char *image_buffer) \
+    {                                                                          \
+        size_t i = 0;                                                          \
+        for (; i + 4 <= n; i += 4)                                             \
+        {                                                                      \
+            data[i] = lsb_extract8(image_buffer + 8 * i);                      \
+            data[i + 1] = lsb_extract8(image_buffer + 8 * i + 8);              \
+            data[i + 2] = lsb_extract8(image_buffer + 8 * i + 16);             \
+            data[i + 3] = lsb_extract8(image_buffer + 8 * i + 24);             \
+        }                                                                      \
+        for (; i < n; i++)                                                     \
+            data[i] = lsb_extract8(image_buffer + 8 * i);                      \
+    }
+
+#define LSB_DEFINE_LAYOUT(layout)                                              \
+    LSB_DEFINE_FIELD_KERNELS(layout, byte, char, 1)                            \
+    LSB_DEFINE_FIELD_KERNELS(layout, size, int, 4)                             \
+    LSB_DEFINE_BLOCK_KERNELS(layout)
+
+/*
+ * Channel gather / scatter
+ * ------------------------
+ * A channel layout copies the selected channels of a run of pixels into
+ * contiguous "slot" bytes, runs the byte kernels on them and copies them
+ * back. With SSSE3, 16 pixels (48 bytes, 3 vectors) are moved per step
+ * by pshufb with control vectors built for every mask at startup; the
+ * scalar tail is generated per mask so its channel tests fold away.
+ */
+static int lsb_have_ssse3;
+
+#ifdef LSB_HAVE_X86
+/* [mask][slot vector k][pixel vector v] -> lanes of v feeding slot vector k */
+static unsigned char lsb_gather_ctrl[8][3][3][16] __attribute__((aligned(16)));
+/* [mask][pixel vector v][slot vector k] -> lanes of k landing in pixel vector v */
+static unsigned char lsb_scatter_ctrl[8][3][3][16] __attribute__((aligned(16)));
+/* [mask][pixel vector v] -> 0xFF for the bytes scatter leaves untouched */
+static unsigned char lsb_scatter_keep[8][3][16] __attribute__((aligned(16)));
+
+__attribute__((target("ssse3"))) static uint lsb_gather_ssse3(uint mask, const char *pixels, uint npixels, char *slots)
+{
+    uint nsel = channel_count(mask);
+    uint blocks = npixels / 16;
+
+    for (uint b = 0; b < blocks; b++, pixels += 48, slots += 16 * nsel)
+    {
+        __m128i in0 = _mm_loadu_si128((const __m128i *)pixels);
+        __m128i in1 = _mm_loadu_si128((const __m128i *)(pixels + 16));
+        __m128i in2 = _mm_loadu_si128((const __m128i *)(pixels + 32));
+        for (uint k = 0; k < nsel; k++)
+        {
+            __m128i out = _mm_or_si128(_mm_or_si128(
+                                           _mm_shuffle_epi8(in0, _mm_load_si128((const __m128i *)lsb_gather_ctrl[mask][k][0])),
+                                           _mm_shuffle_epi8(in1, _mm_load_si128((const __m128i *)lsb_gather_ctrl[mask][k][1]))),
+                                       _mm_shuffle_epi8(in2, _mm_load_si128((const __m128i *)lsb_gather_ctrl[mask][k][2])));
+            _mm_storeu_si128((__m128i *)(slots + 16 * k), out);
+        }
+    }
+    return blocks * 16;
+}
+
+__attribute__((target("ssse3"))) static uint lsb_scatter_ssse3(uint mask, char *pixels, uint npixels, const char *slots)
+{
+    uint nsel = channel_count(mask);
+    uint blocks = npixels / 16;
+
+    for (uint b = 0; b < blocks; b++, pixels += 48, slots += 16 * nsel)
+    {
+        __m128i in[3];
+        for (uint k = 0; k < nsel; k++)
+            in[k] = _mm_loadu_si128((const __m128i *)(slots + 16 * k));
+        for (uint v = 0; v < 3; v++)
+        {
+            __m128i out = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixels + 16 * v)),
+                                        _mm_load_si128((const __m128i *)lsb_scatter_keep[mask][v]));
+            for (uint k = 0; k < nsel; k++)
+                out = _mm_or_si128(out, _mm_shuffle_epi8(in[k], _mm_load_si128((const __m128i *)lsb_scatter_ctrl[mask][v][k])));
+            _mm_storeu_si128((__m128i *)(pixels + 16 * v), out);
+        }
+    }
+    return blocks * 16;
+}
+#endif
+
+static uint lsb_gather_fast(uint mask, const char *pixels, uint npixels, char *slots)
+{
+#ifdef LSB_HAVE_X86
+    if (lsb_have_ssse3)
+        return lsb_gather_ssse3(mask, pixels, npixels, slots);
+#endif
+    return 0;
+}
+
+static uint lsb_scatter_fast(uint mask, char *pixels, uint npixels, const char *slots)
+{
+#ifdef LSB_HAVE_X86
+    if (lsb_have_ssse3)
+        return lsb_scatter_ssse3(mask, pixels, npixels, slots);
+#endif
+    return 0;
+}
+
+#define LSB_DEFINE_CHANNEL_KERNELS(layout, mask)                               \
+    static void layout##_gather(const char *pixels, uint npixels, char *slots) \
+    {                                                                          \
+        uint i = lsb_gather_fast(mask, pixels, npixels, slots);                \
+        pixels += 3 * i;                                                       \
+        slots += channel_count(mask) * i;                                      \
+        for (; i < npixels; i++, pixels += 3)                                  \
+        {                                                                      \
+            if ((mask) & CHANNEL_B)                                            \
+                *slots++ = pixels[0];                                          \
+            if ((mask) & CHANNEL_G)                                            \
+                *slots++ = pixels[1];                                          \
+            if ((mask) & CHANNEL_R)                                            \
+                *slots++ = pixels[2];                                          \
+        }                                                                      \
+    }                                                                          \
+    static void layout##_scatter(char *pixels, uint npixels, const char *slots) \
+    {                                                                          \
+        uint i = lsb_scatter_fast(mask, pixels, npixels, slots);               \
+        pixels += 3 * i;                                                       \
+        slots += channel_count(mask) * i;                                      \
+        for (; i < npixels; i++, pixels += 3)                                  \
+        {                                                                      \
+            if ((mask) & CHANNEL_B)                                            \
+                pixels[0] = *slots++;                                          \
+            if ((mask) & CHANNEL_G)                                            \
+                pixels[1] = *slots++;                                          \
+            if ((mask) & CHANNEL_R)                                            \
+                pixels[2] = *slots++;                                          \
+        }                                                                      \
+    }
+
+#define LSB_KERNEL_ENTRY(layout)                                               \
+    {#layout, layout##_embed_byte, layout##_embed_size, layout##_extract_byte, \
+     layout##_extract_size, layout##_embed_block, layout##_extract_block, 0, NULL, NULL}
+
+/* Channel layouts run the byte kernels on the gathered slots */
+#define LSB_CHANNEL_ENTRY(layout, mask)                                        \
+    {#layout, bytes_embed_byte, bytes_embed_size, bytes_extract_byte,          \
+     bytes_extract_size, bytes_embed_block, bytes_extract_block, mask,         \
+     layout##_gather, layout##_scatter}
+
+/* Layout instantiations */
+LSB_DEFINE_LAYOUT(bytes)
+LSB_DEFINE_CHANNEL_KERNELS(b, CHANNEL_B)
+LSB_DEFINE_CHANNEL_KERNELS(g, CHANNEL_G)
+LSB_DEFINE_CHANNEL_KERNELS(bg, CHANNEL_B | CHANNEL_G)
+LSB_DEFINE_CHANNEL_KERNELS(r, CHANNEL_R)
+LSB_DEFINE_CHANNEL_KERNELS(br, CHANNEL_B | CHANNEL_R)
+LSB_DEFINE_CHANNEL_KERNELS(gr, CHANNEL_G | CHANNEL_R)
+LSB_DEFINE_CHANNEL_KERNELS(bgr, CHANNEL_ALL)
+
+const LsbKernels lsb_kernel_table[e_layout_max] = {
+    [e_layout_bytes] = LSB_KERNEL_ENTRY(bytes),
+    [e_layout_b] = LSB_CHANNEL_ENTRY(b, CHANNEL_B),
+    [e_layout_g] = LSB_CHANNEL_ENTRY(g, CHANNEL_G),
+    [e_layout_bg] = LSB_CHANNEL_ENTRY(bg, CHANNEL_B | CHANNEL_G),
+    [e_layout_r] = LSB_CHANNEL_ENTRY(r, CHANNEL_R),
+    [e_layout_br] = LSB_CHANNEL_ENTRY(br, CHANNEL_B | CHANNEL_R),
+    [e_layout_gr] = LSB_CHANNEL_ENTRY(gr, CHANNEL_G | CHANNEL_R),
+    [e_layout_bgr] = LSB_CHANNEL_ENTRY(bgr, CHANNEL_ALL),
+};
+
+/*
+ * Packed pixel formats
+ * --------------------
+ * 32 bit pixels are B G R A bytes, so the same gather / scatter works
+ * with a 4 byte stride and alpha as a fourth channel a mask may pick.
+ * With SSSE3 a step moves 16 pixels (4 vectors). 16 bit pixels hold
+ * 5-6-5 or 5-5-5 fields; a slot is the pixel shifted so the low bit of
+ * its field is bit 0, and scatter copies only that bit back.
+ */
+#ifdef LSB_HAVE_X86
+static unsigned char lsb_gather_ctrl32[16][4][4][16] __attribute__((aligned(16)));
+static unsigned char lsb_scatter_ctrl32[16][4][4][16] __attribute__((aligned(16)));
+static unsigned char lsb_scatter_keep32[16][4][16] __attribute__((aligned(16)));
+
+__attribute__((target("ssse3"))) static uint lsb_gather32_ssse3(uint mask, const char *pixels, uint npixels, char *slots)
+{
+    uint nsel = channel_count(mask);
+    uint blocks = npixels / 16;
+
+    for (uint b = 0; b < blocks; b++, pixels += 64, slots += 16 * nsel)
+    {
+        __m128i in[4];
+        for (uint v = 0; v < 4; v++)
+            in[v] = _mm_loadu_si128((const __m128i *)(pixels + 16 * v));
+        for (uint k = 0; k < nsel; k++)
+        {
+            __m128i out = _mm_setzero_si128();
+            for (uint v = 0; v < 4; v++)
+                out = _mm_or_si128(out, _mm_shuffle_epi8(in[v], _mm_load_si128((const __m128i *)lsb_gather_ctrl32[mask][k][v])));
+            _mm_storeu_si128((__m128i *)(slots + 16 * k), out);
+        }
+    }
+    return blocks * 16;
+}
+
+__attribute__((target("ssse3"))) static uint lsb_scatter32_ssse3(uint mask, char *pixels, uint npixels, const char *slots)
+{
+    uint nsel = channel_count(mask);
+    uint blocks = npixels / 16;
+
+    for (uint b = 0; b < blocks; b++, pixels += 64, slots += 16 * nsel)
+    {
+        __m128i in[4];
+        for (uint k = 0; k < nsel; k++)
+            in[k] = _mm_loadu_si128((const __m128i *)(slots + 16 * k));
+        for (uint v = 0; v < 4; v++)
+        {
+            __m128i out = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixels + 16 * v)),
+                                        _mm_load_si128((const __m128i *)lsb_scatter_keep32[mask][v]));
+            for (uint k = 0; k < nsel; k++)
+                out = _mm_or_si128(out, _mm_shuffle_epi8(in[k], _mm_load_si128((const __m128i *)lsb_scatter_ctrl32[mask][v][k])));
+            _mm_storeu_si128((__m128i *)(pixels + 16 * v), out);
+        }
+    }
+    return blocks * 16;
+}
+#endif
+
+static uint lsb_gather32_fast(uint mask, const char *pixels, uint npixels, char *slots)
+{
+#ifdef LSB_HAVE_X86
+    if (lsb_have_ssse3)
+        return lsb_gather32_ssse3(mask, pixels, npixels, slots);
+#endif
+    return 0;
+}
+
+static uint lsb_scatter32_fast(uint mask, char *pixels, uint npixels, const char *slots)
+{
+#ifdef LSB_HAVE_X86
+    if (lsb_have_ssse3)
+        return lsb_scatter32_ssse3(mask, pixels, npixels, slots);
+#endif
+    return 0;
+}
+
+#define LSB_DEFINE_BGRA32_KERNELS(layout, mask)                                \
+    static void layout##_gather(const char *pixels, uint npixels, char *slots) \
+    {                                                                          \
+        uint i = lsb_gather32_fast(mask, pixels, npixels, slots);              \
+        pixels += 4 * i;                                                       \
+        slots += channel_count(mask) * i;                                      \
+        for (; i < npixels; i++, pixels += 4)                                  \
+        {                                                                      \
+            if ((mask) & CHANNEL_B)                                            \
+                *slots++ = pixels[0];                                          \
+            if ((mask) & CHANNEL_G)                                            \
+                *slots++ = pixels[1];                                          \
+            if ((mask) & CHANNEL_R)                                            \
+                *slots++ = pixels[2];                                          \
+            if ((mask) & CHANNEL_A)                                            \
+                *slots++ = pixels[3];                                          \
+        }                                                                      \
+    }                                                                          \
+    static void layout##_scatter(char *pixels, uint npixels, const char *slots) \
+    {                                                                          \
+        uint i = lsb_scatter32_fast(mask, pixels, npixels, slots);             \
+        pixels += 4 * i;                                                       \
+        slots += channel_count(mask) * i;                                      \
+        for (; i < npixels; i++, pixels += 4)                                  \
+        {                                                                      \
+            if ((mask) & CHANNEL_B)                                            \
+                pixels[0] = *slots++;                                          \
+            if ((mask) & CHANNEL_G)                                            \
+                pixels[1] = *slots++;                                          \
+            if ((mask) & CHANNEL_R)                                            \
+                pixels[2] = *slots++;                                          \
+            if ((mask) & CHANNEL_A)                                            \
+                pixels[3] = *slots++;                                          \
+        }                                                                      \
+    }
+
+/* One channel of a 16 bit pixel: its field shifted down to bit 0, and back */
+#define LSB_PACKED16_GATHER(mask, ch, shift)                                   \
+    if ((mask) & (ch))                                                         \
+        *slots++ = (char)(pixel >> (shift));
+#define LSB_PACKED16_SCATTER(mask, ch, shift)                                  \
+    if ((mask) & (ch))                                                         \
+        pixel = (pixel & ~(1u << (shift))) | ((uint)(*slots++ & 1) << (shift));
+
+#define LSB_DEFINE_PACKED16_KERNELS(layout, mask, red_shift)                   \
+    static void layout##_gather(const char *pixels, uint npixels, char *slots) \
+    {                                                                          \
+        const unsigned char *p = (const unsigned char *)pixels;                \
+        for (uint i = 0; i < npixels; i++, p += 2)                             \
+        {                                                                      \
+            uint pixel = p[0] | (uint)p[1] << 8;                               \
+            LSB_PACKED16_GATHER(mask, CHANNEL_B, 0)                            \
+            LSB_PACKED16_GATHER(mask, CHANNEL_G, 5)                            \
+            LSB_PACKED16_GATHER(mask, CHANNEL_R, red_shift)                    \
+        }                                                                      \
+    }                                                                          \
+    static void layout##_scatter(char *pixels, uint npixels, const char *slots) \
+    {                                                                          \
+        unsigned char *p = (unsigned char *)pixels;                            \
+        for (uint i = 0; i < npixels; i++, p += 2)                             \
+        {                                                                      \
+            uint pixel = p[0] | (uint)p[1] << 8;                               \
+            LSB_PACKED16_SCATTER(mask, CHANNEL_B, 0)                           \
+            LSB_PACKED16_SCATTER(mask, CHANNEL_G, 5)                           \
+            LSB_PACKED16_SCATTER(mask, CHANNEL_R, red_shift)                   \
+            p[0] = (unsigned char)pixel;                                       \
+            p[1] = (unsigned char)(pixel >> 8);                                \
+        }                                                                      \
+    }
+
+/* Every channel mask of a format (alpha = CHANNEL_A or 0 is added to each) */
+#define LSB_FOR_EACH_MASK3(apply, prefix, alpha, ...)                          \
+    apply(prefix##_b, CHANNEL_B | (alpha), ##__VA_ARGS__)                      \
+    apply(prefix##_g, CHANNEL_G | (alpha), ##__VA_ARGS__)                      \
+    apply(prefix##_bg, CHANNEL_B | CHANNEL_G | (alpha), ##__VA_ARGS__)         \
+    apply(prefix##_r, CHANNEL_R | (alpha), ##__VA_ARGS__)                      \
+    apply(prefix##_br, CHANNEL_B | CHANNEL_R | (alpha), ##__VA_ARGS__)         \
+    apply(prefix##_gr, CHANNEL_G | CHANNEL_R | (alpha), ##__VA_ARGS__)         \
+    apply(prefix##_bgr, CHANNEL_ALL | (alpha), ##__VA_ARGS__)
+#define LSB_FOR_EACH_MASK4(apply, prefix)                                      \
+    LSB_FOR_EACH_MASK3(apply, prefix, 0)                                       \
+    apply(prefix##_a, CHANNEL_A)                                               \
+    LSB_FOR_EACH_MASK3(apply, prefix##_a, CHANNEL_A)
+
+#define LSB_PACKED_ENTRY(layout, mask, ...) [mask] = LSB_CHANNEL_ENTRY(layout, mask),
+
+LSB_FOR_EACH_MASK4(LSB_DEFINE_BGRA32_KERNELS, bgra32)
+LSB_FOR_EACH_MASK3(LSB_DEFINE_PACKED16_KERNELS, rgb565, 0, 11)
+LSB_FOR_EACH_MASK3(LSB_DEFINE_PACKED16_KERNELS, rgb555, 0, 10)
+
+static const LsbKernels lsb_bgra32_table[16] = {LSB_FOR_EACH_MASK4(LSB_PACKED_ENTRY, bgra32)};
+static const LsbKernels lsb_rgb565_table[8] = {LSB_FOR_EACH_MASK3(LSB_PACKED_ENTRY, rgb565, 0)};
+static const LsbKernels lsb_rgb555_table[8] = {LSB_FOR_EACH_MASK3(LSB_PACKED_ENTRY, rgb555, 0)};
+
+/*
+ * PNM samples
+ * -----------
+ * 8 bit P6 samples are R G B, the 24 bit kernels run on them with the
+ * B and R bits of the mask swapped; a P5 sample is one byte, its single
+ * channel (G) is a plain copy. 16 bit samples are big endian, so a slot
+ * is the second byte of a sample. With SSE2 a step moves 16 samples:
+ * gather shifts every 16 bit lane down and packs, scatter keeps the high
+ * bytes and interleaves the slots back in.
+ */
+static uint lsb_gather16_fast(const char *samples, uint nsamples, char *slots)
+{
+    uint i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= nsamples; i += 16, samples += 32, slots += 16)
+    {
+        __m128i lo = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)samples), 8);
+        __m128i hi = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(samples + 16)), 8);
+        _mm_storeu_si128((__m128i *)slots, _mm_packus_epi16(lo, hi));
+    }
+#else
+    (void)samples;
+    (void)slots;
+#endif
+    return i;
+}
+
+static uint lsb_scatter16_fast(char *samples, uint nsamples, const char *slots)
+{
+    uint i = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i keep = _mm_set1_epi16(0x00FF);
+    for (; i + 16 <= nsamples; i += 16, samples += 32, slots += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)slots);
+        __m128i lo = _mm_and_si128(_mm_loadu_si128((const __m128i *)samples), keep);
+        __m128i hi = _mm_and_si128(_mm_loadu_si128((const __m128i *)(samples + 16)), keep);
+        _mm_storeu_si128((__m128i *)samples, _mm_or_si128(lo, _mm_unpacklo_epi8(zero, in)));
+        _mm_storeu_si128((__m128i *)(samples + 16), _mm_or_si128(hi, _mm_unpackhi_epi8(zero, in)));
+    }
+#else
+    (void)samples;
+    (void)slots;
+#endif
+    return i;
+}
+
+/* Low byte of one 16 bit sample: R G B in memory order, a gray sample is G */
+#define LSB_SAMPLE16_GATHER(mask, ch, sample)                                  \
+    if ((mask) & (ch))                                                         \
+        *slots++ = pixels[2 * (sample) + 1];
+#define LSB_SAMPLE16_SCATTER(mask, ch, sample)                                 \
+    if ((mask) & (ch))                                                         \
+        pixels[2 * (sample) + 1] = *slots++;
+
+#define LSB_DEFINE_SAMPLE16_KERNELS(layout, mask, nsamples)                    \
+    static void layout##_gather(const char *pixels, uint npixels, char *slots) \
+    {                                                                          \
+        uint i = 0;                                                            \
+        if (channel_count(mask) == (nsamples))                                 \
+        {                                                                      \
+            i = npixels / 16 * 16;                                             \
+            lsb_gather16_fast(pixels, i * (nsamples), slots);                  \
+            pixels += 2 * (nsamples) * i;                                      \
+            slots += (nsamples) * i;                                           \
+        }                                                                      \
+        for (; i < npixels; i++, pixels += 2 * (nsamples))                     \
+        {                                                                      \
+            if ((nsamples) == 1)                                               \
+            {                                                                  \
+                LSB_SAMPLE16_GATHER(mask, CHANNEL_G, 0)                        \
+                continue;                                                      \
+            }                                                                  \
+            LSB_SAMPLE16_GATHER(mask, CHANNEL_R, 0)                            \
+            LSB_SAMPLE16_GATHER(mask, CHANNEL_G, 1)                            \
+            LSB_SAMPLE16_GATHER(mask, CHANNEL_B, 2)                            \
+        }                                                                      \
+    }                                                                          \
+    static void layout##_scatter(char *pixels, uint npixels, const char *slots) \
+    {                                                                          \
+        uint i = 0;                                                            \
+        if (channel_count(mask) == (nsamples))                                 \
+        {                                                                      \
+            i = npixels / 16 * 16;                                             \
+            lsb_scatter16_fast(pixels, i * (nsamples), slots);                 \
+            pixels += 2 * (nsamples) * i;                                      \
+            slots += (nsamples) * i;                                           \
+        }                                                                      \
+        for (; i < npixels; i++, pixels += 2 * (nsamples))                     \
+        {                                                                      \
+            if ((nsamples) == 1)                                               \
+            {                                                                  \
+                LSB_SAMPLE16_SCATTER(mask, CHANNEL_G, 0)                       \
+                continue;                                                      \
+            }                                                                  \
+            LSB_SAMPLE16_SCATTER(mask, CHANNEL_R, 0)                           \
+            LSB_SAMPLE16_SCATTER(mask, CHANNEL_G, 1)                           \
+            LSB_SAMPLE16_SCATTER(mask, CHANNEL_B, 2)                           \
+        }                                                                      \
+    }
+
+static void gray8_gather(const char *pixels, uint npixels, char *slots)
+{
+    memcpy(slots, pixels, npixels);
+}
+
+static void gray8_scatter(char *pixels, uint npixels, const char *slots)
+{
+    memcpy(pixels, slots, npixels);
+}
+
+LSB_FOR_EACH_MASK3(LSB_DEFINE_SAMPLE16_KERNELS, rgb48, 0, 3)
+LSB_DEFINE_SAMPLE16_KERNELS(gray16, CHANNEL_G, 1)
+
+static const LsbKernels lsb_rgb48_table[8] = {LSB_FOR_EACH_MASK3(LSB_PACKED_ENTRY, rgb48, 0)};
+static const LsbKernels lsb_gray8_kernels = LSB_CHANNEL_ENTRY(gray8, CHANNEL_G);
+static const LsbKernels lsb_gray16_kernels = LSB_CHANNEL_ENTRY(gray16, CHANNEL_G);
+
+/* B and R trade places: P6 stores R G B where a bmp stores B G R */
+static uint lsb_swap_red_blue(uint channel_mask)
+{
+    return (channel_mask & CHANNEL_G) | (channel_mask & CHANNEL_B ? CHANNEL_R : 0) | (channel_mask & CHANNEL_R ? CHANNEL_B : 0);
+}
+
+/*
+ * Matrix embedding
+ * ----------------
+ * The syndrome of a block is the XOR of the 1 based positions of its
+ * set LSBs. The LSBs are collected into a bit mask (16 bytes per
+ * movemask with SSE2, 8 per SWAR gather otherwise), so syndrome bit b is
+ * the parity of the mask under the positions that have bit b set.
+ */
+static const uint64_t lsb_matrix_positions[LSB_MATRIX_MAX_K] = {
+    0x5555555555555555ULL, 0x6666666666666666ULL, 0x7878787878787878ULL,
+    0x7F807F807F807F80ULL, 0x7FFF80007FFF8000ULL, 0x7FFFFFFF80000000ULL,
+};
+
+static inline uint64_t lsb_block_mask(const char *block, uint n)
+{
+    uint64_t mask = 0;
+    uint i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16)
+    {
+        // shifting by 7 moves every LSB into its byte's sign bit
+        __m128i v = _mm_slli_epi64(_mm_loadu_si128((const __m128i *)(block + i)), 7);
+        mask |= (uint64_t)(uint)_mm_movemask_epi8(v) << i;
+    }
+#endif
+    for (; i + 8 <= n; i += 8)
+        mask |= (uint64_t)lsb_gather8(lsb_load64(block + i)) << i;
+    for (; i < n; i++)
+        mask |= (uint64_t)(block[i] & 1) << i;
+    return mask;
+}
+
+static inline uint lsb_block_syndrome(const char *block, uint n, uint k)
+{
+    uint64_t mask = lsb_block_mask(block, n);
+    uint syndrome = 0;
+    for (uint b = 0; b < k; b++)
+        syndrome |= (uint)__builtin_parityll(mask & lsb_matrix_positions[b]) << b;
+    return syndrome;
+}
+
+size_t lsb_matrix_carrier_size(size_t n, uint k)
+{
+    return (n + k - 1) / k * 8 * ((1u << k) - 1);
+}
+
+size_t lsb_matrix_embed(const char *data, size_t n, uint k, char *carrier)
+{
+    uint block_size = (1u << k) - 1;
+    size_t changed = 0;
+
+    for (size_t i = 0; i + k <= n; i += k)
+    {
+        // k bytes, most significant first, give 8 messages of k bits
+        uint64_t bits = 0;
+        for (uint j = 0; j < k; j++)
+            bits = bits << 8 | (unsigned char)data[i + j];
+        for (int blk = 7; blk >= 0; blk--, carrier += block_size)
+        {
+            uint message = (uint)(bits >> (blk * k)) & block_size;
+            uint flip = lsb_block_syndrome(carrier, block_size, k) ^ message;
+            if (flip != 0)
+            {
+                carrier[flip - 1] ^= 1;
+                changed++;
+            }
+        }
+    }
+    return changed;
+}
+
+void lsb_matrix_extract(char *data, size_t n, uint k, const char *carrier)
+{
+    uint block_size = (1u << k) - 1;
+
+    for (size_t i = 0; i + k <= n; i += k)
+    {
+        uint64_t bits = 0;
+        for (int blk = 7; blk >= 0; blk--, carrier += block_size)
+            bits = bits << k | lsb_block_syndrome(carrier, block_size, k);
+        for (int j = k - 1; j >= 0; j--, bits >>= 8)
+            data[i + j] = (char)bits;
+    }
+}
+
+const LsbKernels *lsb_select_kernels(LsbLayout layout)
+{
+    if (layout < 0 || layout >= e_layout_max)
+    {
+        return NULL;
+    }
+    return &lsb_kernel_table[layout];
+}
+
+const LsbKernels *lsb_select_pixel_kernels(PixelFormat format, uint channel_mask)
+{
+    switch (format)
+    {
+    case e_pixel_bgr24:
+        return channel_mask <= CHANNEL_ALL ? lsb_select_kernels(channel_mask) : NULL;
+    case e_pixel_bgra32:
+        return channel_mask != 0 && channel_mask <= (CHANNEL_ALL | CHANNEL_A) ? &lsb_bgra32_table[channel_mask] : NULL;
+    case e_pixel_rgb565:
+        return channel_mask != 0 && channel_mask <= CHANNEL_ALL ? &lsb_rgb565_table[channel_mask] : NULL;
+    case e_pixel_rgb555:
+        return channel_mask != 0 && channel_mask <= CHANNEL_ALL ? &lsb_rgb555_table[channel_mask] : NULL;
+    case e_pixel_rgb24:
+        return channel_mask <= CHANNEL_ALL ? lsb_select_kernels(lsb_swap_red_blue(channel_mask)) : NULL;
+    case e_pixel_gray8:
+        return channel_mask == 0 ? lsb_select_kernels(e_layout_bytes) : channel_mask == CHANNEL_G ? &lsb_gray8_kernels : NULL;
+    case e_pixel_rgb48:
+        return channel_mask != 0 && channel_mask <= CHANNEL_ALL ? &lsb_rgb48_table[channel_mask] : NULL;
+    case e_pixel_gray16:
+        return channel_mask == CHANNEL_G ? &lsb_gray16_kernels : NULL;
+    }
+    return NULL;
+}
+
+void lsb_init_kernels(void)
+{
+#ifdef LSB_HAVE_X86
+    /*
+     * Slot j of a 16 pixel block is pixel j / nsel, channel sel[j % nsel],
+     * i.e. block byte s = 3 * pixel + channel. Gather pulls lane s % 16 of
+     * pixel vector s / 16 into lane j % 16 of slot vector j / 16; scatter
+     * is the same mapping reversed. 0x80 makes pshufb produce zero.
+     */
+    memset(lsb_gather_ctrl, 0x80, sizeof(lsb_gather_ctrl));
+    memset(lsb_scatter_ctrl, 0x80, sizeof(lsb_scatter_ctrl));
+    memset(lsb_scatter_keep, 0xFF, sizeof(lsb_scatter_keep));
+
+    for (uint mask = 1; mask <= CHANNEL_ALL; mask++)
+    {
+        uint sel[3], nsel = 0;
+        for (uint ch = 0; ch < 3; ch++)
+        {
+            if (mask & (1u << ch))
+                sel[nsel++] = ch;
+        }
+        for (uint j = 0; j < 16 * nsel; j++)
+        {
+            uint s = 3 * (j / nsel) + sel[j % nsel];
+            lsb_gather_ctrl[mask][j / 16][s / 16][j % 16] = s % 16;
+            lsb_scatter_ctrl[mask][s / 16][j / 16][s % 16] = j % 16;
+            lsb_scatter_keep[mask][s / 16][s % 16] = 0x00;
+        }
+    }
+
+    // Same for 32 bit pixels: byte s = 4 * pixel + channel, alpha included
+    memset(lsb_gather_ctrl32, 0x80, sizeof(lsb_gather_ctrl32));
+    memset(lsb_scatter_ctrl32, 0x80, sizeof(lsb_scatter_ctrl32));
+    memset(lsb_scatter_keep32, 0xFF, sizeof(lsb_scatter_keep32));
+
+    for (uint mask = 1; mask <= (CHANNEL_ALL | CHANNEL_A); mask++)
+    {
+        uint sel[4], nsel = 0;
+        for (uint ch = 0; ch < 4; ch++)
+        {
+            if (mask & (1u << ch))
+                sel[nsel++] = ch;
+        }
+        for (uint j = 0; j < 16 * nsel; j++)
+        {
+            uint s = 4 * (j / nsel) + sel[j % nsel];
+            lsb_gather_ctrl32[mask][j / 16][s / 16][j % 16] = s % 16;
+            lsb_scatter_ctrl32[mask][s / 16][j / 16][s % 16] = j % 16;
+            lsb_scatter_keep32[mask][s / 16][s % 16] = 0x00;
+        }
+    }
+
+    __builtin_cpu_init();
+    lsb_have_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+}
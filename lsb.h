@@ -0,0 +1,88 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h>
+
+#include "types.h" // Contains user defined types
+#include "image.h" // Pixel formats
+
+/*
+ * Embed / extract kernels
+ * -----------------------
+ * Every kernel is generated at compile time from the macros in lsb.c for
+ * one carrier layout, with the bit loops unrolled into branch free SWAR
+ * (8 carrier bytes handled as one 64 bit word). A job picks its kernel
+ * set once from lsb_kernel_table and then calls straight through it.
+ */
+
+typedef struct _LsbKernels
+{
+    const char *name; // Layout name, for messages
+
+    /* Header fields: one byte (8 carrier bytes) or one size (32 carrier bytes) */
+    void (*embed_byte)(char data, char *image_buffer);
+    void (*embed_size)(int size, char *image_buffer);
+    char (*extract_byte)(const char *image_buffer);
+    int (*extract_size)(const char *image_buffer);
+
+    /* Payload: n data bytes into / out of n * 8 carrier bytes */
+    void (*embed_block)(const char *data, size_t n, char *image_buffer);
+    void (*extract_block)(char *data, size_t n, const char *image_buffer);
+
+    /* Channel selective layouts: pixels <-> contiguous bytes of the selected channels */
+    uint channel_mask; // Channels of the layout (0 = every byte, no gather / scatter)
+    void (*gather)(const char *pixels, uint npixels, char *slots);
+    void (*scatter)(char *pixels, uint npixels, const char *slots);
+} LsbKernels;
+
+/* Carrier layouts that have a kernel set, channel layouts are indexed by their mask */
+typedef enum
+{
+    e_layout_bytes, // 1 bit in the LSB of every carrier byte
+    e_layout_b,     // Blue only
+    e_layout_g,     // Green only
+    e_layout_bg,    // Blue + green
+    e_layout_r,     // Red only
+    e_layout_br,    // Blue + red
+    e_layout_gr,    // Green + red
+    e_layout_bgr,   // Every channel, row padding skipped
+    e_layout_max
+} LsbLayout;
+
+/* One kernel set per layout */
+extern const LsbKernels lsb_kernel_table[e_layout_max];
+
+/* Pick the kernel set of a layout */
+const LsbKernels *lsb_select_kernels(LsbLayout layout);
+
+/*
+ * Pick the kernel set of a pixel format and channel mask: the table
+ * above for 24 bit and 8 bit P6 / P5, a gather / scatter pair per mask
+ * for 32 bit (alpha allowed), 16 bit and 16 bit P6 / P5 samples (never
+ * every byte). NULL when the mask does not fit.
+ */
+const LsbKernels *lsb_select_pixel_kernels(PixelFormat format, uint channel_mask);
+
+/*
+ * Matrix embedding (--matrix k)
+ * -----------------------------
+ * Hamming syndrome coding: k data bits go into a block of 2^k - 1 carrier
+ * bytes and at most one LSB of the block is flipped. k data bytes are 8
+ * blocks, so the calls work on whole groups of k bytes.
+ */
+#define LSB_MATRIX_MIN_K 2
+#define LSB_MATRIX_MAX_K 6 // Block LSBs fit one 64 bit mask
+
+/* Carrier bytes used by n data bytes (rounded up to whole groups) */
+size_t lsb_matrix_carrier_size(size_t n, uint k);
+
+/* Embed n data bytes, returns the number of carrier bytes changed */
+size_t lsb_matrix_embed(const char *data, size_t n, uint k, char *carrier);
+
+/* Extract n data bytes */
+void lsb_matrix_extract(char *data, size_t n, uint k, const char *carrier);
+
+/* Detect CPU features and build the shuffle tables, call once at startup */
+void lsb_init_kernels(void);
+
+#endif
@@ -0,0 +1,298 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "lsbindex.h"
+#include "lsb.h"
+#include "image.h"
+#include "outcache.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Pixel bytes packed per step while building (a multiple of 8) */
+#define LSBINDEX_CHUNK (1 << 23)
+
+static const char lsbindex_magic[4] = {'L', 'S', 'B', 'I'};
+
+static Status sidecar_path(char *path, size_t size, const char *image_fname)
+{
+    return snprintf(path, size, "%s%s", image_fname, LSBINDEX_SUFFIX) < (int)size ? e_success : e_failure;
+}
+
+/* Key of an image: its header up to the pixels, its size, its mtime and its ctime */
+static Status image_key(int fd, const ImageGeometry *geometry, const struct stat *st, unsigned long long *key)
+{
+    char header[BMP_HEADER_MAX];
+    OutcacheHash hash;
+
+    if (pread(fd, header, geometry->data_offset, 0) != (ssize_t)geometry->data_offset)
+    {
+        return e_failure;
+    }
+    long long stamp[5] = {(long long)st->st_size, (long long)st->st_mtim.tv_sec, (long long)st->st_mtim.tv_nsec, (long long)st->st_ctim.tv_sec, (long long)st->st_ctim.tv_nsec};
+    outcache_hash_init(&hash, LSBINDEX_VERSION);
+    outcache_hash_update(&hash, header, geometry->data_offset);
+    outcache_hash_update(&hash, stamp, sizeof(stamp));
+    *key = outcache_hash_final(&hash);
+    return e_success;
+}
+
+static Status read_full(int fd, char *buffer, size_t n, off_t offset)
+{
+    for (size_t done = 0; done < n;)
+    {
+        ssize_t got = pread(fd, buffer + done, n - done, offset + done);
+        if (got <= 0)
+            return e_failure;
+        done += (size_t)got;
+    }
+    return e_success;
+}
+
+static Status write_full(int fd, const void *buffer, size_t n)
+{
+    for (size_t done = 0; done < n;)
+    {
+        ssize_t put = write(fd, (const char *)buffer + done, n - done);
+        if (put <= 0)
+            return e_failure;
+        done += (size_t)put;
+    }
+    return e_success;
+}
+
+static size_t plane_blocks(unsigned long long bits)
+{
+    return (size_t)(((bits + 7) / 8 + LSBINDEX_BLOCK - 1) / LSBINDEX_BLOCK);
+}
+
+/* Hash of one block of the plane, seeded with its number so blocks cannot trade places */
+static unsigned long long block_hash(const void *data, size_t n, size_t block)
+{
+    OutcacheHash hash;
+    outcache_hash_init(&hash, block);
+    outcache_hash_update(&hash, data, n);
+    return outcache_hash_final(&hash);
+}
+
+static unsigned long long table_hash(const unsigned long long *table, size_t blocks)
+{
+    OutcacheHash hash;
+    outcache_hash_init(&hash, LSBINDEX_VERSION);
+    outcache_hash_update(&hash, table, blocks * sizeof(*table));
+    return outcache_hash_final(&hash);
+}
+
+/* Pack the LSBs of the pixel bytes chunk by chunk behind the header and the block table, hashing the pixels and every block on the way */
+static Status write_plane(int fd, int out_fd, LsbIndexHeader *header, uint data_offset)
+{
+    size_t blocks = plane_blocks(header->bits);
+    char *pixels = malloc(LSBINDEX_CHUNK);
+    char *plane = malloc(LSBINDEX_CHUNK / 8);
+    unsigned long long *table = calloc(blocks ? blocks : 1, sizeof(*table));
+    OutcacheHash pixel_hash;
+    Status status = pixels != NULL && plane != NULL && table != NULL && write_full(out_fd, header, sizeof(*header)) == e_success ? write_full(out_fd, table, blocks * sizeof(*table)) : e_failure;
+
+    outcache_hash_init(&pixel_hash, LSBINDEX_VERSION);
+    for (size_t done = 0, n; status == e_success && done < header->bits; done += n)
+    {
+        n = header->bits - done < LSBINDEX_CHUNK ? header->bits - done : LSBINDEX_CHUNK;
+        // the last plane byte is zero padded
+        size_t bytes = (n + 7) / 8;
+        status = read_full(fd, pixels, n, (off_t)data_offset + done);
+        outcache_hash_update(&pixel_hash, pixels, n);
+        memset(pixels + n, 0, bytes * 8 - n);
+        lsb_kernel_table[e_layout_bytes].extract_block(plane, bytes, pixels);
+        // a chunk holds whole blocks, only the last one of the plane is short
+        for (size_t start = 0; start < bytes; start += LSBINDEX_BLOCK)
+        {
+            size_t block = (done / 8 + start) / LSBINDEX_BLOCK;
+            table[block] = block_hash(plane + start, bytes - start < LSBINDEX_BLOCK ? bytes - start : LSBINDEX_BLOCK, block);
+        }
+        if (status == e_success)
+            status = write_full(out_fd, plane, bytes);
+    }
+    // the header and the table went out first, they are filled in at the end
+    header->pixel_hash = outcache_hash_final(&pixel_hash);
+    header->table_hash = table != NULL ? table_hash(table, blocks) : 0;
+    if (status == e_success && (pwrite(out_fd, table, blocks * sizeof(*table), sizeof(*header)) != (ssize_t)(blocks * sizeof(*table)) ||
+                                pwrite(out_fd, header, sizeof(*header), 0) != (ssize_t)sizeof(*header)))
+        status = e_failure;
+    free(pixels);
+    free(plane);
+    free(table);
+    return status;
+}
+
+/* Header of the current sidecar of an image, e_failure when there is none */
+static Status read_sidecar_header(const char *path, LsbIndexHeader *header)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return e_failure;
+    Status status = pread(fd, header, sizeof(*header), 0) == (ssize_t)sizeof(*header) && !memcmp(header->magic, lsbindex_magic, sizeof(header->magic)) &&
+                            header->version == LSBINDEX_VERSION
+                        ? e_success
+                        : e_failure;
+    close(fd);
+    return status;
+}
+
+Status lsbindex_build(const char *image_fname)
+{
+    ImageGeometry geometry;
+    LsbIndexHeader header, old;
+    struct stat st;
+    char path[4096], tmp[4096];
+
+    memset(&header, 0, sizeof(header));
+    if (sidecar_path(path, sizeof(path), image_fname) == e_failure || snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+    {
+        printf("Error: '%s' is too long a name for an index\n", image_fname);
+        return e_failure;
+    }
+
+    FILE *fptr = fopen(image_fname, "rb");
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "Error: unable to open '%s'\n", image_fname);
+        return e_failure;
+    }
+    int fd = fileno(fptr);
+    if (read_image_geometry(fptr, &geometry) == e_failure || fstat(fd, &st) < 0 || st.st_size < geometry.data_offset ||
+        image_key(fd, &geometry, &st, &header.key) == e_failure)
+    {
+        printf("Error: '%s' is not a supported image\n", image_fname);
+        fclose(fptr);
+        return e_failure;
+    }
+    // 5-6-5 / 5-5-5 fields keep their low bits inside the bytes, not in the plane
+    if (geometry.format == e_pixel_rgb565 || geometry.format == e_pixel_rgb555)
+    {
+        printf("Error: 16 bit images cannot be indexed, their payload is not in the byte LSBs\n");
+        fclose(fptr);
+        return e_failure;
+    }
+    memcpy(header.magic, lsbindex_magic, sizeof(header.magic));
+    header.version = LSBINDEX_VERSION;
+    header.bits = (unsigned long long)st.st_size - geometry.data_offset;
+
+    // written under a temporary name so a decoder never maps a partial index
+    int out_fd = mkostemp(tmp, O_CLOEXEC);
+    Status status = e_failure;
+    if (out_fd >= 0)
+    {
+        fchmod(out_fd, 0644);
+        status = write_plane(fd, out_fd, &header, geometry.data_offset);
+        // an index the decoder still took for current, while the pixels had changed under it
+        if (status == e_success && read_sidecar_header(path, &old) == e_success && old.key == header.key && old.bits == header.bits && old.pixel_hash != header.pixel_hash)
+        {
+            printf("⚠️  The pixels of %s changed since the last -I without a new size / mtime / ctime, the old index was stale\n", image_fname);
+        }
+        if (close(out_fd) < 0 || status == e_failure || rename(tmp, path) < 0)
+        {
+            unlink(tmp);
+            status = e_failure;
+        }
+    }
+    else
+    {
+        perror(tmp);
+    }
+    fclose(fptr);
+
+    if (status == e_success)
+        printf("🗂️  LSB index written: %s (%llu bytes for %llu pixel bytes)\n", path, (header.bits + 7) / 8, header.bits);
+    return status;
+}
+
+Status lsbindex_open(const char *image_fname, FILE *fptr_image, LsbIndex *index)
+{
+    ImageGeometry geometry;
+    LsbIndexHeader header;
+    struct stat st, index_st;
+    unsigned long long key;
+    char path[4096];
+
+    memset(index, 0, sizeof(*index));
+    int fd = sidecar_path(path, sizeof(path), image_fname) == e_success ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd < 0)
+    {
+        // no index, decode from the image
+        return e_failure;
+    }
+
+    Status status = e_failure;
+    if (fstat(fd, &index_st) == 0 && pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        !memcmp(header.magic, lsbindex_magic, sizeof(header.magic)) && header.version == LSBINDEX_VERSION &&
+        read_image_geometry(fptr_image, &geometry) == e_success && geometry.format != e_pixel_rgb565 && geometry.format != e_pixel_rgb555 && fstat(fileno(fptr_image), &st) == 0 &&
+        image_key(fileno(fptr_image), &geometry, &st, &key) == e_success)
+    {
+        if (key != header.key || header.bits != (unsigned long long)st.st_size - geometry.data_offset ||
+            (unsigned long long)index_st.st_size != sizeof(header) + plane_blocks(header.bits) * sizeof(unsigned long long) + (header.bits + 7) / 8)
+        {
+            printf("⚠️  %s does not match the image any more, decoding from the image (run -I again)\n", path);
+        }
+        else
+        {
+            size_t blocks = plane_blocks(header.bits);
+            void *map = mmap(NULL, (size_t)index_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            const unsigned long long *table = map != MAP_FAILED ? (const unsigned long long *)((const char *)map + sizeof(header)) : NULL;
+            // only the small table is checked here, the plane block by block as the decode reaches it
+            if (table != NULL && table_hash(table, blocks) != header.table_hash)
+            {
+                printf("⚠️  %s is damaged, decoding from the image (run -I again)\n", path);
+                munmap(map, (size_t)index_st.st_size);
+            }
+            else if (table != NULL && (index->checked = calloc(blocks ? blocks : 1, 1)) == NULL)
+            {
+                munmap(map, (size_t)index_st.st_size);
+            }
+            else if (table != NULL)
+            {
+                index->map_base = map;
+                index->map_size = (size_t)index_st.st_size;
+                index->block_hash = table;
+                index->plane = (const unsigned char *)(table + blocks);
+                index->bits = (size_t)header.bits;
+                status = e_success;
+            }
+        }
+    }
+    close(fd);
+    return status;
+}
+
+Status lsbindex_check(LsbIndex *index, size_t first, size_t last)
+{
+    size_t plane_bytes = (index->bits + 7) / 8;
+    if (last > plane_bytes)
+        last = plane_bytes;
+    for (size_t block = first / LSBINDEX_BLOCK; block * LSBINDEX_BLOCK < last; block++)
+    {
+        if (index->checked[block])
+            continue;
+        size_t start = block * LSBINDEX_BLOCK;
+        size_t n = plane_bytes - start < LSBINDEX_BLOCK ? plane_bytes - start : LSBINDEX_BLOCK;
+        // a damaged plane would decode to garbage without an error
+        if (block_hash(index->plane + start, n, block) != index->block_hash[block])
+        {
+            printf("⚠️  The LSB index is damaged at plane byte %zu, run -I again\n", start);
+            return e_failure;
+        }
+        index->checked[block] = 1;
+    }
+    return e_success;
+}
+
+void lsbindex_close(LsbIndex *index)
+{
+    if (index->map_base != NULL)
+        munmap(index->map_base, index->map_size);
+    free(index->checked);
+    memset(index, 0, sizeof(*index));
+}
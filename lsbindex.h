@@ -0,0 +1,64 @@
+#ifndef LSBINDEX_H
+#define LSBINDEX_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "types.h" // Contains user defined types
+
+/*
+ * LSB plane index (-I)
+ * --------------------
+ * A sidecar <image>.lsbi next to a stego image holds the LSB of every
+ * pixel byte, 8 per byte in the order of the plain byte layout: a byte
+ * embedded in that layout is one byte of the plane, and any other layout
+ * is unpacked from 1/8 of the pixel data. Later decodes map the plane
+ * instead of the image. The index is keyed by a hash of the image
+ * header, the size, the mtime and the ctime of the image: rewriting the
+ * pixels in place moves the ctime even when the mtime is put back, so
+ * such an index is not used. The sidecar also holds a hash of the pixel
+ * data, checked when -I runs again, and a hash of every block of the
+ * plane, checked the first time a decode reads from that block, so a
+ * small decode only reads the blocks it uses. 16 bit images hide their
+ * bits inside packed fields and are not indexed.
+ */
+
+#define LSBINDEX_SUFFIX ".lsbi" // Appended to the image name
+#define LSBINDEX_VERSION 3      // Bump when the plane layout changes
+#define LSBINDEX_BLOCK (1 << 16) // Plane bytes per checked block
+
+/* Header of the sidecar, the block hashes and then the plane follow it */
+typedef struct _LsbIndexHeader
+{
+    char magic[4];               // To store "LSBI"
+    uint version;                // To store LSBINDEX_VERSION
+    unsigned long long key;      // To store the hash of the image header, size, mtime and ctime
+    unsigned long long bits;     // To store the pixel bytes covered (one bit each)
+    unsigned long long pixel_hash; // To store the hash of the pixel bytes the plane was taken from
+    unsigned long long table_hash; // To store the hash of the table of block hashes
+} LsbIndexHeader;
+
+/* A mapped index */
+typedef struct _LsbIndex
+{
+    void *map_base;              // To store the mmap'ed sidecar (NULL = no index)
+    size_t map_size;             // To store the length of the mapping
+    const unsigned char *plane;  // To store the packed LSBs (after the header and the block hashes)
+    size_t bits;                 // To store the pixel bytes the plane covers
+    const unsigned long long *block_hash; // To store the hash of every LSBINDEX_BLOCK of the plane
+    unsigned char *checked;      // To store 1 for every block already checked
+} LsbIndex;
+
+/* Extract the LSB plane of image_fname into its sidecar (replacing an old one) */
+Status lsbindex_build(const char *image_fname);
+
+/* Map the sidecar of an open image, e_failure when there is none or it is stale */
+Status lsbindex_open(const char *image_fname, FILE *fptr_image, LsbIndex *index);
+
+/* Check the plane bytes [first, last) before they are used, e_failure when a block is damaged */
+Status lsbindex_check(LsbIndex *index, size_t first, size_t last);
+
+/* Unmap an index opened by lsbindex_open */
+void lsbindex_close(LsbIndex *index);
+
+#endif
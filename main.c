@@ -2,7 +2,19 @@
 #include "encode.h"
 #include "types.h"
 #include "decode.h"
+#include "serve.h"
+#include "lsb.h"
+#include "progress.h"
+#include "quality.h"
+#include "ecc.h"
+#include "chacha.h"
+#include "sha256.h"
+#include "archive.h"
+#include "watch.h"
+#include "lsbindex.h"
+#include "analysis.h"
 #include <string.h>
+#include <stdlib.h>
 
 /*
  
@@ -75,13 +87,49 @@ int main(int argc, char *argv[])
     /*
      * Simple CLI entry point for the steganography tool.
      * Usage examples:
-     *  - Encoding: a.out -e <source.bmp> <secret.txt> [output.bmp]
-     *  - Decoding: a.out -d <stego.bmp> [output_secret_base]
+     *  - Encoding: a.out -e [--channels BGRA] [--ecc] [--matrix K] [--adaptive] [--key PASS | --key-fd N | --key-env VAR] [--verify] [--cache-dir DIR [--cache-mb N]] [--progress-fd N] <source.bmp|ppm|pgm> <secret.txt> [output.bmp|ppm|pgm]
+     *  - Decoding: a.out -d [--key PASS | --key-fd N | --key-env VAR] <stego.bmp|ppm|pgm> [output_secret_base]
+     *  - Quality : a.out -q <source.bmp> <stego.bmp>
+     *  - Daemon  : a.out --serve <socket_path> [cache_mb]
+     *  - Watch   : a.out -w <spool_dir> <out_dir>
+     *  - Archive : a.out -A <source.bmp> <output.bmp> <file>...  /  -l <archive.bmp>  /  -x <archive.bmp> <name> [output]
+     *  - Index   : a.out -I <stego.bmp>  (LSB plane sidecar read by later -d / -l / -x)
+     *  - Analyse : a.out -a <image|dir>...  (chi-square / RS steganalysis)
      */
 
     printf("=============================================\n");
     printf("🖼️  IMAGE STEGANOGRAPHY USING LSB TECHNIQUE  \n");
     printf("=============================================\n");
+    // Pick the kernel variants for this CPU once
+    lsb_init_kernels();
+    chacha_init_kernels();
+    sha256_init_kernels();
+    ecc_init_tables();
+
+    // Daemon mode only needs the socket path (and an optional cache budget in MB)
+    if ((argc == 3 || argc == 4) && check_operation_type(argv[1]) == e_serve)
+    {
+        size_t cache_mb = argc == 4 ? strtoul(argv[3], NULL, 10) : SERVE_CACHE_MB;
+        return do_serving(argv[2], cache_mb << 20) == e_success ? 0 : 1;
+    }
+    // Listing an archive only needs the image
+    if (argc == 3 && check_operation_type(argv[1]) == e_list)
+    {
+        ArchiveInfo a_Info = {0};
+        a_Info.operation = e_list;
+        return read_and_validate_archive_args(argv, &a_Info) == e_success && do_archive(&a_Info) == e_success ? 0 : 1;
+    }
+    // Indexing a stego image only needs the image
+    if (argc == 3 && check_operation_type(argv[1]) == e_index)
+    {
+        return lsbindex_build(argv[2]) == e_success ? 0 : 1;
+    }
+    // Steganalysis takes any number of images and directories
+    if (argc >= 3 && check_operation_type(argv[1]) == e_analysis)
+    {
+        AnalysisInfo an_Info = {0};
+        return read_and_validate_analysis_args(argv, &an_Info) == e_success && do_analysis(&an_Info) == e_success ? 0 : 1;
+    }
     // Step 1 : Check the argc >= 4 true - > step 2
     if (argc >= 4)
     {
@@ -89,10 +137,12 @@ int main(int argc, char *argv[])
         if (check_operation_type(argv[1]) == e_encode)
         {
             // Step 3 : Declare structure variable EncodeInfo enc_info
-            EncodeInfo enc_Info;
+            EncodeInfo enc_Info = {0};
             // Step 4 : Call the read_and_validate_encode_args(argv,&enc_info)== e_success)))))
             if (read_and_validate_encode_args(argv, &enc_Info) == e_success)
             {
+                // Ctrl+C / SIGTERM cancel cleanly instead of leaving a half written image
+                progress_install_cancel_handlers();
                 //  true -> Step 5 ,
                 // Step 5 : Call the do_encoding (&encInfo);
                 if (do_encoding(&enc_Info) == e_success)
@@ -118,7 +168,7 @@ int main(int argc, char *argv[])
         else if (check_operation_type(argv[1]) == e_decode)
         {
             // for decoding
-            DecodeInfo dcd_Info;
+            DecodeInfo dcd_Info = {0};
 
             printf("=============================================\n");
             printf("🔓 DECODING MODE SELECTED\n");
@@ -127,10 +177,8 @@ int main(int argc, char *argv[])
             if (read_and_validate_decode_args(argv, &dcd_Info) == e_success)
             {
                 // open .bmp file to read magic string and check the file is encoded or not
-                open_file_decode(&dcd_Info);
-
                 // check magic string is present or not
-                if (decode_magic_string(&dcd_Info) == e_success)
+                if (open_file_decode(&dcd_Info) == e_success && decode_magic_string(&dcd_Info) == e_success)
                 {
                     printf("Input file appears to contain embedded data. Starting decode...\n");
                     printf("---------------------------------------------\n");
@@ -155,16 +203,50 @@ int main(int argc, char *argv[])
                     printf(" ❌ The provided file does not appear to be encoded. Please supply a valid encoded BMP.");
                     printf("\n==========================================================\n");
                 }
+                // a failed decode drops its unpublished output
+                close_file_decode(&dcd_Info);
             }
             else
             {
                 return 0;
             }
         }
+        else if (check_operation_type(argv[1]) == e_quality)
+        {
+            // carrier vs stego distortion report
+            QualityInfo q_Info = {0};
+            if (read_and_validate_quality_args(argv, &q_Info) == e_success && do_quality(&q_Info) == e_success)
+            {
+                return 0;
+            }
+            printf("\n------------------------------------------------------\n");
+            printf(" ❌ Error: quality comparison failed.");
+            printf("\n------------------------------------------------------\n");
+            return 1;
+        }
+        else if (check_operation_type(argv[1]) == e_watch)
+        {
+            // long running: encode every carrier / secret pair dropped into the spool
+            return do_watching(argv[2], argv[3]) == e_success ? 0 : 1;
+        }
+        else if (check_operation_type(argv[1]) == e_archive || check_operation_type(argv[1]) == e_extract)
+        {
+            // many files in one image, or one file out of it
+            ArchiveInfo a_Info = {0};
+            a_Info.operation = check_operation_type(argv[1]);
+            if (read_and_validate_archive_args(argv, &a_Info) == e_success && do_archive(&a_Info) == e_success)
+            {
+                return 0;
+            }
+            printf("\n------------------------------------------------------\n");
+            printf(" ❌ Error: archive operation failed.");
+            printf("\n------------------------------------------------------\n");
+            return 1;
+        }
         else
         {
             printf("\n------------------------------------------------------\n");
-            printf(" ❌ Unsupported operation. Use -e to encode or -d to decode.");
+            printf(" ❌ Unsupported operation. Use -e to encode, -d to decode, -q to compare, -w to watch a folder, -a to analyse or -A / -l / -x for archives.");
             printf("\n========================================================\n");
             return 0;
         }
@@ -172,7 +254,7 @@ int main(int argc, char *argv[])
     else
     {
         printf("\n------------------------------------------------------\n");
-        printf(" ❌ Insufficient arguments. \nSee usage: \na.out -e <source.bmp> <secret> [output.bmp]  OR  \na.out -d <stego.bmp> [output_secret_base]\n");
+        printf(" ❌ Insufficient arguments. \nSee usage: \na.out -e [--channels BGRA] [--ecc] [--matrix K] [--adaptive] [--key PASS | --key-fd N | --key-env VAR] [--verify] [--cache-dir DIR [--cache-mb N]] [--progress-fd N] <source.bmp|ppm|pgm> <secret> [output.bmp|ppm|pgm]  OR  \na.out -d [--key PASS | --key-fd N | --key-env VAR] <stego.bmp|ppm|pgm> [output_secret_base]  OR  \na.out -q <source.bmp> <stego.bmp>  OR  \na.out -w <spool_dir> <out_dir>  OR  \na.out -A <source.bmp> <output.bmp> <file>...  OR  \na.out -l <archive.bmp>  OR  \na.out -x <archive.bmp> <name> [output]  OR  \na.out -I <stego.bmp>  OR  \na.out -a <image|dir>...  OR  \na.out --serve <socket_path> [cache_mb]\n");
         printf("==========================================================\n");
         return 0;
     }
@@ -191,6 +273,46 @@ OperationType check_operation_type(char *symbol)
         // Step 2 : Check whether the symbol is -d or not true - > return e_decode
         return e_decode;
     }
+    else if (!strcmp(symbol, "-q"))
+    {
+        // Carrier vs stego quality metrics
+        return e_quality;
+    }
+    else if (!strcmp(symbol, "-w"))
+    {
+        // Watch a spool directory
+        return e_watch;
+    }
+    else if (!strcmp(symbol, "-A"))
+    {
+        // Many files in one image
+        return e_archive;
+    }
+    else if (!strcmp(symbol, "-l"))
+    {
+        // List the entries of an archive
+        return e_list;
+    }
+    else if (!strcmp(symbol, "-x"))
+    {
+        // Extract one entry of an archive
+        return e_extract;
+    }
+    else if (!strcmp(symbol, "-I"))
+    {
+        // Build the LSB plane index of a stego image
+        return e_index;
+    }
+    else if (!strcmp(symbol, "-a"))
+    {
+        // Steganalysis of images and directories
+        return e_analysis;
+    }
+    else if (!strcmp(symbol, "--serve"))
+    {
+        // Long-lived daemon over a unix socket
+        return e_serve;
+    }
     else
     {
         // false -> return e_unsupported
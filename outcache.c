@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "outcache.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+/* xxHash64 */
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static inline uint64_t xxh_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t xxh_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    return xxh_rotl(acc + input * XXH_P2, 31) * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v)
+{
+    return (acc ^ xxh_round(0, v)) * XXH_P1 + XXH_P4;
+}
+
+void outcache_hash_init(OutcacheHash *hash, uint64_t seed)
+{
+    memset(hash, 0, sizeof(*hash));
+    hash->seed = seed;
+    hash->v[0] = seed + XXH_P1 + XXH_P2;
+    hash->v[1] = seed + XXH_P2;
+    hash->v[2] = seed;
+    hash->v[3] = seed - XXH_P1;
+}
+
+static void xxh_stripe(OutcacheHash *hash, const unsigned char *p)
+{
+    for (int i = 0; i < 4; i++)
+        hash->v[i] = xxh_round(hash->v[i], xxh_read64(p + 8 * i));
+}
+
+void outcache_hash_update(OutcacheHash *hash, const void *data, size_t n)
+{
+    const unsigned char *p = data;
+    hash->total += n;
+
+    if (hash->buf_len > 0)
+    {
+        size_t take = 32 - hash->buf_len < n ? 32 - hash->buf_len : n;
+        memcpy(hash->buf + hash->buf_len, p, take);
+        hash->buf_len += (uint)take;
+        p += take;
+        n -= take;
+        if (hash->buf_len < 32)
+            return;
+        xxh_stripe(hash, hash->buf);
+        hash->buf_len = 0;
+    }
+    for (; n >= 32; p += 32, n -= 32)
+        xxh_stripe(hash, p);
+    memcpy(hash->buf, p, n);
+    hash->buf_len = (uint)n;
+}
+
+uint64_t outcache_hash_final(const OutcacheHash *hash)
+{
+    uint64_t h;
+    if (hash->total >= 32)
+    {
+        h = xxh_rotl(hash->v[0], 1) + xxh_rotl(hash->v[1], 7) + xxh_rotl(hash->v[2], 12) + xxh_rotl(hash->v[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = xxh_merge(h, hash->v[i]);
+    }
+    else
+    {
+        h = hash->seed + XXH_P5;
+    }
+    h += hash->total;
+
+    const unsigned char *p = hash->buf, *end = hash->buf + hash->buf_len;
+    for (; p + 8 <= end; p += 8)
+        h = xxh_rotl(h ^ xxh_round(0, xxh_read64(p)), 27) * XXH_P1 + XXH_P4;
+    if (p + 4 <= end)
+    {
+        h = xxh_rotl(h ^ (uint64_t)xxh_read32(p) * XXH_P1, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = xxh_rotl(h ^ *p * XXH_P5, 11) * XXH_P1;
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+void outcache_key_hex(const unsigned char *key, char *hex)
+{
+    for (int i = 0; i < OUTCACHE_KEY_SIZE; i++)
+        sprintf(hex + 2 * i, "%02x", key[i]);
+}
+
+static void entry_path(char *path, size_t size, const char *dir, const unsigned char *key)
+{
+    char hex[2 * OUTCACHE_KEY_SIZE + 1];
+    outcache_key_hex(key, hex);
+    snprintf(path, size, "%s/%s", dir, hex);
+}
+
+/* Entry names: the hex key, or the <16 hex>.bmp of version 1 caches, which age out like the rest */
+static int entry_name(const char *name)
+{
+    size_t len = strlen(name), digits = strspn(name, "0123456789abcdef");
+    return (len == 2 * OUTCACHE_KEY_SIZE && digits == len) || (len == 20 && digits == 16 && !strcmp(name + 16, ".bmp"));
+}
+
+/*
+ * Make dst_fd a copy of src_fd: a reflink where the filesystem shares
+ * extents, else an in-kernel copy, else plain reads and writes.
+ */
+static Status clone_fd(int src_fd, int dst_fd)
+{
+    if (ftruncate(dst_fd, 0) < 0)
+    {
+        return e_failure;
+    }
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0)
+    {
+        return e_success;
+    }
+
+    struct stat st;
+    if (fstat(src_fd, &st) < 0)
+    {
+        return e_failure;
+    }
+    loff_t in = 0, out = 0;
+    while (in < st.st_size)
+    {
+        ssize_t n = copy_file_range(src_fd, &in, dst_fd, &out, (size_t)(st.st_size - in), 0);
+        if (n <= 0)
+            break;
+    }
+
+    char buffer[65536];
+    while (in < st.st_size)
+    {
+        ssize_t n = pread(src_fd, buffer, sizeof(buffer), in);
+        if (n <= 0 || pwrite(dst_fd, buffer, (size_t)n, out) != n)
+        {
+            return e_failure;
+        }
+        in += n;
+        out += n;
+    }
+    return e_success;
+}
+
+Status outcache_fetch(const char *dir, const unsigned char *key, int out_fd)
+{
+    char path[4096];
+    entry_path(path, sizeof(path), dir, key);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return e_failure;
+    }
+    Status status = clone_fd(fd, out_fd);
+    // a hit makes the entry the most recently used one
+    if (status == e_success)
+        futimens(fd, NULL);
+    close(fd);
+    return status;
+}
+
+typedef struct _OutcacheEntry
+{
+    char name[2 * OUTCACHE_KEY_SIZE + 1];
+    off_t size;
+    struct timespec mtime;
+} OutcacheEntry;
+
+static int older_first(const void *a, const void *b)
+{
+    const OutcacheEntry *x = a, *y = b;
+    if (x->mtime.tv_sec != y->mtime.tv_sec)
+        return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    if (x->mtime.tv_nsec != y->mtime.tv_nsec)
+        return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/* Drop the least recently used entries until the directory fits budget */
+static void evict(const char *dir, unsigned long long budget)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+    {
+        return;
+    }
+    OutcacheEntry *entries = NULL;
+    size_t count = 0, alloc = 0;
+    unsigned long long total = 0;
+
+    for (struct dirent *de; (de = readdir(d)) != NULL;)
+    {
+        struct stat st;
+        if (!entry_name(de->d_name) || fstatat(dirfd(d), de->d_name, &st, 0) < 0)
+            continue;
+        if (count == alloc)
+        {
+            OutcacheEntry *grown = realloc(entries, (alloc = alloc ? 2 * alloc : 64) * sizeof(*entries));
+            if (grown == NULL)
+                break;
+            entries = grown;
+        }
+        strcpy(entries[count].name, de->d_name);
+        entries[count].size = st.st_size;
+        entries[count].mtime = st.st_mtim;
+        total += (unsigned long long)st.st_size;
+        count++;
+    }
+
+    if (total > budget)
+    {
+        qsort(entries, count, sizeof(*entries), older_first);
+        for (size_t i = 0; i < count && total > budget; i++)
+        {
+            if (unlinkat(dirfd(d), entries[i].name, 0) == 0)
+                total -= (unsigned long long)entries[i].size;
+        }
+    }
+    free(entries);
+    closedir(d);
+}
+
+Status outcache_store(const char *dir, const unsigned char *key, int out_fd, unsigned long long budget)
+{
+    char path[4096], tmp[4096];
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+    {
+        perror(dir);
+        return e_failure;
+    }
+    // the output may be open write only, read it back through procfs
+    snprintf(tmp, sizeof(tmp), "/proc/self/fd/%d", out_fd);
+    int src_fd = open(tmp, O_RDONLY | O_CLOEXEC);
+    if (src_fd < 0)
+    {
+        return e_failure;
+    }
+
+    // written under a temporary name so a reader never sees a partial entry
+    snprintf(tmp, sizeof(tmp), "%s/.tmpXXXXXX", dir);
+    int tmp_fd = mkostemp(tmp, O_CLOEXEC);
+    Status status = e_failure;
+    if (tmp_fd >= 0)
+    {
+        entry_path(path, sizeof(path), dir, key);
+        fchmod(tmp_fd, 0644);
+        status = clone_fd(src_fd, tmp_fd);
+        if (close(tmp_fd) < 0 || status == e_failure || rename(tmp, path) < 0)
+        {
+            unlink(tmp);
+            status = e_failure;
+        }
+    }
+    close(src_fd);
+    evict(dir, budget);
+    return status;
+}
+
+void outcache_count(const char *dir, int hit, unsigned long long *hits, unsigned long long *misses)
+{
+    char path[4096];
+    *hits = *misses = 0;
+
+    mkdir(dir, 0755);
+    snprintf(path, sizeof(path), "%s/stats", dir);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return;
+    }
+    // concurrent encodes sharing the directory update the counters in turn
+    flock(fd, LOCK_EX);
+    char buffer[128] = {0};
+    if (pread(fd, buffer, sizeof(buffer) - 1, 0) > 0)
+        sscanf(buffer, "hits %llu misses %llu", hits, misses);
+    if (hit)
+        (*hits)++;
+    else
+        (*misses)++;
+    int len = snprintf(buffer, sizeof(buffer), "hits %llu misses %llu\n", *hits, *misses);
+    if (pwrite(fd, buffer, (size_t)len, 0) == len)
+        ftruncate(fd, len);
+    flock(fd, LOCK_UN);
+    close(fd);
+}
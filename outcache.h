@@ -0,0 +1,52 @@
+#ifndef OUTCACHE_H
+#define OUTCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h" // Contains user defined types
+#include "sha256.h" // Entry keys
+
+/*
+ * Content addressed output cache (--cache-dir)
+ * --------------------------------------------
+ * Encoding is deterministic, so a stego image is fully defined by the
+ * carrier, the payload and the encode options. Finished outputs are kept
+ * in the cache directory under the hex SHA-256 of all three, without an
+ * extension since the carrier may be any supported format; a repeated job
+ * clones the cached file instead of encoding.
+ * The directory is kept under a byte budget by dropping the entries used
+ * least recently (a hit refreshes the mtime of its entry).
+ */
+
+#define OUTCACHE_DEFAULT_MB 1024 // Default size budget of the cache
+#define OUTCACHE_VERSION 2       // Bump when the stego format changes
+#define OUTCACHE_KEY_SIZE SHA256_DIGEST_SIZE // Bytes of an entry key
+
+/* Streaming 64 bit hash (xxHash64) */
+typedef struct _OutcacheHash
+{
+    uint64_t v[4];            // Lane accumulators
+    uint64_t seed;            // Seed for short inputs
+    unsigned long long total; // Bytes hashed so far
+    unsigned char buf[32];    // Bytes waiting for a full stripe
+    uint buf_len;             // Number of bytes in buf
+} OutcacheHash;
+
+void outcache_hash_init(OutcacheHash *hash, uint64_t seed);
+void outcache_hash_update(OutcacheHash *hash, const void *data, size_t n);
+uint64_t outcache_hash_final(const OutcacheHash *hash);
+
+/* Lower case hex of a key, hex holds 2 * OUTCACHE_KEY_SIZE + 1 bytes */
+void outcache_key_hex(const unsigned char *key, char *hex);
+
+/* On a hit replace the contents of out_fd with the cached output */
+Status outcache_fetch(const char *dir, const unsigned char *key, int out_fd);
+
+/* Add the finished output in out_fd under key, then evict down to budget bytes */
+Status outcache_store(const char *dir, const unsigned char *key, int out_fd, unsigned long long budget);
+
+/* Count a hit or a miss and return the totals of the directory */
+void outcache_count(const char *dir, int hit, unsigned long long *hits, unsigned long long *misses);
+
+#endif
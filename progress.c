@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include "progress.h"
+#include "types.h"
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Report period of the reporter thread */
+#define PROGRESS_TICK_MS 250
+
+static volatile sig_atomic_t cancel_requested;
+
+static void progress_cancel_handler(int sig)
+{
+    (void)sig;
+    cancel_requested = 1;
+}
+
+void progress_install_cancel_handlers(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = progress_cancel_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
+
+int progress_cancelled(void)
+{
+    return cancel_requested;
+}
+
+void progress_add(Progress *progress, unsigned long long n)
+{
+    __atomic_fetch_add(&progress->done, n, __ATOMIC_RELAXED);
+}
+
+/* Emit one report through the fd, the callback or stderr */
+static void progress_report(Progress *progress, int final)
+{
+    unsigned long long done = __atomic_load_n(&progress->done, __ATOMIC_RELAXED);
+    unsigned long long total = progress->total;
+    if (done > total)
+        done = total;
+
+    if (progress->fd > 0)
+    {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "progress %llu %llu\n", done, total);
+        if (write(progress->fd, line, len) < 0)
+            progress->fd = 0;
+    }
+    if (progress->callback != NULL)
+    {
+        progress->callback(done, total, progress->callback_arg);
+    }
+    if (progress->fd <= 0 && progress->callback == NULL)
+    {
+        // Jobs that finish within one tick print nothing at all
+        if (final && !progress->reported)
+            return;
+        fprintf(stderr, "\r⏳ %s... %3llu%%", progress->label, total ? done * 100 / total : 100);
+        if (final)
+            fprintf(stderr, "\n");
+    }
+    progress->reported = 1;
+}
+
+static void *progress_reporter(void *arg)
+{
+    Progress *progress = arg;
+
+    pthread_mutex_lock(&progress->lock);
+    while (progress->running)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PROGRESS_TICK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&progress->wake, &progress->lock, &deadline) != 0 && progress->running)
+        {
+            progress_report(progress, 0);
+        }
+    }
+    pthread_mutex_unlock(&progress->lock);
+    return NULL;
+}
+
+Status progress_start(Progress *progress, unsigned long long total, const char *label)
+{
+    progress->done = 0;
+    progress->total = total;
+    progress->label = label;
+    progress->reported = 0;
+    progress->running = 1;
+    pthread_mutex_init(&progress->lock, NULL);
+    pthread_cond_init(&progress->wake, NULL);
+
+    if (pthread_create(&progress->reporter, NULL, progress_reporter, progress) != 0)
+    {
+        progress->running = 0;
+        return e_failure;
+    }
+    return e_success;
+}
+
+void progress_stop(Progress *progress)
+{
+    if (!progress->running)
+        return;
+
+    pthread_mutex_lock(&progress->lock);
+    progress->running = 0;
+    pthread_cond_signal(&progress->wake);
+    pthread_mutex_unlock(&progress->lock);
+    pthread_join(progress->reporter, NULL);
+
+    progress_report(progress, 1);
+    pthread_mutex_destroy(&progress->lock);
+    pthread_cond_destroy(&progress->wake);
+}
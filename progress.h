@@ -0,0 +1,49 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <pthread.h>
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Progress reporting and cancellation for long jobs.
+ * The hot loops only add to an atomic counter once per chunk and test a
+ * flag; formatting and output happen on a separate reporter thread.
+ */
+
+/* Called from the reporter thread with the bytes done so far */
+typedef void (*ProgressCallback)(unsigned long long done, unsigned long long total, void *arg);
+
+typedef struct _Progress
+{
+    unsigned long long done;   // To store the bytes processed (atomic, per chunk)
+    unsigned long long total;  // To store the bytes the job will process
+    const char *label;         // To store the label of the default report
+    int fd;                    // To store the --progress-fd descriptor (0 = none)
+    ProgressCallback callback; // To store an API callback (NULL = none)
+    void *callback_arg;        // To store the argument of the callback
+
+    /* Reporter thread */
+    pthread_t reporter;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+    int reported;              // To store whether a tick was already shown
+} Progress;
+
+/* Reset the counters and start the reporter thread */
+Status progress_start(Progress *progress, unsigned long long total, const char *label);
+
+/* Account for n more bytes, call once per chunk */
+void progress_add(Progress *progress, unsigned long long n);
+
+/* Stop the reporter thread and emit the final report */
+void progress_stop(Progress *progress);
+
+/* SIGINT / SIGTERM set the cancel flag instead of killing the process */
+void progress_install_cancel_handlers(void);
+
+/* Non zero once a cancel was requested */
+int progress_cancelled(void);
+
+#endif
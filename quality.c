@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include "quality.h"
+#include "encode.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Bytes of each image read per step */
+#define QUALITY_CHUNK (1 << 20)
+
+/* Upper bounds (in percent of the row) of the histogram buckets */
+static const uint quality_bucket_limits[QUALITY_BUCKETS] = {0, 1, 5, 10, 25, 50, 100};
+static const char *quality_bucket_names[QUALITY_BUCKETS] = {"unchanged", "<= 1%", "<= 5%", "<= 10%", "<= 25%", "<= 50%", "> 50%"};
+
+/* Statistics of one row */
+typedef struct _QualityRow
+{
+    unsigned long long sum_sq_diff;
+    uint changed;
+    uint max_delta[QUALITY_MAX_CHANNELS];
+} QualityRow;
+
+/*
+ * One pass over a row of n samples, channels per pixel. With SSE2 every
+ * 48 byte block is three vectors: |a - b| from two saturating subtracts,
+ * changed samples from a compare + movemask, squares through madd, and a
+ * running max per vector. 1, 3 and 4 all divide 48, so lane i of vector v
+ * always holds channel (16 v + i) % channels and the max vectors fold
+ * back into the channels at the end.
+ */
+static void quality_row(const unsigned char *a, const unsigned char *b, uint n, uint channels, QualityRow *row)
+{
+    uint i = 0;
+    memset(row, 0, sizeof(*row));
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i max_v[3] = {zero, zero, zero};
+    __m128i sum32 = zero, sum64 = zero;
+    uint blocks = 0;
+
+    for (; i + 48 <= n; i += 48)
+    {
+        for (int v = 0; v < 3; v++)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + i + 16 * v));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + i + 16 * v));
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+
+            row->changed += 16 - __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)));
+            max_v[v] = _mm_max_epu8(max_v[v], diff);
+
+            __m128i lo = _mm_unpacklo_epi8(diff, zero);
+            __m128i hi = _mm_unpackhi_epi8(diff, zero);
+            sum32 = _mm_add_epi32(sum32, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        // 32 bit lanes gain at most 3 * 4 * 255^2 per block, flush long before they wrap
+        if (++blocks == 1024)
+        {
+            sum64 = _mm_add_epi64(sum64, _mm_add_epi64(_mm_unpacklo_epi32(sum32, zero), _mm_unpackhi_epi32(sum32, zero)));
+            sum32 = zero;
+            blocks = 0;
+        }
+    }
+    sum64 = _mm_add_epi64(sum64, _mm_add_epi64(_mm_unpacklo_epi32(sum32, zero), _mm_unpackhi_epi32(sum32, zero)));
+
+    unsigned long long sums[2];
+    _mm_storeu_si128((__m128i *)sums, sum64);
+    row->sum_sq_diff = sums[0] + sums[1];
+
+    unsigned char lanes[3][16];
+    for (int v = 0; v < 3; v++)
+    {
+        _mm_storeu_si128((__m128i *)lanes[v], max_v[v]);
+        for (int l = 0; l < 16; l++)
+        {
+            uint ch = (16 * v + l) % channels;
+            if (lanes[v][l] > row->max_delta[ch])
+                row->max_delta[ch] = lanes[v][l];
+        }
+    }
+#endif
+
+    // Scalar tail (and the whole row without SSE2)
+    for (; i < n; i++)
+    {
+        uint delta = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+        row->sum_sq_diff += delta * delta;
+        row->changed += delta != 0;
+        if (delta > row->max_delta[i % channels])
+            row->max_delta[i % channels] = delta;
+    }
+}
+
+/*
+ * Samples of one row, pixel after pixel. 8 bit formats are compared in
+ * place (alpha included, --channels A embeds there); 16 bit fields are
+ * widened to 8 bits the way a viewer shows them, so the deltas and the
+ * PSNR are on the same 0..255 scale as the other formats.
+ */
+static const unsigned char *row_samples(const ImageGeometry *geometry, const unsigned char *row, unsigned char *samples)
+{
+    if (geometry->format != e_pixel_rgb565 && geometry->format != e_pixel_rgb555)
+    {
+        return row;
+    }
+    for (uint x = 0; x < geometry->width; x++)
+    {
+        uint pixel = row[2 * x] | (uint)row[2 * x + 1] << 8;
+        uint b = pixel & 0x1F;
+        uint g = geometry->format == e_pixel_rgb565 ? (pixel >> 5) & 0x3F : (pixel >> 5) & 0x1F;
+        uint r = geometry->format == e_pixel_rgb565 ? pixel >> 11 : (pixel >> 10) & 0x1F;
+        samples[3 * x] = (unsigned char)(b << 3 | b >> 2);
+        samples[3 * x + 1] = geometry->format == e_pixel_rgb565 ? (unsigned char)(g << 2 | g >> 4) : (unsigned char)(g << 3 | g >> 2);
+        samples[3 * x + 2] = (unsigned char)(r << 3 | r >> 2);
+    }
+    return samples;
+}
+
+Status read_and_validate_quality_args(char *argv[], QualityInfo *qInfo)
+{
+    for (int i = 2; i <= 3; i++)
+    {
+        if (argv[i] == NULL || !(checkExtension(argv[i], ".bmp") || checkExtension(argv[i], ".ppm") || checkExtension(argv[i], ".pgm")))
+        {
+            printf("Error: -q expects two .bmp, .ppm or .pgm images: <source> <stego>\n");
+            return e_failure;
+        }
+    }
+    qInfo->src_image_fname = argv[2];
+    qInfo->stego_image_fname = argv[3];
+    return e_success;
+}
+
+/* Open both images and check that they can be compared */
+static Status open_quality_files(QualityInfo *qInfo)
+{
+    ImageGeometry stego_geometry;
+
+    qInfo->fptr_src_image = fopen(qInfo->src_image_fname, "rb");
+    qInfo->fptr_stego_image = fopen(qInfo->stego_image_fname, "rb");
+    if (qInfo->fptr_src_image == NULL || qInfo->fptr_stego_image == NULL)
+    {
+        perror("fopen");
+        return e_failure;
+    }
+    if (read_image_geometry(qInfo->fptr_src_image, &qInfo->geometry) == e_failure || read_image_geometry(qInfo->fptr_stego_image, &stego_geometry) == e_failure)
+    {
+        printf("Error: unable to read the image headers\n");
+        return e_failure;
+    }
+    if (memcmp(&qInfo->geometry, &stego_geometry, sizeof(stego_geometry)) != 0)
+    {
+        printf("Error: the images have different dimensions\n");
+        return e_failure;
+    }
+    switch (qInfo->geometry.format)
+    {
+    case e_pixel_bgra32:
+        qInfo->channels = 4;
+        qInfo->names = "BGRA";
+        break;
+    case e_pixel_rgb24:
+        qInfo->channels = 3;
+        qInfo->names = "RGB";
+        break;
+    case e_pixel_gray8:
+        qInfo->channels = 1;
+        qInfo->names = "G";
+        break;
+    case e_pixel_rgb48:
+    case e_pixel_gray16:
+        printf("Error: -q does not compare 16 bit pnm samples\n");
+        return e_failure;
+    default:
+        // 24 bit, and 16 bit fields widened to B G R samples
+        qInfo->channels = 3;
+        qInfo->names = "BGR";
+        break;
+    }
+    return e_success;
+}
+
+/* Walk both images in lock step, a chunk of whole rows at a time */
+static Status compare_pixel_data(QualityInfo *qInfo)
+{
+    const ImageGeometry *geometry = &qInfo->geometry;
+    uint row_samples_count = geometry->width * qInfo->channels;
+    uint rows_per_chunk = QUALITY_CHUNK / geometry->row_stride ? QUALITY_CHUNK / geometry->row_stride : 1;
+    size_t chunk_size = (size_t)rows_per_chunk * geometry->row_stride;
+    Status status = e_success;
+
+    unsigned char *src = malloc(chunk_size);
+    unsigned char *stego = malloc(chunk_size);
+    // widened 16 bit fields of one row of each image
+    unsigned char *samples = malloc(2 * (size_t)geometry->width * 3);
+    if (src == NULL || stego == NULL || samples == NULL)
+    {
+        free(src);
+        free(stego);
+        free(samples);
+        return e_failure;
+    }
+
+    fseek(qInfo->fptr_src_image, geometry->data_offset, SEEK_SET);
+    fseek(qInfo->fptr_stego_image, geometry->data_offset, SEEK_SET);
+    for (uint row = 0; row < geometry->height; row += rows_per_chunk)
+    {
+        uint rows = geometry->height - row < rows_per_chunk ? geometry->height - row : rows_per_chunk;
+        size_t size = (size_t)rows * geometry->row_stride;
+        if (fread(src, 1, size, qInfo->fptr_src_image) != size || fread(stego, 1, size, qInfo->fptr_stego_image) != size)
+        {
+            printf("Error: pixel data is shorter than the header says\n");
+            status = e_failure;
+            break;
+        }
+
+        for (uint r = 0; r < rows; r++)
+        {
+            QualityRow stats;
+            const unsigned char *a = row_samples(geometry, src + (size_t)r * geometry->row_stride, samples);
+            const unsigned char *b = row_samples(geometry, stego + (size_t)r * geometry->row_stride, samples + (size_t)geometry->width * 3);
+            quality_row(a, b, row_samples_count, qInfo->channels, &stats);
+
+            qInfo->sum_sq_diff += stats.sum_sq_diff;
+            qInfo->changed_samples += stats.changed;
+            for (uint ch = 0; ch < qInfo->channels; ch++)
+            {
+                if (stats.max_delta[ch] > qInfo->max_delta[ch])
+                    qInfo->max_delta[ch] = stats.max_delta[ch];
+            }
+
+            // Bucket of the row by the percentage of changed samples
+            int bucket = 0;
+            while (bucket < QUALITY_BUCKETS - 1 && (unsigned long long)stats.changed * 100 > (unsigned long long)quality_bucket_limits[bucket] * row_samples_count)
+                bucket++;
+            qInfo->row_histogram[bucket]++;
+        }
+        qInfo->total_samples += (unsigned long long)rows * row_samples_count;
+    }
+
+    free(src);
+    free(stego);
+    free(samples);
+    return status;
+}
+
+Status do_quality(QualityInfo *qInfo)
+{
+    printf("\n=============================================\n");
+    printf("📊 QUALITY MODE SELECTED\n");
+    printf("=============================================\n");
+    printf("📂 Source Image : %s\n", qInfo->src_image_fname);
+    printf("📂 Stego Image  : %s\n", qInfo->stego_image_fname);
+    printf("---------------------------------------------\n");
+
+    Status status = open_quality_files(qInfo);
+    if (status == e_success)
+        status = compare_pixel_data(qInfo);
+
+    if (qInfo->fptr_src_image != NULL)
+        fclose(qInfo->fptr_src_image);
+    if (qInfo->fptr_stego_image != NULL)
+        fclose(qInfo->fptr_stego_image);
+    if (status == e_failure)
+        return e_failure;
+
+    qInfo->mse = qInfo->total_samples ? (double)qInfo->sum_sq_diff / qInfo->total_samples : 0.0;
+    qInfo->psnr = qInfo->mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / qInfo->mse) : INFINITY;
+
+    printf("📐 Pixels compared    : %u x %u\n", qInfo->geometry.width, qInfo->geometry.height);
+    printf("📉 MSE                : %.6f\n", qInfo->mse);
+    printf("📈 PSNR               : %.2f dB\n", qInfo->psnr);
+    printf("✏️  Changed samples    : %llu of %llu (%.4f%%)\n", qInfo->changed_samples, qInfo->total_samples,
+           qInfo->total_samples ? 100.0 * qInfo->changed_samples / qInfo->total_samples : 0.0);
+    printf("🎨 Max delta (");
+    for (uint ch = 0; ch < qInfo->channels; ch++)
+        printf("%s%c", ch ? "/" : "", qInfo->names[ch]);
+    printf(")%*s: ", 8 - 2 * (int)qInfo->channels, "");
+    for (uint ch = 0; ch < qInfo->channels; ch++)
+        printf("%s%u", ch ? " / " : "", qInfo->max_delta[ch]);
+    printf("\n");
+    printf("📊 Rows by share of changed samples:\n");
+    for (int bucket = 0; bucket < QUALITY_BUCKETS; bucket++)
+    {
+        printf("   %-10s : %llu\n", quality_bucket_names[bucket], qInfo->row_histogram[bucket]);
+    }
+    printf("-------------------------------------------------\n");
+    return e_success;
+}
@@ -0,0 +1,45 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <stdio.h>
+
+#include "types.h" // Contains user defined types
+#include "image.h" // Pixel geometry
+
+/* Rows are binned by the share of their samples that changed */
+#define QUALITY_BUCKETS 7
+
+/* Most samples per pixel (B G R A) */
+#define QUALITY_MAX_CHANNELS 4
+
+/*
+ * Structure to store the inputs and results of a -q comparison
+ * between a carrier and the stego image made from it
+ */
+typedef struct _QualityInfo
+{
+    char *src_image_fname;   // To store the carrier image name
+    FILE *fptr_src_image;    // To store the address of the carrier image
+    char *stego_image_fname; // To store the stego image name
+    FILE *fptr_stego_image;  // To store the address of the stego image
+    ImageGeometry geometry;  // To store the common pixel geometry
+    uint channels;           // To store the samples per pixel (1, 3 or 4)
+    const char *names;       // To store the channel letters in sample order
+
+    /* Results */
+    unsigned long long sum_sq_diff;     // To store the sum of squared sample deltas
+    unsigned long long changed_samples; // To store the number of samples that differ
+    unsigned long long total_samples;   // To store the number of samples compared
+    uint max_delta[QUALITY_MAX_CHANNELS]; // To store the max |delta| of every channel
+    unsigned long long row_histogram[QUALITY_BUCKETS]; // To store rows per change bucket
+    double mse;                       // To store the mean squared error
+    double psnr;                      // To store the PSNR in dB (infinite when identical)
+} QualityInfo;
+
+/* Read and validate -q args from argv */
+Status read_and_validate_quality_args(char *argv[], QualityInfo *qInfo);
+
+/* Compare the two images and print the report */
+Status do_quality(QualityInfo *qInfo);
+
+#endif
@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "serve.h"
+#include "encode.h"
+#include "decode.h"
+#include "carrier_cache.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * Daemon mode
+ * -----------
+ * One listening unix socket, a pool of worker threads all blocking in
+ * accept(). Every worker owns an EncodeInfo whose image buffer survives
+ * between requests, so a warm worker never allocates on the hot path.
+ * Source images come from the shared carrier cache, so encoding into a
+ * carrier that was seen recently does no carrier I/O at all.
+ */
+
+static int listen_fd = -1;
+
+/* One log line per request, workers never interleave */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Receive the request and the attached descriptors */
+static Status recv_request(int conn, ServeRequest *req, int *fds, int *nfds)
+{
+    char control[CMSG_SPACE(sizeof(int) * SERVE_MAX_FDS)];
+    struct iovec iov = {req, sizeof(*req)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *nfds = 0;
+    ssize_t n = recvmsg(conn, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            *nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+        }
+    }
+
+    if (n != sizeof(*req) || (msg.msg_flags & MSG_CTRUNC))
+    {
+        return e_failure;
+    }
+    req->secret_fname[SERVE_FNAME_SIZE - 1] = '\0';
+    req->key[CHACHA_PASSPHRASE_MAX] = '\0';
+    return e_success;
+}
+
+static Status serve_encode(ServeRequest *req, int *fds, EncodeInfo *encInfo, ServeReply *reply)
+{
+    // Reset the job state but keep the warm buffers
+    EncodeInfo warm = *encInfo;
+    memset(encInfo, 0, sizeof(*encInfo));
+    encInfo->image_data = warm.image_data;
+    encInfo->image_data_alloc = warm.image_data_alloc;
+    encInfo->slot_buffer = warm.slot_buffer;
+    encInfo->slot_buffer_alloc = warm.slot_buffer_alloc;
+
+    encInfo->src_image_fname = "<fd>";
+    encInfo->secret_fname = req->secret_fname;
+    encInfo->stego_image_fname = "<fd>";
+    encInfo->channel_mask = req->channel_mask & (CHANNEL_ALL | CHANNEL_A);
+    encInfo->stego_fd_handed_over = 1;
+    encInfo->quiet = 1;
+    encInfo->key = req->key[0] != '\0' ? req->key : NULL;
+
+    if (!(checkExtension(req->secret_fname, ".txt") || checkExtension(req->secret_fname, ".c") || checkExtension(req->secret_fname, ".sh") || checkExtension(req->secret_fname, ".h")))
+    {
+        printf("Error: '%s' must have one of these extensions: .txt, .c, .sh, .h\n", req->secret_fname);
+        return e_failure;
+    }
+
+    // The FILE streams take over the received descriptors
+    encInfo->fptr_src_image = fdopen(fds[0], "rb");
+    encInfo->fptr_secret = fdopen(fds[1], "rb");
+    encInfo->fptr_stego_image = fdopen(fds[2], "wb");
+    if (encInfo->fptr_src_image != NULL)
+        fds[0] = -1;
+    if (encInfo->fptr_secret != NULL)
+        fds[1] = -1;
+    if (encInfo->fptr_stego_image != NULL)
+        fds[2] = -1;
+    if (encInfo->fptr_src_image == NULL || encInfo->fptr_secret == NULL || encInfo->fptr_stego_image == NULL)
+    {
+        perror("fdopen");
+        close_files(encInfo);
+        return e_failure;
+    }
+
+    encInfo->carrier = carrier_cache_acquire(encInfo->fptr_src_image);
+
+    Status status = do_encoding(encInfo);
+    reply->size_secret_file = encInfo->size_secret_file;
+    strcpy(reply->extn_secret_file, encInfo->extn_secret_file);
+    close_files(encInfo);
+    carrier_cache_release(encInfo->carrier);
+    encInfo->carrier = NULL;
+    return status;
+}
+
+static int serve_decode(ServeRequest *req, int *fds, ServeReply *reply)
+{
+    DecodeInfo dcdInfo = {0};
+    Status status = e_failure;
+
+    dcdInfo.stego1_image_fname = "<fd>";
+    dcdInfo.secret_fname = "<fd>";
+    dcdInfo.quiet = 1;
+    dcdInfo.key = req->key[0] != '\0' ? req->key : NULL;
+
+    // The FILE streams take over the received descriptors
+    dcdInfo.fptr_stego1_image = fdopen(fds[0], "rb");
+    dcdInfo.fptr_secret = fdopen(fds[1], "w");
+    if (dcdInfo.fptr_stego1_image != NULL)
+        fds[0] = -1;
+    if (dcdInfo.fptr_secret != NULL)
+        fds[1] = -1;
+    if (dcdInfo.fptr_stego1_image == NULL || dcdInfo.fptr_secret == NULL)
+    {
+        perror("fdopen");
+        close_file_decode(&dcdInfo);
+        return e_failure;
+    }
+
+    if (open_file_decode(&dcdInfo) == e_success && decode_magic_string(&dcdInfo) == e_success)
+    {
+        status = do_decoding(&dcdInfo);
+    }
+    reply->size_secret_file = dcdInfo.size_secret_file;
+    strcpy(reply->extn_secret_file, dcdInfo.extn_secret_file);
+    close_file_decode(&dcdInfo);
+    return status == e_failure && dcdInfo.key_refused ? SERVE_KEY_REFUSED : (int)status;
+}
+
+/* The one line a job prints: the jobs themselves are quiet */
+static void log_request(const ServeRequest *req, const ServeReply *reply)
+{
+    pthread_mutex_lock(&log_lock);
+    if (req->operation == e_encode)
+        printf("%s encode %s: %ld bytes\n", reply->status == e_success ? "📨" : "⚠️ ERROR:", req->secret_fname, reply->size_secret_file);
+    else
+        printf("%s decode: %ld bytes (%s)%s\n", reply->status == e_success ? "📨" : "⚠️ ERROR:", reply->size_secret_file, reply->extn_secret_file, reply->status == SERVE_KEY_REFUSED ? ", passphrase missing or wrong" : "");
+    fflush(stdout);
+    pthread_mutex_unlock(&log_lock);
+}
+
+/* Handle one connection: request in, job, reply out */
+static void serve_request(int conn, EncodeInfo *encInfo)
+{
+    ServeRequest req;
+    ServeReply reply = {0};
+    int fds[SERVE_MAX_FDS] = {-1, -1, -1};
+    int nfds;
+
+    reply.status = e_failure;
+    if (recv_request(conn, &req, fds, &nfds) == e_success)
+    {
+        if (req.operation == e_encode && nfds == 3)
+        {
+            reply.status = serve_encode(&req, fds, encInfo, &reply);
+            log_request(&req, &reply);
+        }
+        else if (req.operation == e_decode && nfds == 2)
+        {
+            reply.status = serve_decode(&req, fds, &reply);
+            log_request(&req, &reply);
+        }
+        else
+        {
+            printf("⚠️ ERROR: malformed request (operation %d with %d fds)\n", req.operation, nfds);
+        }
+    }
+
+    // The passphrase does not outlive the job
+    explicit_bzero(req.key, sizeof(req.key));
+
+    // Close whatever the job did not take over
+    for (int i = 0; i < nfds && i < SERVE_MAX_FDS; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    send(conn, &reply, sizeof(reply), MSG_NOSIGNAL);
+}
+
+static void *serve_worker(void *arg)
+{
+    (void)arg;
+    // Image buffer of this worker, kept warm across requests
+    EncodeInfo encInfo = {0};
+
+    for (;;)
+    {
+        int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Listening socket shut down: daemon is stopping
+            break;
+        }
+        serve_request(conn, &encInfo);
+        close(conn);
+    }
+
+    free(encInfo.image_data);
+    free(encInfo.slot_buffer);
+    return NULL;
+}
+
+Status do_serving(char *sock_path, size_t cache_budget)
+{
+    struct sockaddr_un addr = {0};
+    pthread_t workers[SERVE_MAX_WORKERS];
+    sigset_t set;
+    int sig;
+
+    if (strlen(sock_path) >= sizeof(addr.sun_path))
+    {
+        printf("Error: socket path '%s' is too long\n", sock_path);
+        return e_failure;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+    {
+        perror("socket");
+        return e_failure;
+    }
+    // Replace a stale socket left behind by a previous daemon
+    unlink(sock_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0)
+    {
+        perror("bind/listen");
+        close(listen_fd);
+        return e_failure;
+    }
+
+    // Workers never see SIGINT / SIGTERM, the main thread waits for them
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 2)
+        nworkers = 2;
+    if (nworkers > SERVE_MAX_WORKERS)
+        nworkers = SERVE_MAX_WORKERS;
+
+    carrier_cache_init(cache_budget);
+    int started = 0;
+    for (int i = 0; i < nworkers; i++)
+    {
+        if (pthread_create(&workers[started], NULL, serve_worker, NULL) == 0)
+            started++;
+    }
+    if (started == 0)
+    {
+        printf("⚠️ ERROR: unable to start worker threads.\n");
+        close(listen_fd);
+        unlink(sock_path);
+        return e_failure;
+    }
+
+    printf("🛰️  Serving on %s with %d workers, %zu MB carrier cache (Ctrl+C to stop)\n", sock_path, started, cache_budget >> 20);
+    fflush(stdout);
+
+    sigwait(&set, &sig);
+
+    // Wake every worker out of accept() and let in-flight jobs finish
+    shutdown(listen_fd, SHUT_RDWR);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    close(listen_fd);
+    unlink(sock_path);
+    carrier_cache_destroy();
+    printf("\n👋 Daemon stopped.\n");
+    return e_success;
+}
@@ -0,0 +1,46 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stddef.h>
+
+#include "types.h" // Contains user defined types
+#include "chacha.h" // Passphrase size
+
+/*
+ * Wire format of the --serve daemon.
+ * A client connects to the unix socket, sends one ServeRequest with the
+ * file descriptors of the job attached (SCM_RIGHTS) and reads back one
+ * ServeReply. The image and secret bytes never travel through the socket.
+ *
+ *   e_encode : fds = { source bmp, secret file, stego output }
+ *   e_decode : fds = { stego bmp, secret output }
+ *
+ * A --key passphrase travels in the request (the socket never leaves the
+ * host) and is wiped from the daemon's memory once the job is done.
+ */
+
+#define SERVE_MAX_FDS 3       // Most fds a single request carries
+#define SERVE_MAX_WORKERS 16  // Upper bound of the worker pool
+#define SERVE_FNAME_SIZE 256  // Room for the secret file name
+#define SERVE_CACHE_MB 256    // Default carrier cache budget
+#define SERVE_KEY_REFUSED 2   // Reply status: the image is encrypted and the passphrase is missing or wrong
+
+typedef struct _ServeRequest
+{
+    int operation;                      // e_encode or e_decode
+    char secret_fname[SERVE_FNAME_SIZE]; // Secret name, its extension is embedded
+    uint channel_mask;                  // --channels selection (0 = every byte)
+    char key[CHACHA_PASSPHRASE_MAX + 1]; // --key passphrase ("" = no key)
+} ServeRequest;
+
+typedef struct _ServeReply
+{
+    int status;               // e_success, e_failure or SERVE_KEY_REFUSED
+    long size_secret_file;    // Size of the embedded / extracted secret
+    char extn_secret_file[5]; // Extension of the embedded / extracted secret
+} ServeReply;
+
+/* Run the daemon on sock_path until SIGINT / SIGTERM */
+Status do_serving(char *sock_path, size_t cache_budget);
+
+#endif
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include "sha256.h"
+#include "types.h"
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define SHA256_HAVE_X86 1
+#endif
+
+#define SHA256_ROTR(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static void sha256_compress(uint32_t *h, const unsigned char *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = k + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += k;
+}
+
+#ifdef SHA256_HAVE_X86
+static int sha256_have_shani = 0; // Set by sha256_init_kernels
+
+/* The SHA extensions keep the state as ABEF / CDGH and run two rounds per instruction */
+__attribute__((target("sha,sse4.1"))) static void sha256_compress_shani(uint32_t *h, const unsigned char *data, size_t blocks)
+{
+    const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xB1);
+    __m128i s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1B);
+    __m128i s0 = _mm_alignr_epi8(t, s1, 8);
+    s1 = _mm_blend_epi16(s1, t, 0xF0);
+
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE)
+    {
+        __m128i abef = s0, cdgh = s1, w[4];
+        for (int g = 0; g < 16; g++)
+        {
+            if (g < 4)
+                w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)), swap);
+            else
+                w[g & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]), _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4)), w[(g + 3) & 3]);
+            __m128i m = _mm_add_epi32(w[g & 3], _mm_loadu_si128((const __m128i *)&sha256_k[4 * g]));
+            s1 = _mm_sha256rnds2_epu32(s1, s0, m);
+            s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(m, 0x0E));
+        }
+        s0 = _mm_add_epi32(s0, abef);
+        s1 = _mm_add_epi32(s1, cdgh);
+    }
+
+    t = _mm_shuffle_epi32(s0, 0x1B);
+    s1 = _mm_shuffle_epi32(s1, 0xB1);
+    _mm_storeu_si128((__m128i *)&h[0], _mm_blend_epi16(t, s1, 0xF0));
+    _mm_storeu_si128((__m128i *)&h[4], _mm_alignr_epi8(s1, t, 8));
+}
+#endif
+
+/* Compress whole blocks with the fastest kernel */
+static void sha256_blocks(uint32_t *h, const unsigned char *data, size_t blocks)
+{
+#ifdef SHA256_HAVE_X86
+    if (sha256_have_shani)
+    {
+        sha256_compress_shani(h, data, blocks);
+        return;
+    }
+#endif
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE)
+        sha256_compress(h, data);
+}
+
+void sha256_init_kernels(void)
+{
+#ifdef SHA256_HAVE_X86
+    uint eax, ebx, ecx, edx;
+    __builtin_cpu_init();
+    // the sha flag is leaf 7 ebx bit 29, older compilers do not know it by name
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        sha256_have_shani = (ebx >> 29 & 1) && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+void sha256_init(Sha256Ctx *ctx)
+{
+    static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(ctx->h, iv, sizeof(iv));
+    ctx->buf_len = 0;
+    ctx->total = 0;
+}
+
+void sha256_update(Sha256Ctx *ctx, const void *data, size_t n)
+{
+    const unsigned char *p = data;
+    ctx->total += n;
+    while (n > 0)
+    {
+        if (ctx->buf_len == 0 && n >= SHA256_BLOCK_SIZE)
+        {
+            size_t blocks = n / SHA256_BLOCK_SIZE;
+            sha256_blocks(ctx->h, p, blocks);
+            p += blocks * SHA256_BLOCK_SIZE;
+            n -= blocks * SHA256_BLOCK_SIZE;
+            continue;
+        }
+        size_t take = SHA256_BLOCK_SIZE - ctx->buf_len < n ? SHA256_BLOCK_SIZE - ctx->buf_len : n;
+        memcpy(ctx->buf + ctx->buf_len, p, take);
+        ctx->buf_len += (uint)take;
+        p += take;
+        n -= take;
+        if (ctx->buf_len == SHA256_BLOCK_SIZE)
+        {
+            sha256_blocks(ctx->h, ctx->buf, 1);
+            ctx->buf_len = 0;
+        }
+    }
+}
+
+void sha256_final(Sha256Ctx *ctx, unsigned char *digest)
+{
+    unsigned long long bits = ctx->total * 8;
+    unsigned char pad = 0x80;
+    sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->buf_len != SHA256_BLOCK_SIZE - 8)
+        sha256_update(ctx, &pad, 1);
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++)
+        length[i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha256_update(ctx, length, 8);
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i] = (unsigned char)(ctx->h[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(ctx->h[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(ctx->h[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)ctx->h[i];
+    }
+}
+
+/* HMAC of a message that fits one block after the key block: inner and outer states are precomputed */
+static void hmac_sha256_short(const Sha256Ctx *inner, const Sha256Ctx *outer, const unsigned char *msg, size_t n, unsigned char *mac)
+{
+    Sha256Ctx ctx = *inner;
+    sha256_update(&ctx, msg, n);
+    sha256_final(&ctx, mac);
+    ctx = *outer;
+    sha256_update(&ctx, mac, SHA256_DIGEST_SIZE);
+    sha256_final(&ctx, mac);
+}
+
+void pbkdf2_sha256(const void *password, size_t password_len, const void *salt, size_t salt_len, unsigned long iterations, unsigned char *out, size_t out_len)
+{
+    unsigned char key[SHA256_BLOCK_SIZE] = {0}, pad[SHA256_BLOCK_SIZE];
+    unsigned char u[SHA256_DIGEST_SIZE], t[SHA256_DIGEST_SIZE];
+    Sha256Ctx inner, outer;
+
+    // a password longer than a block is hashed first (RFC 2104)
+    if (password_len > SHA256_BLOCK_SIZE)
+    {
+        sha256_init(&inner);
+        sha256_update(&inner, password, password_len);
+        sha256_final(&inner, key);
+    }
+    else
+    {
+        memcpy(key, password, password_len);
+    }
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++)
+        pad[i] = key[i] ^ 0x36;
+    sha256_init(&inner);
+    sha256_update(&inner, pad, SHA256_BLOCK_SIZE);
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++)
+        pad[i] = key[i] ^ 0x5c;
+    sha256_init(&outer);
+    sha256_update(&outer, pad, SHA256_BLOCK_SIZE);
+
+    for (uint32_t block = 1; out_len > 0; block++)
+    {
+        // U1 = HMAC(P, S || INT(block)), T = U1 ^ U2 ^ ... ^ Uc
+        Sha256Ctx ctx = inner;
+        unsigned char index[4] = {(unsigned char)(block >> 24), (unsigned char)(block >> 16), (unsigned char)(block >> 8), (unsigned char)block};
+        sha256_update(&ctx, salt, salt_len);
+        sha256_update(&ctx, index, sizeof(index));
+        sha256_final(&ctx, u);
+        ctx = outer;
+        sha256_update(&ctx, u, SHA256_DIGEST_SIZE);
+        sha256_final(&ctx, u);
+        memcpy(t, u, SHA256_DIGEST_SIZE);
+        for (unsigned long i = 1; i < iterations; i++)
+        {
+            hmac_sha256_short(&inner, &outer, u, SHA256_DIGEST_SIZE, u);
+            for (int j = 0; j < SHA256_DIGEST_SIZE; j++)
+                t[j] ^= u[j];
+        }
+        size_t take = out_len < SHA256_DIGEST_SIZE ? out_len : SHA256_DIGEST_SIZE;
+        memcpy(out, t, take);
+        out += take;
+        out_len -= take;
+    }
+    memset(key, 0, sizeof(key));
+    memset(pad, 0, sizeof(pad));
+    memset(&inner, 0, sizeof(inner));
+    memset(&outer, 0, sizeof(outer));
+}
@@ -0,0 +1,38 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h" // Contains user defined types
+
+/*
+ * SHA-256 (FIPS 180-4) and PBKDF2-HMAC-SHA256 (RFC 8018), for turning a
+ * --key passphrase into a cipher key. PBKDF2 keeps the inner and outer
+ * HMAC states of the passphrase, so one iteration is two compressions.
+ * Cpus with the SHA extensions compress with them, which makes hashing a
+ * whole carrier (the output cache key) cheap enough to do on every encode.
+ */
+
+#define SHA256_BLOCK_SIZE 64  // Bytes per compression
+#define SHA256_DIGEST_SIZE 32 // Bytes of a digest
+
+typedef struct _Sha256Ctx
+{
+    uint32_t h[8];                         // To store the chaining value
+    unsigned char buf[SHA256_BLOCK_SIZE];  // To store a partial block
+    uint buf_len;                          // To store the bytes in buf
+    unsigned long long total;              // To store the bytes hashed so far
+} Sha256Ctx;
+
+/* Pick the compression kernel for this cpu, call once at startup */
+void sha256_init_kernels(void);
+
+void sha256_init(Sha256Ctx *ctx);
+void sha256_update(Sha256Ctx *ctx, const void *data, size_t n);
+void sha256_final(Sha256Ctx *ctx, unsigned char *digest);
+
+/* Derive out_len bytes from a password and a salt with the given iteration count */
+void pbkdf2_sha256(const void *password, size_t password_len, const void *salt, size_t salt_len, unsigned long iterations, unsigned char *out, size_t out_len);
+
+#endif
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../serve.h"
+
+/*
+ * Small client for the --serve daemon.
+ *
+ *   stegno_client.out [--memfd] [--channels BGR] [--key PASS | --key-fd N | --key-env VAR] <socket> -e <source.bmp> <secret> [output.bmp]
+ *   stegno_client.out [--memfd] [--key PASS | --key-fd N | --key-env VAR] <socket> -d <stego.bmp> [output_secret_base]
+ *
+ * Files are opened here and only their descriptors are passed to the
+ * daemon. With --memfd the inputs are first staged in memfds, the way an
+ * in-memory producer would hand its buffers over. A passphrase is sent in
+ * the request, read the same way as by stegno.out.
+ */
+
+/* Copy everything from src_fd to dest_fd starting at offset 0 */
+static int copy_fd(int src_fd, int dest_fd)
+{
+    char buffer[65536];
+    ssize_t n;
+
+    lseek(src_fd, 0, SEEK_SET);
+    while ((n = read(src_fd, buffer, sizeof(buffer))) > 0)
+    {
+        if (write(dest_fd, buffer, n) != n)
+            return -1;
+    }
+    return n < 0 ? -1 : 0;
+}
+
+/* Open an input file, optionally staged in a memfd */
+static int open_input(const char *fname, int use_memfd)
+{
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || !use_memfd)
+        return fd;
+
+    int mfd = memfd_create(fname, MFD_CLOEXEC);
+    if (mfd < 0 || copy_fd(fd, mfd) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    lseek(mfd, 0, SEEK_SET);
+    return mfd;
+}
+
+/* Passphrase of --key PASS, --key-fd N (first line) or --key-env VAR into key */
+static int read_key(const char *option, char *value, char *key)
+{
+    size_t len = 0;
+
+    if (!strcmp(option, "--key-fd"))
+    {
+        char *end;
+        long fd = strtol(value, &end, 10);
+        ssize_t n = 0;
+        if (*end != '\0' || fd < 0 || fd > INT_MAX)
+        {
+            fprintf(stderr, "Error: --key-fd expects a file descriptor\n");
+            return -1;
+        }
+        while (len <= CHACHA_PASSPHRASE_MAX && (n = read((int)fd, key + len, 1)) == 1 && key[len] != '\n')
+            len++;
+        if (n < 0)
+        {
+            perror("--key-fd");
+            return -1;
+        }
+        if (len > 0 && len <= CHACHA_PASSPHRASE_MAX && key[len - 1] == '\r')
+            len--;
+    }
+    else
+    {
+        const char *source = !strcmp(option, "--key-env") ? getenv(value) : value;
+        if (source == NULL)
+        {
+            fprintf(stderr, "Error: --key-env: %s is not set\n", value);
+            return -1;
+        }
+        len = strnlen(source, CHACHA_PASSPHRASE_MAX + 1);
+        if (len <= CHACHA_PASSPHRASE_MAX)
+            memcpy(key, source, len);
+        // keep the passphrase out of /proc/<pid>/cmdline from here on
+        if (source == value)
+            memset(value, 0, strlen(value));
+    }
+    if (len == 0 || len > CHACHA_PASSPHRASE_MAX)
+    {
+        fprintf(stderr, "Error: the passphrase must be 1 to %d bytes\n", CHACHA_PASSPHRASE_MAX);
+        return -1;
+    }
+    key[len] = '\0';
+    return 0;
+}
+
+static int send_request(int sock, ServeRequest *req, int *fds, int nfds)
+{
+    char control[CMSG_SPACE(sizeof(int) * SERVE_MAX_FDS)] = {0};
+    struct iovec iov = {req, sizeof(*req)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+    return sendmsg(sock, &msg, 0) == sizeof(*req) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int use_memfd = 0;
+    int arg = 1;
+    ServeRequest req = {0};
+
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); arg++)
+    {
+        if (!strcmp(argv[arg], "--memfd"))
+        {
+            use_memfd = 1;
+        }
+        else if ((!strcmp(argv[arg], "--key") || !strcmp(argv[arg], "--key-fd") || !strcmp(argv[arg], "--key-env")) && arg + 1 < argc)
+        {
+            if (read_key(argv[arg], argv[arg + 1], req.key) < 0)
+                return 1;
+            arg++;
+        }
+        else if (!strcmp(argv[arg], "--channels") && arg + 1 < argc)
+        {
+            // B = 1, G = 2, R = 4, same bits as the daemon
+            for (char *ch = argv[++arg]; *ch != '\0'; ch++)
+                req.channel_mask |= (*ch == 'B' || *ch == 'b') ? 1 : (*ch == 'G' || *ch == 'g') ? 2 : (*ch == 'R' || *ch == 'r') ? 4 : (*ch == 'A' || *ch == 'a') ? 8 : 0;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (argc - arg < 3 || (strcmp(argv[arg + 1], "-e") && strcmp(argv[arg + 1], "-d")))
+    {
+        fprintf(stderr, "usage: %s [--memfd] [--channels BGR] [--key PASS | --key-fd N | --key-env VAR] <socket> -e <source.bmp> <secret> [output.bmp]\n", argv[0]);
+        fprintf(stderr, "       %s [--memfd] [--key PASS | --key-fd N | --key-env VAR] <socket> -d <stego.bmp> [output_secret_base]\n", argv[0]);
+        return 1;
+    }
+
+    char *sock_path = argv[arg];
+    int encode = !strcmp(argv[arg + 1], "-e");
+    int fds[SERVE_MAX_FDS];
+    int nfds;
+    char out_fname[SERVE_FNAME_SIZE + 8];
+
+    if (encode)
+    {
+        if (argc - arg < 4)
+        {
+            fprintf(stderr, "Error: missing secret file\n");
+            return 1;
+        }
+        req.operation = e_encode;
+        snprintf(req.secret_fname, sizeof(req.secret_fname), "%s", argv[arg + 3]);
+        snprintf(out_fname, sizeof(out_fname), "%s", argc - arg > 4 ? argv[arg + 4] : "output.bmp");
+        fds[0] = open_input(argv[arg + 2], use_memfd);
+        fds[1] = open_input(argv[arg + 3], use_memfd);
+        fds[2] = open(out_fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        nfds = 3;
+    }
+    else
+    {
+        // The extension is only known after decoding, so collect in a memfd
+        req.operation = e_decode;
+        fds[0] = open_input(argv[arg + 2], use_memfd);
+        fds[1] = memfd_create("secret", MFD_CLOEXEC);
+        nfds = 2;
+    }
+    for (int i = 0; i < nfds; i++)
+    {
+        if (fds[i] < 0)
+        {
+            perror("open");
+            return 1;
+        }
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        return 1;
+    }
+
+    ServeReply reply;
+    if (send_request(sock, &req, fds, nfds) < 0 || recv(sock, &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply))
+    {
+        perror("request");
+        return 1;
+    }
+    close(sock);
+    int keyed = req.key[0] != '\0';
+    memset(req.key, 0, sizeof(req.key));
+
+    if (reply.status == SERVE_KEY_REFUSED)
+    {
+        fprintf(stderr, "🔑 the image is encrypted: %s\n", keyed ? "wrong passphrase" : "pass the passphrase with --key");
+        return 1;
+    }
+    if (reply.status != e_success)
+    {
+        fprintf(stderr, "❌ daemon reported failure\n");
+        return 1;
+    }
+
+    if (!encode)
+    {
+        reply.extn_secret_file[4] = '\0';
+        snprintf(out_fname, sizeof(out_fname), "%s%s", argc - arg > 3 ? strtok(argv[arg + 3], ".") : "Decode", reply.extn_secret_file);
+        int out_fd = open(out_fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out_fd < 0 || copy_fd(fds[1], out_fd) < 0)
+        {
+            perror(out_fname);
+            return 1;
+        }
+        close(out_fd);
+    }
+
+    printf("✅ %s: %ld bytes (%s) -> %s\n", encode ? "encoded" : "decoded", reply.size_secret_file, reply.extn_secret_file, out_fname);
+    return 0;
+}
@@ -15,6 +15,14 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_serve,
+    e_quality,
+    e_archive,
+    e_list,
+    e_extract,
+    e_watch,
+    e_index,
+    e_analysis,
     e_unsupported
 } OperationType;
 
@@ -0,0 +1,513 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "watch.h"
+#include "encode.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+
+/* Secret extensions a job may use, as accepted by -e */
+static const char *watch_secret_extns[] = {".txt", ".c", ".sh", ".h"};
+#define WATCH_NEXTNS (sizeof(watch_secret_extns) / sizeof(watch_secret_extns[0]))
+
+/* Buckets of the table of names in flight */
+#define WATCH_BUCKETS 1024
+
+/* One pair waiting for its partner, or queued for a worker */
+typedef struct _WatchJob
+{
+    char base[NAME_MAX + 1]; // Common name of carrier and secret
+    int have_carrier;        // <base>.bmp is complete
+    int secret_extn;         // Index in watch_secret_extns, -1 until complete
+    int again;               // A file of the pair was written again while in flight
+    dev_t carrier_dev, secret_dev; // Files the worker opened, only these are unlinked
+    ino_t carrier_ino, secret_ino;
+    struct _WatchJob *next;
+    struct _WatchJob *inflight_next; // Chain in the table of names in flight
+} WatchJob;
+
+static char *watch_in_dir, *watch_out_dir;
+static int out_dir_fd = -1;       // Output directory, for syncfs
+static WatchJob *pending;         // Half complete pairs
+static WatchJob *inflight[WATCH_BUCKETS]; // Queued, busy and committing jobs by name
+static WatchJob *queue_head, *queue_tail;
+static WatchJob *committing;      // Published jobs whose inputs wait for the next sync
+static uint committing_count;
+static uint busy;                 // Jobs taken by workers and not finished yet
+static int stopping;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* One log line, workers never interleave */
+static void watch_log(const char *format, ...)
+{
+    va_list args;
+    pthread_mutex_lock(&log_lock);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    fflush(stdout);
+    pthread_mutex_unlock(&log_lock);
+}
+
+static uint name_bucket(const char *name, size_t len)
+{
+    uint hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash % WATCH_BUCKETS;
+}
+
+/* The job that owns a name from the queue until its inputs are committed (queue_lock held) */
+static WatchJob *find_inflight(const char *name, size_t len)
+{
+    WatchJob *job = inflight[name_bucket(name, len)];
+    while (job != NULL && (strlen(job->base) != len || strncmp(job->base, name, len)))
+        job = job->inflight_next;
+    return job;
+}
+
+/* Queue a complete pair, its name is in flight from now on (queue_lock held) */
+static void enqueue(WatchJob *job)
+{
+    uint bucket = name_bucket(job->base, strlen(job->base));
+    job->inflight_next = inflight[bucket];
+    inflight[bucket] = job;
+
+    job->next = NULL;
+    if (queue_tail != NULL)
+        queue_tail->next = job;
+    else
+        queue_head = job;
+    queue_tail = job;
+    pthread_cond_signal(&queue_cond);
+}
+
+static void file_completed(const char *name, int rescan);
+
+/*
+ * Forget a finished job (queue_lock held). When its files were written
+ * again while it was in flight, whatever of the pair is in the spool now
+ * is picked up as a new job.
+ */
+static void release_job(WatchJob *job)
+{
+    char name[NAME_MAX + 8], path[PATH_MAX];
+    struct stat st;
+
+    WatchJob **link = &inflight[name_bucket(job->base, strlen(job->base))];
+    while (*link != job)
+        link = &(*link)->inflight_next;
+    *link = job->inflight_next;
+
+    for (int i = -1; job->again && i < (int)WATCH_NEXTNS; i++)
+    {
+        snprintf(name, sizeof(name), "%s%s", job->base, i < 0 ? ".bmp" : watch_secret_extns[i]);
+        snprintf(path, sizeof(path), "%s/%s", watch_in_dir, name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            file_completed(name, 0);
+    }
+    free(job);
+}
+
+/*
+ * Record a completed file, hand the pair over once both halves are there
+ * (queue_lock held). A name in flight is not queued twice: a rescan finds
+ * its own inputs, an event means the pair is read again once released.
+ */
+static void file_completed(const char *name, int rescan)
+{
+    size_t len = strlen(name);
+    int extn = -1, carrier = 0;
+
+    if (name[0] == '.')
+        return;
+    if (len > 4 && !strcmp(name + len - 4, ".bmp"))
+    {
+        carrier = 1;
+        len -= 4;
+    }
+    for (uint i = 0; i < WATCH_NEXTNS && !carrier && extn < 0; i++)
+    {
+        size_t elen = strlen(watch_secret_extns[i]);
+        if (len > elen && !strcmp(name + len - elen, watch_secret_extns[i]))
+        {
+            extn = (int)i;
+            len -= elen;
+        }
+    }
+    if (!carrier && extn < 0)
+        return;
+
+    WatchJob *running = find_inflight(name, len);
+    if (running != NULL)
+    {
+        if (!rescan)
+            running->again = 1;
+        return;
+    }
+
+    WatchJob **link = &pending;
+    while (*link != NULL && (strlen((*link)->base) != len || strncmp((*link)->base, name, len)))
+        link = &(*link)->next;
+    WatchJob *job = *link;
+    if (job == NULL)
+    {
+        job = calloc(1, sizeof(*job));
+        if (job == NULL)
+            return;
+        memcpy(job->base, name, len);
+        job->secret_extn = -1;
+        job->next = pending;
+        pending = job;
+        link = &pending;
+    }
+    if (carrier)
+        job->have_carrier = 1;
+    else
+        job->secret_extn = extn;
+
+    if (job->have_carrier && job->secret_extn >= 0)
+    {
+        *link = job->next;
+        enqueue(job);
+    }
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Unlink an input the job read, 0 when another file has taken its name since */
+static int unlink_input(const char *path, dev_t dev, ino_t ino)
+{
+    struct stat st;
+    if (lstat(path, &st) != 0)
+        return 1;
+    if (st.st_dev != dev || st.st_ino != ino)
+        return 0;
+    unlink(path);
+    return 1;
+}
+
+/* Make a batch of outputs durable with one syncfs, then drop their inputs from the spool */
+static void commit_batch(WatchJob *batch)
+{
+    char path[PATH_MAX];
+    uint count = 0;
+
+    int synced = syncfs(out_dir_fd) == 0;
+    if (!synced)
+        perror("syncfs");
+    while (batch != NULL)
+    {
+        WatchJob *job = batch;
+        batch = job->next;
+        // unsynced inputs stay in the spool, the next start encodes them again; rewritten ones are read again,
+        // and a file that replaced an input under its name (not seen as an event) is picked up as a new job
+        if (synced && !job->again)
+        {
+            snprintf(path, sizeof(path), "%s/%s.bmp", watch_in_dir, job->base);
+            if (!unlink_input(path, job->carrier_dev, job->carrier_ino))
+                job->again = 1;
+            snprintf(path, sizeof(path), "%s/%s%s", watch_in_dir, job->base, watch_secret_extns[job->secret_extn]);
+            if (!unlink_input(path, job->secret_dev, job->secret_ino))
+                job->again = 1;
+        }
+        pthread_mutex_lock(&queue_lock);
+        release_job(job);
+        pthread_mutex_unlock(&queue_lock);
+        count++;
+    }
+    if (synced)
+        watch_log("💽 %u outputs synced, inputs removed\n", count);
+}
+
+/*
+ * A job is done: a published one joins the group commit. The batch is
+ * synced when it is full, or by the last busy worker once the queue is
+ * dry, so jobs finishing together share one syncfs.
+ */
+static void finish_job(WatchJob *job, Status status)
+{
+    WatchJob *batch = NULL;
+
+    pthread_mutex_lock(&queue_lock);
+    busy--;
+    if (status == e_success)
+    {
+        job->next = committing;
+        committing = job;
+        committing_count++;
+    }
+    else
+    {
+        release_job(job);
+    }
+    if (committing != NULL && (committing_count >= WATCH_COMMIT_BATCH || (queue_head == NULL && busy == 0)))
+    {
+        batch = committing;
+        committing = NULL;
+        committing_count = 0;
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    if (batch != NULL)
+        commit_batch(batch);
+}
+
+/* Encode one pair straight to its unnamed output, linked in when complete */
+static Status process_job(WatchJob *job, EncodeInfo *encInfo)
+{
+    char src[PATH_MAX], secret[PATH_MAX], secret_name[NAME_MAX + 8], out[PATH_MAX];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    snprintf(src, sizeof(src), "%s/%s.bmp", watch_in_dir, job->base);
+    snprintf(secret_name, sizeof(secret_name), "%s%s", job->base, watch_secret_extns[job->secret_extn]);
+    snprintf(secret, sizeof(secret), "%s/%s", watch_in_dir, secret_name);
+    snprintf(out, sizeof(out), "%s/%s.bmp", watch_out_dir, job->base);
+
+    // Reset the job state but keep the warm buffers
+    EncodeInfo warm = *encInfo;
+    memset(encInfo, 0, sizeof(*encInfo));
+    encInfo->image_data = warm.image_data;
+    encInfo->image_data_alloc = warm.image_data_alloc;
+    encInfo->slot_buffer = warm.slot_buffer;
+    encInfo->slot_buffer_alloc = warm.slot_buffer_alloc;
+
+    // Both inputs are opened here, so the files encoded are the ones whose inodes are kept for the unlink,
+    // and only the bare secret name reaches the extension checks
+    encInfo->src_image_fname = src;
+    encInfo->secret_fname = secret_name;
+    encInfo->fptr_src_image = fopen(src, "rb");
+    encInfo->fptr_secret = fopen(secret, "rb");
+    encInfo->stego_image_fname = out;
+    encInfo->defer_sync = 1;
+    encInfo->quiet = 1;
+
+    Status status = e_failure;
+    struct stat carrier_st, secret_st;
+    if (encInfo->fptr_src_image == NULL || fstat(fileno(encInfo->fptr_src_image), &carrier_st) != 0)
+    {
+        perror(src);
+    }
+    else if (encInfo->fptr_secret == NULL || fstat(fileno(encInfo->fptr_secret), &secret_st) != 0)
+    {
+        perror(secret);
+    }
+    else
+    {
+        job->carrier_dev = carrier_st.st_dev;
+        job->carrier_ino = carrier_st.st_ino;
+        job->secret_dev = secret_st.st_dev;
+        job->secret_ino = secret_st.st_ino;
+        status = do_encoding(encInfo);
+    }
+    close_files(encInfo);
+
+    if (status == e_success)
+        watch_log("📥 %s -> %s (%.1f ms)\n", job->base, out, elapsed_ms(&start));
+    else
+        watch_log("⚠️ ERROR: %s failed, inputs left in %s\n", job->base, watch_in_dir);
+    return status;
+}
+
+static void *watch_worker(void *arg)
+{
+    (void)arg;
+    // Buffers of this worker, kept warm across jobs
+    EncodeInfo encInfo = {0};
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_head == NULL && !stopping)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        if (stopping)
+        {
+            pthread_mutex_unlock(&queue_lock);
+            break;
+        }
+        WatchJob *job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL)
+            queue_tail = NULL;
+        busy++;
+        pthread_mutex_unlock(&queue_lock);
+
+        finish_job(job, process_job(job, &encInfo));
+    }
+
+    free(encInfo.image_data);
+    free(encInfo.slot_buffer);
+    return NULL;
+}
+
+/* Pairs dropped while we were not running */
+static void scan_spool(void)
+{
+    DIR *dir = opendir(watch_in_dir);
+    if (dir == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&queue_lock);
+    for (struct dirent *de; (de = readdir(dir)) != NULL;)
+    {
+        if (de->d_type == DT_REG || de->d_type == DT_UNKNOWN)
+            file_completed(de->d_name, 1);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    closedir(dir);
+}
+
+Status do_watching(char *in_dir, char *out_dir)
+{
+    pthread_t workers[WATCH_MAX_WORKERS];
+    sigset_t set;
+
+    watch_in_dir = in_dir;
+    watch_out_dir = out_dir;
+
+    int in_fd = inotify_init1(IN_CLOEXEC);
+    if (in_fd < 0 || inotify_add_watch(in_fd, in_dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        perror(in_dir);
+        return e_failure;
+    }
+    out_dir_fd = open(out_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (access(out_dir, W_OK) < 0 || out_dir_fd < 0)
+    {
+        perror(out_dir);
+        if (out_dir_fd >= 0)
+            close(out_dir_fd);
+        out_dir_fd = -1;
+        close(in_fd);
+        return e_failure;
+    }
+
+    // Workers never see SIGINT / SIGTERM, the main loop reads them from a signalfd
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    int sig_fd = signalfd(-1, &set, SFD_CLOEXEC);
+    if (sig_fd < 0)
+    {
+        perror("signalfd");
+        pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        close(out_dir_fd);
+        out_dir_fd = -1;
+        close(in_fd);
+        return e_failure;
+    }
+
+    long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 2)
+        nworkers = 2;
+    if (nworkers > WATCH_MAX_WORKERS)
+        nworkers = WATCH_MAX_WORKERS;
+
+    int started = 0;
+    for (int i = 0; i < nworkers; i++)
+    {
+        if (pthread_create(&workers[started], NULL, watch_worker, NULL) == 0)
+            started++;
+    }
+    if (started == 0)
+    {
+        printf("⚠️ ERROR: unable to start the watcher.\n");
+        pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        close(sig_fd);
+        close(out_dir_fd);
+        out_dir_fd = -1;
+        close(in_fd);
+        return e_failure;
+    }
+
+    printf("👀 Watching %s -> %s with %d workers (Ctrl+C to stop)\n", in_dir, out_dir, started);
+    fflush(stdout);
+    scan_spool();
+
+    // Events are aligned to struct inotify_event
+    char events[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {{in_fd, POLLIN, 0}, {sig_fd, POLLIN, 0}};
+    while (!(fds[1].revents & POLLIN))
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (!(fds[0].revents & POLLIN))
+            continue;
+        ssize_t n = read(in_fd, events, sizeof(events));
+        for (char *p = events; n > 0 && p < events + n;)
+        {
+            struct inotify_event *event = (struct inotify_event *)p;
+            if (event->len > 0 && !(event->mask & IN_ISDIR))
+            {
+                pthread_mutex_lock(&queue_lock);
+                file_completed(event->name, 0);
+                pthread_mutex_unlock(&queue_lock);
+            }
+            // the spool overflowed, pick up whatever got lost
+            if (event->mask & IN_Q_OVERFLOW)
+                scan_spool();
+            p += sizeof(*event) + event->len;
+        }
+    }
+
+    // Let in-flight jobs finish, queued pairs stay in the spool
+    pthread_mutex_lock(&queue_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    // the last published jobs still wait for their sync
+    if (committing != NULL)
+        commit_batch(committing);
+    committing = NULL;
+    committing_count = 0;
+    while (queue_head != NULL)
+    {
+        WatchJob *job = queue_head;
+        queue_head = job->next;
+        free(job);
+    }
+    while (pending != NULL)
+    {
+        WatchJob *job = pending;
+        pending = job->next;
+        free(job);
+    }
+    memset(inflight, 0, sizeof(inflight));
+    close(sig_fd);
+    close(in_fd);
+    close(out_dir_fd);
+    out_dir_fd = -1;
+    printf("\n👋 Watcher stopped.\n");
+    return e_success;
+}
@@ -0,0 +1,29 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Watch-folder mode (-w indir outdir)
+ * -----------------------------------
+ * indir is watched with inotify. A job is a carrier <name>.bmp plus a
+ * secret <name>.txt / .c / .sh / .h; once both are completely written
+ * (IN_CLOSE_WRITE or moved in) the pair goes to a pool of workers that
+ * keep their buffers warm. The stego image is linked in as
+ * outdir/<name>.bmp only once complete, so readers never see a partial
+ * file. Durability is group committed: finished jobs collect until the
+ * queue runs dry (or a batch is full), one syncfs makes all their
+ * outputs durable, and only then are their inputs removed from the
+ * spool, so a crash never loses a pair. An input is only removed while
+ * its name still holds the file the worker read; a newer file under
+ * that name becomes the next job. Pairs already waiting at startup are
+ * processed first.
+ */
+
+#define WATCH_MAX_WORKERS 16 // Upper bound of the worker pool
+#define WATCH_COMMIT_BATCH 64 // Most outputs made durable by one syncfs
+
+/* Watch indir until SIGINT / SIGTERM */
+Status do_watching(char *in_dir, char *out_dir);
+
+#endif